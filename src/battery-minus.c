@@ -16,22 +16,23 @@
 
 #include <inttypes.h>
 #include <pebble.h>
-#include "dict_tools.h"
+#include "messages.h"
+#include "profile.h"
 #include "simple_dialog.h"
 #include "storage.h"
 
 #undef DISPLAY_TEST_DATA
+#undef TRACE_FRESHNESS
 
 static Window *window;
 static SimpleMenuLayer *menu_layer;
 static SimpleMenuSection menu_section;
-static SimpleMenuItem menu_items[PAGE_LENGTH + 2];
+static SimpleMenuItem menu_items[PROFILE_LOG_WINDOW + SESSION_LENGTH + 3];
 
-static struct event current_page[PAGE_LENGTH];
-static const char *titles[PAGE_LENGTH];
-static const char *dates[PAGE_LENGTH];
+static struct page current_page;
 static int cfg_wakeup_time = -1;
 static char send_status[64];
+static char last_sync_status[32];
 
 static void
 do_start_worker(int index, void *context);
@@ -39,6 +40,21 @@ do_start_worker(int index, void *context);
 static void
 do_stop_worker(int index, void *context);
 
+static void
+do_show_history(int index, void *context);
+
+static void
+do_toggle_session(int index, void *context);
+
+static void
+handle_history(const struct msg_command *msg);
+
+static void
+history_failed(void);
+
+static void
+stream_done(void);
+
 /*************
  * UTILITIES *
  *************/
@@ -48,16 +64,90 @@ close_app(void) {
 	window_stack_pop_all(true);
 }
 
-static unsigned
-first_index(struct event *page, size_t page_length) {
-	unsigned j;
+/* launched to sync in the background rather than by the user */
+static bool
+is_auto_sync(void) {
+	return launch_reason() == APP_LAUNCH_WAKEUP
+	    || launch_reason() == APP_LAUNCH_WORKER;
+}
 
-	for (j = 1;
-	    j < page_length && page[j - 1].time < page[j].time;
-	    j += 1);
-	if (j >= page_length || !page[j].time) j = 0;
+/******************************
+ * BACKGROUND SYNC ACCOUNTING *
+ ******************************/
+
+#define PERSIST_KEY_SYNC_RUNS	410
+#define SYNC_RUN_COUNT		PROFILE_SYNC_RUNS
+#define DEFAULT_SYNC_BUDGET	60
+
+/* outcome of a background sync */
+#define SYNC_DONE	0	/* every event acknowledged, not all posted */
+#define SYNC_NOTHING	1	/* nothing to send */
+#define SYNC_POSTED	2	/* phone reported everything as posted */
+#define SYNC_FAILED	3	/* outbox failure while connected */
+#define SYNC_TIMEOUT	4	/* time budget exhausted */
+
+struct __attribute__((__packed__)) sync_run {
+	time_t start;
+	uint16_t duration_ms;
+	uint8_t sent;
+	uint8_t outcome;
+};
+
+static time_t launch_time;
+static uint16_t launch_time_ms;
+static AppTimer *budget_timer;
+static bool is_closing;
 
-	return j;
+static void
+finish_auto_sync(uint8_t outcome, unsigned sent) {
+	struct sync_run runs[SYNC_RUN_COUNT];
+	time_t now;
+	uint16_t now_ms;
+	int32_t duration;
+
+	if (is_closing) return;
+	is_closing = true;
+
+	time_ms(&now, &now_ms);
+	duration = (now - launch_time) * 1000 + now_ms - launch_time_ms;
+	if (duration > UINT16_MAX) duration = UINT16_MAX;
+
+	if (persist_read_data(PERSIST_KEY_SYNC_RUNS, runs, sizeof runs)
+	    != sizeof runs)
+		memset(runs, 0, sizeof runs);
+	memmove(runs + 1, runs, sizeof runs - sizeof runs[0]);
+	runs[0].start = launch_time;
+	runs[0].duration_ms = duration;
+	runs[0].sent = sent > UINT8_MAX ? UINT8_MAX : sent;
+	runs[0].outcome = outcome;
+	persist_write_data(PERSIST_KEY_SYNC_RUNS, runs, sizeof runs);
+
+	APP_LOG(APP_LOG_LEVEL_INFO,
+	    "background sync closing after %" PRIi32 " ms, outcome %u, %u sent",
+	    duration, (unsigned)outcome, sent);
+
+	if (budget_timer) app_timer_cancel(budget_timer);
+	budget_timer = 0;
+	close_app();
+}
+
+static void
+format_last_sync(void) {
+	struct sync_run run;
+	static const char *outcomes[] = { "done", "idle", "posted", "failed",
+	    "timeout" };
+
+	if (persist_read_data(PERSIST_KEY_SYNC_RUNS, &run, sizeof run)
+	    != sizeof run || !run.start)
+		return;
+
+	snprintf(last_sync_status, sizeof last_sync_status,
+	    "Auto: %u sent, %u.%02us %s",
+	    (unsigned)run.sent,
+	    (unsigned)run.duration_ms / 1000,
+	    (unsigned)run.duration_ms % 1000 / 10,
+	    run.outcome < sizeof outcomes / sizeof *outcomes
+	    ? outcomes[run.outcome] : "?");
 }
 
 static void
@@ -70,16 +160,48 @@ mark_menu_dirty(void) {
  * DATA UPLOAD TO WEB *
  **********************/
 
-#define MSG_KEY_LAST_SENT	110
-#define MSG_KEY_LAST_POSTED	120
-#define MSG_KEY_DATA_TIME	210
-#define MSG_KEY_DATA_LINE	220
-#define MSG_KEY_CFG_WAKEUP_TIME	320
+#define NO_CURSOR UINT32_MAX
 
-static unsigned sent_index;
+static uint32_t sent_seq;
+static unsigned sent_count;
+static uint32_t sent_skipped;
+static uint32_t sent_end;
 static unsigned sent_done;
-static time_t sent_last_key;
-
+static uint32_t sent_cursor = NO_CURSOR;	/* start of the last stream */
+static bool is_sending;
+static bool is_sending_marker;
+static bool is_interrupted;
+static bool is_log_reset;	/* until the phone receives a message */
+
+/* last event acknowledged by the phone, saved under MSG_KEY_LAST_SEQ so
+ * that the next launch streams without waiting for the cursor of the
+ * phone, which then only corrects it */
+static uint32_t acked_seq;
+static uint32_t saved_acked_seq;
+static bool is_cursor_confirmed;
+static bool has_correction;
+static uint32_t correction_seq;
+
+/* last event posted by the phone, which a background sync waits for */
+static uint32_t last_posted;
+static bool is_awaiting_post;
+
+/* ranges requested again by the phone, served in order after the current
+ * stream, the last one growing to cover new requests when the queue is full */
+#define RESYNC_QUEUE_LENGTH 4
+
+static uint32_t resync_queue[RESYNC_QUEUE_LENGTH][2];
+static unsigned resync_count;
+static uint32_t resync_first;	/* range being resent */
+static uint32_t resync_last;
+static bool is_resync;
+
+/* history query, which shares the outbox with the event stream */
+static bool is_querying;
+static bool has_pending_start;
+static uint32_t pending_last_seq;
+
+/* keep in sync with tools/battery-log.c and tools/csv-ingest.c */
 static const char keyword_anomalous[] = "error";
 static const char keyword_charge_start[] = "charge";
 static const char keyword_charge_stop[] = "dischg";
@@ -90,6 +212,8 @@ static const char keyword_start[] = "start";
 static const char keyword_start_charging[] = "start+";
 static const char keyword_stop[] = "stop";
 static const char keyword_stop_charging[] = "stop+";
+static const char keyword_sample[] = "sample";
+static const char keyword_sample_charging[] = "sample+";
 
 static bool
 event_csv_image(char *buffer, size_t size, struct event *event) {
@@ -151,6 +275,13 @@ event_csv_image(char *buffer, size_t size, struct event *event) {
 		has_int_2 = false;
 		break;
 
+	    case SAMPLE:
+		keyword = (event->after & 0x80)
+		    ? keyword_sample_charging : keyword_sample;
+		int_1 = event->after & 0x7f;
+		has_int_2 = false;
+		break;
+
 	    default:
 		keyword = (event->before & 0x80)
 		    ? ((event->after & 0x80)
@@ -179,148 +310,472 @@ event_csv_image(char *buffer, size_t size, struct event *event) {
 	return true;
 }
 
-static bool
-send_event(struct event *event) {
-	AppMessageResult msg_result;
-	DictionaryIterator *iter;
-	DictionaryResult dict_result;
-	char buffer[64];
-	bool result = true;
+#ifdef TRACE_FRESHNESS
+/* fill the worker stamps and the send delay of an event */
+static void
+fill_trace(struct msg_data *msg, uint32_t seq, struct event *event) {
+	struct trace_entry trace[PAGE_LENGTH];
+	struct trace_entry *entry = trace + seq % PAGE_LENGTH;
+	time_t now;
+	uint16_t now_ms;
 
-	if (!event) return false;
+	if (persist_read_data(TRACE_KEY, trace, sizeof trace) != sizeof trace)
+		return;
 
-	if (!event_csv_image(buffer, sizeof buffer, event))
-		return false;
+	time_ms(&now, &now_ms);
+	msg->trace_ms = entry->handler_ms;
+	msg->trace_flush = entry->flush_ms;
+	msg->trace_send
+	    = (now - event->time) * 1000 + now_ms - entry->handler_ms;
+	msg->fields |= MSG_DATA_TRACE_MS | MSG_DATA_TRACE_FLUSH
+	    | MSG_DATA_TRACE_SEND;
+}
+#endif
+
+/* send in one message the consecutive events from seq, up to
+ * PROFILE_SEND_BATCH of them and before sent_end, returning their count */
+static unsigned
+send_events(uint32_t seq, uint32_t skipped) {
+	AppMessageResult msg_result;
+	DictionaryIterator *iter;
+	struct msg_data msg = { 0 };
+	struct event *first = page_event(&current_page, seq);
+	struct event *event;
+	char buffer[PROFILE_SEND_BATCH * PROFILE_LINE_SIZE];
+	size_t length = 0;
+	unsigned count = 0;
+
+	if (!first) return 0;
+
+	while (count < PROFILE_SEND_BATCH && seq + count < sent_end
+	    && (event = page_event(&current_page, seq + count))) {
+		if (count) buffer[length++] = '\n';
+		if (!event_csv_image(buffer + length, sizeof buffer - length,
+		    event)) {
+			if (!count) return 0;
+			buffer[--length] = 0;
+			break;
+		}
+		length += strlen(buffer + length);
+		count += 1;
+	}
 
 	msg_result = app_message_outbox_begin(&iter);
 	if (msg_result) {
 		APP_LOG(APP_LOG_LEVEL_ERROR,
-		    "send_event: app_message_outbox_begin returned %d",
+		    "send_events: app_message_outbox_begin returned %d",
 		    (int)msg_result);
-		return false;
+		return 0;
 	}
 
-	dict_result = dict_write_int(iter, MSG_KEY_DATA_TIME,
-	    &event->time, sizeof event->time, true);
-	if (dict_result != DICT_OK) {
+	/* the outbox holds MSG_DATA_SIZE bytes, so writes cannot fail */
+	msg.fields = (skipped ? MSG_DATA_SKIPPED : 0)
+	    | (is_log_reset ? MSG_DATA_RESET : 0);
+	msg.time = first->time;
+	msg.line = buffer;
+	msg.seq = seq;
+	msg.skipped = skipped;
+	msg.reset = 1;
+#ifdef TRACE_FRESHNESS
+	fill_trace(&msg, seq, first);
+#endif
+	msg_data_write(iter, &msg);
+
+	msg_result = app_message_outbox_send();
+	if (msg_result) {
 		APP_LOG(APP_LOG_LEVEL_ERROR,
-		    "send_event: [%d] unable to add data time %" PRIi32,
-		    (int)dict_result, event->time);
-		result = false;
+		    "send_events: app_mesage_outbox_send returned %d",
+		    (int)msg_result);
+		return 0;
 	}
 
-	dict_result = dict_write_cstring(iter, MSG_KEY_DATA_LINE, buffer);
-	if (dict_result != DICT_OK) {
+	return count;
+}
+
+/* PebbleKit JS only runs while the app is open, so closing as soon as the
+ * stream is acknowledged would cut the uploads short: the background sync
+ * stays open until the phone reports everything as posted, spending radio
+ * and budget time rather than leaving the queue to the next launch */
+static void
+finish_once_posted(void) {
+	if (last_posted < acked_seq) {
+		is_awaiting_post = true;
+		return;
+	}
+
+	finish_auto_sync(sent_done ? SYNC_POSTED : SYNC_NOTHING, sent_done);
+}
+
+static void
+handle_nothing_to_do(void) {
+	/* events may have been sent from the saved cursor */
+	if (is_auto_sync())
+		finish_once_posted();
+	else {
+		snprintf(send_status, sizeof send_status, "Done (%u)",
+		    sent_done);
+		mark_menu_dirty();
+	}
+}
+
+static void
+save_acked_seq(void) {
+	if (acked_seq == saved_acked_seq) return;
+	persist_write_int(MSG_KEY_LAST_SEQ, acked_seq);
+	saved_acked_seq = acked_seq;
+}
+
+static bool
+send_resync_marker(uint32_t first, uint32_t last) {
+	AppMessageResult msg_result;
+	DictionaryIterator *iter;
+
+	msg_result = app_message_outbox_begin(&iter);
+	if (msg_result) {
 		APP_LOG(APP_LOG_LEVEL_ERROR,
-		    "send_event: [%d] unable to add data line \"%s\"",
-		    (int)dict_result, buffer);
-		result = false;
+		    "send_resync_marker: app_message_outbox_begin returned %d",
+		    (int)msg_result);
+		return false;
 	}
 
+	msg_resync_done_write(iter, &(struct msg_resync_done){
+	    .first = first,
+	    .last = last
+	});
+
 	msg_result = app_message_outbox_send();
 	if (msg_result) {
 		APP_LOG(APP_LOG_LEVEL_ERROR,
-		    "send_event: app_mesage_outbox_send returned %d",
+		    "send_resync_marker: app_mesage_outbox_send returned %d",
 		    (int)msg_result);
-		result = false;
+		return false;
 	}
 
-	return result;
+	return true;
 }
 
+/* deferred, so that a failed marker does not recurse into the next stream */
 static void
-handle_nothing_to_do(void) {
-	if (launch_reason() == APP_LAUNCH_WAKEUP)
-		close_app();
-	else {
-		snprintf(send_status, sizeof send_status, "Done (0)");
-		mark_menu_dirty();
+resync_marker_failed(void *context) {
+	(void)context;
+	stream_done();
+}
+
+/* end a resync stream with its marker, or without it if it cannot be sent */
+static void
+finish_resync_stream(void) {
+	is_sending_marker = true;
+	if (!send_resync_marker(resync_first, resync_last))
+		app_timer_register(0, &resync_marker_failed, 0);
+}
+
+/* send events from wanted up to (excluding) end, the stream must be idle */
+static void
+stream_events(uint32_t wanted, uint32_t end) {
+	sent_seq = page_next_valid_seq(&current_page, wanted);
+	sent_end = end;
+	is_sending = true;
+	is_awaiting_post = false;
+
+	if (sent_seq >= sent_end) {
+		/* nothing to send, only the resync marker */
+		finish_resync_stream();
+		return;
 	}
+
+	/* events between the phone cursor and the first one sent are lost */
+	sent_skipped = sent_seq - wanted;
+
+	sent_count = send_events(sent_seq, sent_skipped);
 }
 
 static void
-handle_last_sent(Tuple *tuple) {
-	time_t t = tuple_int(tuple);
+start_resync(void) {
+	resync_first = resync_queue[0][0];
+	resync_last = resync_queue[0][1];
+	resync_count -= 1;
+	memmove(resync_queue, resync_queue + 1,
+	    resync_count * sizeof *resync_queue);
+	is_resync = true;
+
+	if (resync_last >= current_page.next_seq)
+		resync_last = current_page.next_seq - 1;
 
-	sent_index = first_index(current_page, PAGE_LENGTH);
+	APP_LOG(APP_LOG_LEVEL_INFO,
+	    "resending %" PRIu32 " to %" PRIu32, resync_first, resync_last);
 
-	if (!current_page[sent_index].time) {
-		/* empty page */
-		handle_nothing_to_do();
+	stream_events(resync_first, resync_last + 1);
+}
+
+static void
+request_resync(uint32_t first, uint32_t last) {
+	uint32_t *range;
+
+	if (resync_count < RESYNC_QUEUE_LENGTH) {
+		range = resync_queue[resync_count++];
+		range[0] = first;
+		range[1] = last;
+	} else {
+		range = resync_queue[RESYNC_QUEUE_LENGTH - 1];
+		if (first < range[0]) range[0] = first;
+		if (last > range[1]) range[1] = last;
+		APP_LOG(APP_LOG_LEVEL_WARNING,
+		    "resync %" PRIu32 "-%" PRIu32 " merged into %" PRIu32
+		    "-%" PRIu32, first, last, range[0], range[1]);
+	}
+
+	if (!is_sending && !is_querying) start_resync();
+}
+
+/* first event at or after time t */
+static uint32_t
+seq_from_time(time_t t) {
+	uint32_t seq = page_next_valid_seq(&current_page, 0);
+	struct event *event;
+
+	while ((event = page_event(&current_page, seq)) && event->time < t)
+		seq = page_next_valid_seq(&current_page, seq + 1);
+
+	return seq;
+}
+
+static void
+start_sending(uint32_t last_seq) {
+	uint32_t wanted;
+
+	if (is_querying) {
+		/* start once the outbox is done with the query */
+		has_pending_start = true;
+		pending_last_seq = last_seq;
 		return;
 	}
 
-	if (t)
-		while (current_page[sent_index].time <= t) {
-			unsigned next_index = (sent_index + 1) % PAGE_LENGTH;
-			if (current_page[sent_index].time
-			     > current_page[next_index].time) {
-				/* end of page reached without match */
-				handle_nothing_to_do();
-				return;
-			}
-			sent_index = next_index;
-		}
+	if (last_seq >= current_page.next_seq) {
+		/* the log restarted, e.g. after its storage was lost, so the
+		 * cursors mean nothing and the phone is told to forget them */
+		APP_LOG(APP_LOG_LEVEL_WARNING,
+		    "phone cursor %" PRIu32 " is ahead of the log (%" PRIu32
+		    "), resending it", last_seq, current_page.next_seq);
+		is_log_reset = true;
+		acked_seq = 0;
+		last_posted = 0;
+		persist_write_int(MSG_KEY_LAST_POSTED, 0);
+		last_seq = 0;
+	}
+
+	wanted = last_seq + 1;
 
-	snprintf(send_status, sizeof send_status, "0 sent");
+	if (page_next_valid_seq(&current_page, wanted)
+	    >= current_page.next_seq) {
+		if (resync_count) start_resync();
+		else handle_nothing_to_do();
+		return;
+	}
+
+	snprintf(send_status, sizeof send_status, "%u sent", sent_done);
 	mark_menu_dirty();
 
-	send_event(current_page + sent_index);
+	is_interrupted = false;
+	is_resync = false;
+	sent_cursor = last_seq;
+	stream_events(wanted, current_page.next_seq);
+}
+
+/* stream from the saved cursor, before the phone sends its own */
+static void
+start_from_saved_cursor(void) {
+	if (!persist_exists(MSG_KEY_LAST_SEQ)
+	    || !connection_service_peek_pebble_app_connection())
+		return;
+
+	/* with nothing new, the phone cursor alone decides what to send */
+	if (page_next_valid_seq(&current_page, acked_seq + 1)
+	    >= current_page.next_seq)
+		return;
+
+	APP_LOG(APP_LOG_LEVEL_INFO,
+	    "streaming from saved cursor %" PRIu32, acked_seq);
+	start_sending(acked_seq);
+}
+
+/* cursor of the phone, which only restarts the stream when it disagrees */
+static void
+handle_last_seq(uint32_t last_seq) {
+	/* sent before the phone received the stream, it lags behind it */
+	bool is_lagging = sent_cursor != NO_CURSOR && last_seq >= sent_cursor;
+
+	is_cursor_confirmed = true;
+
+	if (!is_sending) {
+		start_sending(is_lagging && last_seq < acked_seq
+		    ? acked_seq : last_seq);
+		return;
+	}
+
+	if (is_resync) {
+		/* served once the phone has the requested range */
+		has_correction = true;
+		correction_seq = is_lagging && last_seq < acked_seq
+		    ? acked_seq : last_seq;
+		return;
+	}
+
+	if (is_lagging && last_seq < sent_seq + sent_count)
+		return;
+
+	APP_LOG(APP_LOG_LEVEL_WARNING,
+	    "phone cursor %" PRIu32 " disagrees with %" PRIu32
+	    ", restarting the stream", last_seq, sent_cursor);
+	has_correction = true;
+	correction_seq = last_seq;
+}
+
+/* legacy handshake, with the time of the last received event */
+static void
+handle_last_sent(time_t last_sent) {
+	handle_last_seq(seq_from_time(last_sent + 1) - 1);
+}
+
+static void
+handle_resync(struct msg_command *msg) {
+	const uint32_t by_seq = MSG_COMMAND_RESYNC_FIRST
+	    | MSG_COMMAND_RESYNC_LAST;
+	const uint32_t by_time = MSG_COMMAND_RESYNC_FROM
+	    | MSG_COMMAND_RESYNC_TO;
+
+	if ((msg->fields & by_seq) == by_seq)
+		request_resync(msg->resync_first, msg->resync_last);
+	else if ((msg->fields & by_time) == by_time)
+		request_resync(seq_from_time(msg->resync_from),
+		    seq_from_time(msg->resync_to + 1) - 1);
+	else
+		APP_LOG(APP_LOG_LEVEL_ERROR, "incomplete resync request");
 }
 
 static void
 inbox_received_handler(DictionaryIterator *iterator, void *context) {
-	Tuple *tuple;
+	struct msg_command msg;
+	uint32_t unexpected = msg_command_read(iterator, &msg);
 	(void)context;
 
-	for (tuple = dict_read_first(iterator);
-	    tuple;
-	    tuple = dict_read_next(iterator)) {
-		switch (tuple->key) {
-		    case MSG_KEY_LAST_SENT:
-			handle_last_sent(tuple);
-			break;
+	if (unexpected)
+		APP_LOG(APP_LOG_LEVEL_ERROR,
+		    "Unknown key %" PRIu32 " in received message",
+		    unexpected);
 
-		    case MSG_KEY_LAST_POSTED:
-			if (tuple_int(tuple) == sent_last_key
-			    && launch_reason() == APP_LAUNCH_WAKEUP) {
-				close_app();
-			}
-			break;
+	if (msg.fields & MSG_COMMAND_LAST_SENT)
+		handle_last_sent(msg.last_sent);
 
-		    case MSG_KEY_CFG_WAKEUP_TIME:
-			cfg_wakeup_time = tuple_int(tuple);
-			persist_write_int(MSG_KEY_CFG_WAKEUP_TIME,
-			    cfg_wakeup_time + 1);
-			break;
+	if (msg.fields & MSG_COMMAND_LAST_SEQ)
+		handle_last_seq(msg.last_seq);
 
-		    default:
-			APP_LOG(APP_LOG_LEVEL_ERROR,
-			    "Unknown key %" PRIu32 " in received message",
-			    tuple->key);
-			break;
-		}
+	if (msg.fields & (MSG_COMMAND_RESYNC_FIRST | MSG_COMMAND_RESYNC_FROM))
+		handle_resync(&msg);
+
+	if (msg.fields & MSG_COMMAND_LAST_POSTED) {
+		last_posted = msg.last_posted;
+		persist_write_int(MSG_KEY_LAST_POSTED, last_posted);
+		if (is_awaiting_post && last_posted >= acked_seq)
+			finish_auto_sync(SYNC_POSTED, sent_done);
+	}
+
+	if (msg.fields & MSG_COMMAND_CFG_WAKEUP_TIME) {
+		cfg_wakeup_time = msg.cfg_wakeup_time;
+		persist_write_int(MSG_KEY_CFG_WAKEUP_TIME,
+		    cfg_wakeup_time + 1);
+	}
+
+	if (msg.fields & MSG_COMMAND_CFG_SYNC_BUDGET)
+		persist_write_int(MSG_KEY_CFG_SYNC_BUDGET,
+		    msg.cfg_sync_budget);
+
+	/* read by the worker at its next hourly tick */
+	if (msg.fields & MSG_COMMAND_CFG_LEVEL_SAMPLING)
+		persist_write_int(MSG_KEY_CFG_LEVEL_SAMPLING,
+		    msg.cfg_level_sampling);
+
+	if (msg.fields & (MSG_COMMAND_HISTORY_EVENTS | MSG_COMMAND_HISTORY_DONE))
+		handle_history(&msg);
+}
+
+static void
+stream_done(void) {
+	is_sending = false;
+	is_sending_marker = false;
+	is_resync = false;
+	save_acked_seq();
+
+	if (has_correction) {
+		has_correction = false;
+		start_sending(correction_seq);
+		return;
+	}
+
+	if (resync_count) {
+		start_resync();
+		return;
+	}
+
+	if (is_auto_sync()) {
+		/* the phone may still correct the saved cursor */
+		if (!is_cursor_confirmed) return;
+
+		finish_once_posted();
+		return;
+	}
+
+	snprintf(send_status, sizeof send_status, "Done (%u)", sent_done);
+	mark_menu_dirty();
+}
+
+static void
+query_done(bool is_sent) {
+	is_querying = false;
+	if (!is_sent) history_failed();
+
+	if (has_pending_start) {
+		has_pending_start = false;
+		start_sending(pending_last_seq);
+	} else if (resync_count && !is_sending) {
+		start_resync();
 	}
 }
 
 static void
 outbox_sent_handler(DictionaryIterator *iterator, void *context) {
-	unsigned next_index = (sent_index + 1) % PAGE_LENGTH;
+	uint32_t next_seq;
 	(void)iterator;
 	(void)context;
 
-	sent_done += 1;
+	if (is_querying) {
+		query_done(true);
+		return;
+	}
+
+	if (is_sending_marker) {
+		stream_done();
+		return;
+	}
 
-	if (current_page[sent_index].time <= current_page[next_index].time) {
-		sent_index = next_index;
-		send_event(current_page + next_index);
+	sent_done += sent_count;
+	is_log_reset = false;
+	if (sent_seq + sent_count - 1 > acked_seq)
+		acked_seq = sent_seq + sent_count - 1;
+	next_seq = page_next_valid_seq(&current_page, sent_seq + sent_count);
+
+	if (has_correction && !is_resync) {
+		/* the rest of the stream is not what the phone needs */
+		stream_done();
+	} else if (next_seq < sent_end) {
+		sent_skipped = next_seq - (sent_seq + sent_count);
+		sent_seq = next_seq;
+		sent_count = send_events(sent_seq, sent_skipped);
 		snprintf(send_status, sizeof send_status, "%u sent",
 		    sent_done);
+	} else if (is_resync) {
+		finish_resync_stream();
 	} else {
-		sent_last_key = current_page[sent_index].time;
-		snprintf(send_status, sizeof send_status, "Done (%u)",
-		    sent_done);
-		mark_menu_dirty();
+		stream_done();
 	}
 }
 
@@ -330,131 +785,270 @@ outbox_failed_handler(DictionaryIterator *iterator, AppMessageResult reason,
 	(void)iterator;
 	(void)context;
 	APP_LOG(APP_LOG_LEVEL_ERROR, "Outbox failed: 0x%x", (unsigned)reason);
-	if (launch_reason() == APP_LAUNCH_WAKEUP)
-		close_app();
+
+	if (is_querying) {
+		query_done(false);
+		return;
+	}
+
+	is_sending = false;
+	is_sending_marker = false;
+	is_resync = false;
+	is_interrupted = true;
+	save_acked_seq();
+
+	if (has_correction) {
+		/* the phone just sent its cursor, so it is reachable */
+		has_correction = false;
+		start_sending(correction_seq);
+		return;
+	}
+
+	if (!is_cursor_confirmed) {
+		/* JS not running yet, its cursor will restart the stream */
+		snprintf(send_status, sizeof send_status, "Waiting for JS");
+		mark_menu_dirty();
+		return;
+	}
+
+	if (is_auto_sync() && connection_service_peek_pebble_app_connection())
+		finish_auto_sync(SYNC_FAILED, sent_done);
 	snprintf(send_status, sizeof send_status, "Outbox failed 0x%x",
 	    (unsigned)reason);
 }
 
+#ifndef DISPLAY_TEST_DATA
+static void
+budget_expired(void *context) {
+	(void)context;
+	budget_timer = 0;
+	finish_auto_sync(is_awaiting_post ? SYNC_DONE : SYNC_TIMEOUT,
+	    sent_done);
+}
+#endif
+
+static void
+connection_handler(bool connected) {
+	if (!connected || !is_interrupted || is_sending) return;
+
+	/* resume where the stream broke, the phone drops duplicates */
+	APP_LOG(APP_LOG_LEVEL_INFO, "reconnected, resuming at %" PRIu32,
+	    sent_seq);
+	start_sending(sent_seq - 1);
+}
+
 /*************
  * MENU ITEM *
  *************/
 
 #define SET_BUF(dest, src) (strcpy(dest, src ""), (int)(sizeof src) - 1)
 
-static const char *
-strdup(char *buffer) {
-	size_t length = strlen(buffer);
-	char *result = malloc(length + 1);
-	if (result) memcpy(result, buffer, length + 1);
-	return result;
+#define FIRST_FRAME_ROWS	5
+#define FORMAT_CHUNK_ROWS	8
+#define FORMAT_CHUNK_DELAY	20	/* ms */
+#define TITLE_SIZE		24
+#define DATE_SIZE		20
+#define SUMMARY_SIZE		32
+#define NO_SESSION		UINT32_MAX
+
+/* sessions, in their index slots */
+static struct session_index sessions;
+static char session_titles[SESSION_LENGTH][TITLE_SIZE];
+static char session_summaries[SESSION_LENGTH][SUMMARY_SIZE];
+static uint32_t item_sessions[ARRAY_LENGTH(menu_items)];
+static uint32_t expanded_id = NO_SESSION;
+
+/* latest events of the expanded session, oldest first, empty when there is
+ * no event */
+static char titles[PROFILE_LOG_WINDOW][TITLE_SIZE];
+static char dates[PROFILE_LOG_WINDOW][DATE_SIZE];
+static uint32_t rows_end;	/* sequence number after the last row */
+static unsigned rows_pending;	/* rows below this one are not formatted */
+static AppTimer *format_timer;
+static int32_t utc_offset;
+static bool is_first_frame_drawn;
+
+/* offset of local time, computed once instead of a localtime() per row */
+static void
+init_utc_offset(void) {
+	time_t now = time(0);
+	struct tm local = *localtime(&now);
+	struct tm *utc = gmtime(&now);
+	int days = local.tm_yday - utc->tm_yday;
+
+	if (local.tm_year != utc->tm_year)
+		days = local.tm_year > utc->tm_year ? 1 : -1;
+
+	utc_offset = days * 86400 + (local.tm_hour - utc->tm_hour) * 3600
+	    + (local.tm_min - utc->tm_min) * 60;
 }
 
+/* "YYYY-MM-DD HH:MM:SS" of local time, from days since the epoch. The
+ * offset is the current one, so rows across a DST change are shifted by
+ * the difference. */
 static void
-init_strings(void) {
-	char buffer[256];
-	int ret;
-	struct tm *tm;
-	unsigned j = first_index(current_page, PAGE_LENGTH);
-
-	for (unsigned i = 0; i < PAGE_LENGTH; i += 1) {
-		if (!current_page[j].time) {
-			titles[i] = dates[i] = 0;
-			continue;
-		}
+format_date(char *buffer, size_t size, time_t t) {
+	int32_t local = t + utc_offset;
+	int32_t secs = local % 86400;
+	int32_t days, era, doe, yoe, doy, mp, y;
+	unsigned m, d;
+
+	/* rounded down, so that times before the epoch count back */
+	if (secs < 0) secs += 86400;
+	days = (local - secs) / 86400;
+
+	/* civil_from_days, from Howard Hinnant's date algorithms */
+	days += 719468;
+	era = days / 146097;
+	doe = days - era * 146097;
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	y = yoe + era * 400;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+	d = doy - (153 * mp + 2) / 5 + 1;
+	m = mp < 10 ? mp + 3 : mp - 9;
+	if (m <= 2) y += 1;
+
+	/* the modulos only show the compiler that every field fits */
+	snprintf(buffer, size, "%04u-%02u-%02u %02u:%02u:%02u",
+	    (unsigned)y % 10000, m % 100, d % 100, (unsigned)(secs / 3600),
+	    (unsigned)(secs / 60 % 60), (unsigned)(secs % 60));
+}
 
-		tm = localtime(&current_page[j].time);
-		ret = strftime(buffer, sizeof buffer, "%Y-%m-%d %H:%M:%S", tm);
-		dates[i] = ret ? strdup(buffer) : 0;
+/* menu title of an event, in a TITLE_SIZE buffer */
+static void
+format_title(char *title, const struct event *event) {
+	switch (event->before) {
+	    case UNKNOWN:
+		snprintf(title, TITLE_SIZE,
+		    "%u%%%c",
+		    (unsigned)(event->after & 0x7f),
+		    (event->after & 0x80) ? '+' : '-');
+		break;
 
-		switch (current_page[j].before) {
-		    case UNKNOWN:
-			snprintf(buffer, sizeof buffer,
-			    "%u%%%c",
-			    (unsigned)(current_page[j].after & 0x7f),
-			    (current_page[j].after & 0x80) ? '+' : '-');
-			break;
+	    case APP_STARTED:
+		snprintf(title, TITLE_SIZE,
+		    "Start %u%%%c",
+		    (unsigned)(event->after & 0x7f),
+		    (event->after & 0x80) ? '+' : '-');
+		break;
 
-		    case APP_STARTED:
-			snprintf(buffer, sizeof buffer,
-			    "Start %u%%%c",
-			    (unsigned)(current_page[j].after & 0x7f),
-			    (current_page[j].after & 0x80) ? '+' : '-');
-			break;
+	    case APP_CLOSED:
+		snprintf(title, TITLE_SIZE,
+		    "Close %u%%%c",
+		    (unsigned)(event->after & 0x7f),
+		    (event->after & 0x80) ? '+' : '-');
+		break;
 
-		    case APP_CLOSED:
-			snprintf(buffer, sizeof buffer,
-			    "Close %u%%%c",
-			    (unsigned)(current_page[j].after & 0x7f),
-			    (current_page[j].after & 0x80) ? '+' : '-');
-			break;
+	    case ANOMALOUS_VALUE:
+		snprintf(title, TITLE_SIZE,
+		    "Anomalous %u",
+		    (unsigned)(event->after));
+		break;
 
-		    case ANOMALOUS_VALUE:
-			snprintf(buffer, sizeof buffer,
-			    "Anomalous %u",
-			    (unsigned)(current_page[j].after));
-			break;
+	    case SAMPLE:
+		snprintf(title, TITLE_SIZE,
+		    "Still %u%%%c",
+		    (unsigned)(event->after & 0x7f),
+		    (event->after & 0x80) ? '+' : '-');
+		break;
 
-		    default:
-			if ((current_page[j].before & 0x80)
-			    == (current_page[j].after & 0x80)) {
-				snprintf(buffer, sizeof buffer,
-				    "%u%% %c> %u%%",
-				    (unsigned)(current_page[j].before & 0x7f),
-				    (current_page[j].after & 0x80) ? '+' : '-',
-				    (unsigned)(current_page[j].after & 0x7f));
-				break;
-			}
-
-			if ((current_page[j].before & 0x7f)
-			    == (current_page[j].after & 0x7f))
-				snprintf (buffer, sizeof buffer,
-				    "%s %u%%",
-				    (current_page[j].after & 0x80)
-				    ? "Charge" : "Discharge",
-				    (unsigned)(current_page[j].after & 0x7f));
-			else
-				snprintf (buffer, sizeof buffer,
-				    "%s %u%% -> %u%%",
-				    (current_page[j].after & 0x80)
-				    ? "Chg" : "Disch",
-				    (unsigned)(current_page[j].before & 0x7f),
-				    (unsigned)(current_page[j].after & 0x7f));
+	    default:
+		if ((event->before & 0x80)
+		    == (event->after & 0x80)) {
+			snprintf(title, TITLE_SIZE,
+			    "%u%% %c> %u%%",
+			    (unsigned)(event->before & 0x7f),
+			    (event->after & 0x80) ? '+' : '-',
+			    (unsigned)(event->after & 0x7f));
 			break;
 		}
 
-		titles[i] = strdup(buffer);
-
-		j = (j + 1) % PAGE_LENGTH;
+		if ((event->before & 0x7f)
+		    == (event->after & 0x7f))
+			snprintf (title, TITLE_SIZE,
+			    "%s %u%%",
+			    (event->after & 0x80)
+			    ? "Charge" : "Discharge",
+			    (unsigned)(event->after & 0x7f));
+		else
+			snprintf (title, TITLE_SIZE,
+			    "%s %u%% -> %u%%",
+			    (event->after & 0x80)
+			    ? "Chg" : "Disch",
+			    (unsigned)(event->before & 0x7f),
+			    (unsigned)(event->after & 0x7f));
+		break;
 	}
 }
 
-static time_t
-latest_event(void) {
-	time_t result = current_page[0].time;
-	for (unsigned j = 1; j < PAGE_LENGTH; j += 1) {
-		if (result < current_page[j].time) {
-			result = current_page[j].time;
-		}
+static void
+format_row(unsigned i) {
+	struct session *session = session_get(&sessions, expanded_id);
+	uint32_t seq = rows_end - PROFILE_LOG_WINDOW + i;
+	struct event *event = session && seq >= session->first_seq
+	    ? page_event(&current_page, seq) : 0;
+
+	if (!event) {
+		titles[i][0] = dates[i][0] = 0;
+		return;
 	}
-	return result;
+
+	format_date(dates[i], DATE_SIZE, event->time);
+	format_title(titles[i], event);
 }
 
+/* "Charge 40% > 100%", and "MM-DD HH:MM 2h05 +29%/h" with the rate
+ * outside of the time without worker, flagged with a star */
 static void
-rebuild_menu(void) {
-	unsigned i = PAGE_LENGTH;
-	bool is_empty = true;
-	time_t old_latest = latest_event();
+format_session(uint32_t id) {
+	struct session *session = session_get(&sessions, id);
+	unsigned slot = id % SESSION_LENGTH;
+	int32_t minutes = (session->end - session->start) / 60;
+	int32_t active = session->end - session->start
+	    - session->gap_minutes * 60;
+	int delta = (int)(session->end_level & 0x7f)
+	    - (int)(session->start_level & 0x7f);
+	char date[DATE_SIZE];
+	int length;
+
+	snprintf(session_titles[slot], TITLE_SIZE, "%s %u%% > %u%%",
+	    (session->end_level & 0x80) ? "Charge" : "Disch",
+	    (unsigned)(session->start_level & 0x7f),
+	    (unsigned)(session->end_level & 0x7f));
+
+	format_date(date, sizeof date, session->start);
+	length = snprintf(session_summaries[slot], SUMMARY_SIZE,
+	    "%.11s %d:%02d%s", date + 5, (int)(minutes / 60),
+	    (int)(minutes % 60), session->gap_minutes ? "*" : "");
+
+	if (active >= 60 && length > 0 && length < SUMMARY_SIZE)
+		snprintf(session_summaries[slot] + length,
+		    SUMMARY_SIZE - length, " %s%d%%/h", delta > 0 ? "+" : "",
+		    (int)(delta * 3600 / active));
+}
 
-	persist_read_data(1, current_page, sizeof current_page);
+/* reload the index and format every session in it */
+static void
+init_sessions(void) {
+	uint32_t id;
 
-	if (old_latest != latest_event()) {
-		for (unsigned i = 0; i < PAGE_LENGTH; i += 1) {
-			free((void *)dates[i]);
-			free((void *)titles[i]);
-		}
-		init_strings();
-	}
+#ifdef DISPLAY_TEST_DATA
+	memset(&sessions, 0, sizeof sessions);
+	session_catch_up(&sessions, &current_page);
+#else
+	session_read(&sessions, &current_page);
+#endif
+
+	for (id = sessions.next_id; id > 0 && session_get(&sessions, id - 1);
+	    id -= 1)
+		format_session(id - 1);
+}
+
+static void
+build_menu(void) {
+	unsigned i;
+	uint32_t id = sessions.next_id;
 
 	menu_section.title = 0;
 	menu_section.items = menu_items;
@@ -462,7 +1056,7 @@ rebuild_menu(void) {
 
 	menu_items[menu_section.num_items] = (SimpleMenuItem){
 	    .title = send_status,
-	    .subtitle = 0,
+	    .subtitle = last_sync_status[0] ? last_sync_status : 0,
 	    .callback = 0,
 	    .icon = 0
 	};
@@ -482,18 +1076,38 @@ rebuild_menu(void) {
 		menu_section.num_items += 1;
 	}
 
-	while (i) {
-		i -= 1;
-		if (!titles[i]) continue;
-		menu_items[menu_section.num_items].title = titles[i];
-		menu_items[menu_section.num_items].subtitle = dates[i];
-		menu_items[menu_section.num_items].icon = 0;
-		menu_items[menu_section.num_items].callback = 0;
+	menu_items[menu_section.num_items] = (SimpleMenuItem){
+	    .title = "Older events",
+	    .subtitle = "From the phone",
+	    .callback = &do_show_history
+	};
+	menu_section.num_items += 1;
+
+	/* newest session first, followed by its events when expanded */
+	while (id > 0 && session_get(&sessions, id - 1)) {
+		id -= 1;
+		item_sessions[menu_section.num_items] = id;
+		menu_items[menu_section.num_items] = (SimpleMenuItem){
+		    .title = session_titles[id % SESSION_LENGTH],
+		    .subtitle = session_summaries[id % SESSION_LENGTH],
+		    .callback = &do_toggle_session
+		};
 		menu_section.num_items += 1;
-		is_empty = false;
+
+		if (id != expanded_id) continue;
+
+		for (i = PROFILE_LOG_WINDOW; i > rows_pending; ) {
+			i -= 1;
+			if (!titles[i][0]) continue;
+			menu_items[menu_section.num_items] = (SimpleMenuItem){
+			    .title = titles[i],
+			    .subtitle = dates[i]
+			};
+			menu_section.num_items += 1;
+		}
 	}
 
-	if (is_empty) {
+	if (!sessions.next_id) {
 		menu_items[menu_section.num_items].title = "No event recorded";
 		menu_items[menu_section.num_items].subtitle = 0;
 		menu_items[menu_section.num_items].icon = 0;
@@ -502,6 +1116,65 @@ rebuild_menu(void) {
 	}
 }
 
+/* format the next rows, newest first */
+static void
+format_rows(unsigned count) {
+	while (count && rows_pending) {
+		rows_pending -= 1;
+		format_row(rows_pending);
+		count -= 1;
+	}
+}
+
+/* older rows are formatted after the first frame, a chunk at a time */
+static void
+format_chunk(void *context) {
+	(void)context;
+	format_timer = 0;
+	format_rows(FORMAT_CHUNK_ROWS);
+	build_menu();
+	mark_menu_dirty();
+
+	if (rows_pending)
+		format_timer = app_timer_register(FORMAT_CHUNK_DELAY,
+		    &format_chunk, 0);
+}
+
+/* restart the formatting of the rows of the expanded session */
+static void
+init_strings(void) {
+	struct session *session = session_get(&sessions, expanded_id);
+
+	if (format_timer) app_timer_cancel(format_timer);
+	format_timer = 0;
+
+	if (!session) {
+		rows_pending = 0;
+		return;
+	}
+
+	rows_end = session->last_seq + 1;
+	rows_pending = PROFILE_LOG_WINDOW;
+	format_rows(FIRST_FRAME_ROWS);
+
+	if (rows_pending)
+		format_timer = app_timer_register(FORMAT_CHUNK_DELAY,
+		    &format_chunk, 0);
+}
+
+static void
+rebuild_menu(void) {
+	uint32_t old_next_seq = current_page.next_seq;
+
+	page_read(&current_page);
+	if (old_next_seq != current_page.next_seq) {
+		init_sessions();
+		init_strings();
+	}
+
+	build_menu();
+}
+
 /****************
  * MENU ACTIONS *
  ****************/
@@ -510,7 +1183,7 @@ static void
 do_start_worker(int index, void *context) {
 	(void)index;
 	(void)context;
-	char buffer[256];
+	char buffer[32];
 	AppWorkerResult result = app_worker_launch();
 
 	switch (result) {
@@ -532,11 +1205,22 @@ do_start_worker(int index, void *context) {
 	}
 }
 
+static void
+do_toggle_session(int index, void *context) {
+	(void)context;
+
+	expanded_id = expanded_id == item_sessions[index]
+	    ? NO_SESSION : item_sessions[index];
+	init_strings();
+	build_menu();
+	mark_menu_dirty();
+}
+
 static void
 do_stop_worker(int index, void *context) {
 	(void)index;
 	(void)context;
-	char buffer[256];
+	char buffer[32];
 	AppWorkerResult result = app_worker_kill();
 
 	switch (result) {
@@ -561,13 +1245,206 @@ do_stop_worker(int index, void *context) {
 	}
 }
 
+/******************
+ * HISTORY WINDOW *
+ ******************/
+
+/* events older than the log, fetched from the phone archive */
+struct history {
+	SimpleMenuLayer *menu_layer;
+	SimpleMenuSection section;
+	SimpleMenuItem items[PROFILE_HISTORY_ROWS + 1];
+	char status[32];
+	unsigned count;
+	char titles[PROFILE_HISTORY_ROWS][TITLE_SIZE];
+	char dates[PROFILE_HISTORY_ROWS][DATE_SIZE];
+};
+
+static Window *history_window;
+static struct history *history;	/* only allocated while displayed */
+
+static void
+build_history_menu(void) {
+	unsigned i = history->count;
+
+	history->section.title = 0;
+	history->section.items = history->items;
+	history->section.num_items = 0;
+
+	history->items[history->section.num_items] = (SimpleMenuItem){
+	    .title = history->status
+	};
+	history->section.num_items += 1;
+
+	/* the phone sends the oldest events first */
+	while (i > 0) {
+		i -= 1;
+		history->items[history->section.num_items] = (SimpleMenuItem){
+		    .title = history->titles[i],
+		    .subtitle = history->dates[i]
+		};
+		history->section.num_items += 1;
+	}
+
+	if (history->menu_layer)
+		layer_mark_dirty(simple_menu_layer_get_layer(
+		    history->menu_layer));
+}
+
+/* ask the phone for the events before the oldest one in the log */
+static void
+send_history_query(void) {
+	AppMessageResult msg_result;
+	DictionaryIterator *iter;
+	struct event *oldest = page_event(&current_page,
+	    page_next_valid_seq(&current_page, 0));
+
+	if (is_sending || is_querying) {
+		snprintf(history->status, sizeof history->status,
+		    "Busy, retry later");
+		return;
+	}
+
+	msg_result = app_message_outbox_begin(&iter);
+	if (msg_result) {
+		APP_LOG(APP_LOG_LEVEL_ERROR,
+		    "send_history_query: app_message_outbox_begin returned %d",
+		    (int)msg_result);
+		snprintf(history->status, sizeof history->status,
+		    "Query failed");
+		return;
+	}
+
+	msg_history_query_write(iter, &(struct msg_history_query){
+	    .from = 0,
+	    .to = oldest ? oldest->time - 1 : time(0),
+	    .max = PROFILE_HISTORY_ROWS,
+	    .batch = PROFILE_HISTORY_BATCH
+	});
+
+	msg_result = app_message_outbox_send();
+	if (msg_result) {
+		APP_LOG(APP_LOG_LEVEL_ERROR,
+		    "send_history_query: app_mesage_outbox_send returned %d",
+		    (int)msg_result);
+		snprintf(history->status, sizeof history->status,
+		    "Query failed");
+		return;
+	}
+
+	is_querying = true;
+	snprintf(history->status, sizeof history->status, "Loading...");
+}
+
+static void
+handle_history(const struct msg_command *msg) {
+	struct event event;
+	uint16_t offset = 0;
+
+	/* replies after the window is closed are dropped */
+	if (!history) return;
+
+	while ((msg->fields & MSG_COMMAND_HISTORY_EVENTS)
+	    && offset + sizeof event <= msg->history_events_length
+	    && history->count < PROFILE_HISTORY_ROWS) {
+		memcpy(&event, msg->history_events + offset, sizeof event);
+		format_date(history->dates[history->count], DATE_SIZE,
+		    event.time);
+		format_title(history->titles[history->count], &event);
+		history->count += 1;
+		offset += sizeof event;
+	}
+
+	if (!(msg->fields & MSG_COMMAND_HISTORY_DONE))
+		snprintf(history->status, sizeof history->status,
+		    "Loading (%u)...", history->count);
+	else if (history->count)
+		snprintf(history->status, sizeof history->status,
+		    "%u older events", history->count);
+	else
+		snprintf(history->status, sizeof history->status,
+		    "No older events");
+
+	build_history_menu();
+}
+
+static void
+history_failed(void) {
+	if (!history) return;
+	snprintf(history->status, sizeof history->status, "Query failed");
+	build_history_menu();
+}
+
+static void
+history_window_load(Window *window) {
+	Layer *window_layer = window_get_root_layer(window);
+
+	build_history_menu();
+	history->menu_layer = simple_menu_layer_create(
+	    layer_get_bounds(window_layer), window, &history->section, 1, 0);
+	layer_add_child(window_layer,
+	    simple_menu_layer_get_layer(history->menu_layer));
+}
+
+static void
+history_window_unload(Window *window) {
+	simple_menu_layer_destroy(history->menu_layer);
+	free(history);
+	history = 0;
+}
+
+static void
+do_show_history(int index, void *context) {
+	(void)index;
+	(void)context;
+
+	if (history) return;
+
+	history = malloc(sizeof *history);
+	if (!history) {
+		APP_LOG(APP_LOG_LEVEL_ERROR,
+		    "Unable to allocate the history window");
+		push_simple_dialog("Not enough memory.", true);
+		return;
+	}
+	memset(history, 0, sizeof *history);
+
+	if (!history_window) {
+		history_window = window_create();
+		window_set_window_handlers(history_window, (WindowHandlers){
+		    .load = &history_window_load,
+		    .unload = &history_window_unload
+		});
+	}
+
+	send_history_query();
+	window_stack_push(history_window, true);
+}
+
 /*********************
  * WINDOW MANAGEMENT *
  *********************/
 
+static Layer *frame_probe;
+
+/* drawn under the menu, only to time the first frame */
+static void
+frame_probe_update(Layer *layer, GContext *ctx) {
+	time_t now;
+	uint16_t now_ms;
+
+	if (is_first_frame_drawn) return;
+	is_first_frame_drawn = true;
+
+	time_ms(&now, &now_ms);
+	APP_LOG(APP_LOG_LEVEL_INFO, "first frame %" PRIi32 " ms after launch",
+	    (now - launch_time) * 1000 + now_ms - launch_time_ms);
+}
+
 static void
 window_appear(Window *window) {
-	rebuild_menu();
+	/* the page was read in init, reread when back from a dialog */
+	if (is_first_frame_drawn) rebuild_menu();
 }
 
 static void
@@ -575,7 +1452,11 @@ window_load(Window *window) {
 	Layer *window_layer = window_get_root_layer(window);
 	GRect bounds = layer_get_bounds(window_layer);
 
-	rebuild_menu();
+	build_menu();
+
+	frame_probe = layer_create(bounds);
+	layer_set_update_proc(frame_probe, &frame_probe_update);
+	layer_add_child(window_layer, frame_probe);
 
 	menu_layer = simple_menu_layer_create(bounds, window,
 	    &menu_section, 1, 0);
@@ -587,6 +1468,67 @@ window_load(Window *window) {
 static void
 window_unload(Window *window) {
 	simple_menu_layer_destroy(menu_layer);
+	layer_destroy(frame_probe);
+}
+
+/*********************
+ * WAKEUP SCHEDULING *
+ *********************/
+
+/* backlog at which a sync is brought forward, before the ring overflows */
+#define SYNC_TARGET_BACKLOG (PAGE_LENGTH * 3 / 4)
+#define SYNC_MIN_DELAY 900
+#define SYNC_RETRY_DELAY 3600
+
+/* events the phone has not acknowledged, posting them is up to its queue */
+static uint32_t
+unsynced_events(void) {
+	return page_backlog(&current_page, acked_seq);
+}
+
+/* events the phone has acknowledged but not posted yet */
+static uint32_t
+unposted_events(void) {
+	return last_posted < acked_seq ? acked_seq - last_posted : 0;
+}
+
+/* average time between recorded events, or 0 when unknown */
+static time_t
+event_interval(void) {
+	uint32_t first = page_next_valid_seq(&current_page, 0);
+	uint32_t last = current_page.next_seq - 1;
+	struct event *first_event = page_event(&current_page, first);
+	struct event *last_event = page_event(&current_page, last);
+
+	if (!first_event || !last_event || last <= first) return 0;
+	return (last_event->time - first_event->time) / (time_t)(last - first);
+}
+
+/* next sync time, the configured time being the latest allowed */
+static time_t
+next_wakeup_time(void) {
+	time_t now = time(0);
+	time_t t = clock_to_timestamp(TODAY,
+	    cfg_wakeup_time / 60, cfg_wakeup_time % 60);
+	uint32_t backlog = unsynced_events() + unposted_events();
+	time_t interval = event_interval();
+	time_t fill;
+
+	if (t - now > 6 * 86400)
+		t -= 6 * 86400;
+	else if (t - now <= 120)
+		t += 86400;
+
+	if (backlog >= SYNC_TARGET_BACKLOG) {
+		/* last sync failed, try again sooner than the ceiling */
+		fill = now + SYNC_RETRY_DELAY;
+	} else if (interval > 0) {
+		fill = now + (time_t)(SYNC_TARGET_BACKLOG - backlog) * interval;
+		if (fill < now + SYNC_MIN_DELAY) fill = now + SYNC_MIN_DELAY;
+	} else
+		fill = t;
+
+	return fill < t ? fill : t;
 }
 
 /**********************************
@@ -595,85 +1537,113 @@ window_unload(Window *window) {
 
 static void
 init(void) {
+	time_ms(&launch_time, &launch_time_ms);
 	snprintf(send_status, sizeof send_status, "Waiting for JS");
 
 	cfg_wakeup_time = persist_read_int(MSG_KEY_CFG_WAKEUP_TIME) - 1;
 	wakeup_cancel_all();
 
-	persist_read_data(1, current_page, sizeof current_page);
+	page_read(&current_page);
+	acked_seq = saved_acked_seq = persist_read_int(MSG_KEY_LAST_SEQ);
+	last_posted = persist_read_int(MSG_KEY_LAST_POSTED);
 
 #ifdef DISPLAY_TEST_DATA
-	current_page[0].time = 1449738000; /* 2015-12-10T10:00:00 */
-	current_page[0].before = APP_STARTED;
-	current_page[0].after = 90;
-	current_page[1].time = 1449741600; /* 2015-12-10T11:00:00 */
-	current_page[1].before = 90;
-	current_page[1].after = 80;
-	current_page[2].time = 1449742980; /* 2015-12-10T11:23:00 */
-	current_page[2].before = ANOMALOUS_VALUE;
-	current_page[2].after = 131;
-	current_page[3].time = 1449743160; /* 2015-12-10T11:26:00 */
-	current_page[3].before = UNKNOWN;
-	current_page[3].after = 70;
-	current_page[4].time = 1449743460; /* 2015-12-10T11:31:00 */
-	current_page[4].before = 70;
-	current_page[4].after = 128 | 70;
-	current_page[5].time = 1449743940; /* 2015-12-10T11:39:00 */
-	current_page[5].before = 128 | 70;
-	current_page[5].after = 128 | 80;
-	current_page[6].time = 1449744000; /* 2015-12-10T11:40:00 */
-	current_page[6].before = 128 | 80;
-	current_page[6].after = 80;
-	current_page[7].time = 1449744420; /* 2015-12-10T11:47:00 */
-	current_page[7].before = 80;
-	current_page[7].after = 128 | 70;
-	current_page[8].time = 1449744660; /* 2015-12-10T11:51:00 */
-	current_page[8].before = 128 | 70;
-	current_page[8].after = 80;
-	current_page[9].time = 1449744660; /* 2015-12-10T11:51:00 */
-	current_page[9].before = 80;
-	current_page[9].after = 90;
-	current_page[10].time = 1449745140; /* 2015-12-10T11:59:00 */
-	current_page[10].before = 90;
-	current_page[10].after = 128 | 100;
-	current_page[11].time = 1449745260; /* 2015-12-10T12:01:00 */
-	current_page[11].before = 128 | 100;
-	current_page[11].after = 128 | 80;
-	current_page[12].time = 1449745620; /* 2015-12-10T12:07:00 */
-	current_page[12].before = 128 | 80;
-	current_page[12].after = 60;
-	current_page[13].time = 1449745800; /* 2015-12-10T12:10:00 */
-	current_page[13].before = APP_CLOSED;
-	current_page[13].after = 60;
-	current_page[14].time = 1449846060; /* 2015-12-11T16:01:00 */
-	current_page[14].before = APP_STARTED;
-	current_page[14].after = 128 | 40;
-	current_page[15].time = 1449846480; /* 2015-12-11T16:08:00 */
-	current_page[15].before = 128 | 40;
-	current_page[15].after = 128 | 40;
-	current_page[16].time = 1449846660; /* 2015-12-11T16:11:00 */
-	current_page[16].before = UNKNOWN;
-	current_page[16].after = 128 | 60;
-	current_page[17].time = 1449846780; /* 2015-12-11T16:13:00 */
-	current_page[17].before = APP_CLOSED;
-	current_page[17].after = 128 | 60;
+	current_page.next_seq = PAGE_LENGTH + 18;
+	current_page.events[0].time = 1449738000; /* 2015-12-10T10:00:00 */
+	current_page.events[0].before = APP_STARTED;
+	current_page.events[0].after = 90;
+	current_page.events[1].time = 1449741600; /* 2015-12-10T11:00:00 */
+	current_page.events[1].before = 90;
+	current_page.events[1].after = 80;
+	current_page.events[2].time = 1449742980; /* 2015-12-10T11:23:00 */
+	current_page.events[2].before = ANOMALOUS_VALUE;
+	current_page.events[2].after = 131;
+	current_page.events[3].time = 1449743160; /* 2015-12-10T11:26:00 */
+	current_page.events[3].before = UNKNOWN;
+	current_page.events[3].after = 70;
+	current_page.events[4].time = 1449743460; /* 2015-12-10T11:31:00 */
+	current_page.events[4].before = 70;
+	current_page.events[4].after = 128 | 70;
+	current_page.events[5].time = 1449743940; /* 2015-12-10T11:39:00 */
+	current_page.events[5].before = 128 | 70;
+	current_page.events[5].after = 128 | 80;
+	current_page.events[6].time = 1449744000; /* 2015-12-10T11:40:00 */
+	current_page.events[6].before = 128 | 80;
+	current_page.events[6].after = 80;
+	current_page.events[7].time = 1449744420; /* 2015-12-10T11:47:00 */
+	current_page.events[7].before = 80;
+	current_page.events[7].after = 128 | 70;
+	current_page.events[8].time = 1449744660; /* 2015-12-10T11:51:00 */
+	current_page.events[8].before = 128 | 70;
+	current_page.events[8].after = 80;
+	current_page.events[9].time = 1449744660; /* 2015-12-10T11:51:00 */
+	current_page.events[9].before = 80;
+	current_page.events[9].after = 90;
+	current_page.events[10].time = 1449745140; /* 2015-12-10T11:59:00 */
+	current_page.events[10].before = 90;
+	current_page.events[10].after = 128 | 100;
+	current_page.events[11].time = 1449745260; /* 2015-12-10T12:01:00 */
+	current_page.events[11].before = 128 | 100;
+	current_page.events[11].after = 128 | 80;
+	current_page.events[12].time = 1449745620; /* 2015-12-10T12:07:00 */
+	current_page.events[12].before = 128 | 80;
+	current_page.events[12].after = 60;
+	current_page.events[13].time = 1449745800; /* 2015-12-10T12:10:00 */
+	current_page.events[13].before = APP_CLOSED;
+	current_page.events[13].after = 60;
+	current_page.events[14].time = 1449846060; /* 2015-12-11T16:01:00 */
+	current_page.events[14].before = APP_STARTED;
+	current_page.events[14].after = 128 | 40;
+	current_page.events[15].time = 1449846480; /* 2015-12-11T16:08:00 */
+	current_page.events[15].before = 128 | 40;
+	current_page.events[15].after = 128 | 40;
+	current_page.events[16].time = 1449846660; /* 2015-12-11T16:11:00 */
+	current_page.events[16].before = UNKNOWN;
+	current_page.events[16].after = 128 | 60;
+	current_page.events[17].time = 1449846780; /* 2015-12-11T16:13:00 */
+	current_page.events[17].before = APP_CLOSED;
+	current_page.events[17].after = 128 | 60;
 	for (unsigned i = 18; i < PAGE_LENGTH; i += 1) {
-		current_page[i].time = 0;
-		current_page[i].before = 0;
-		current_page[i].after = 0;
+		current_page.events[i].time = 0;
+		current_page.events[i].before = 0;
+		current_page.events[i].after = 0;
 	}
 #else
-	if (launch_reason() == APP_LAUNCH_WAKEUP) {
-		push_simple_dialog("Battery- Auto Sync", true);
+	if (is_auto_sync() && !unsynced_events() && !unposted_events()) {
+		/* nothing pending, leave without waking the phone up */
+		APP_LOG(APP_LOG_LEVEL_INFO, "nothing to sync, skipping");
+		finish_auto_sync(SYNC_NOTHING, 0);
+		return;
+	}
+
+	if (is_auto_sync()) {
+		int32_t budget = persist_read_int(MSG_KEY_CFG_SYNC_BUDGET);
+
+		/* bare window, only there to keep the app running */
+		window = window_create();
+		window_stack_push(window, false);
+
+		if (budget <= 0) budget = DEFAULT_SYNC_BUDGET;
+		budget_timer = app_timer_register(budget * 1000,
+		    &budget_expired, 0);
+
+		connection_service_subscribe((ConnectionHandlers) {
+		    .pebble_app_connection_handler = connection_handler,
+		});
 		app_message_register_inbox_received(inbox_received_handler);
 		app_message_register_outbox_failed(outbox_failed_handler);
 		app_message_register_outbox_sent(outbox_sent_handler);
-		app_message_open(256, 2048);
+		if (app_message_open(MSG_COMMAND_SIZE, MSG_DATA_SIZE)
+		    == APP_MSG_OK)
+			start_from_saved_cursor();
 		return;
 	}
 #endif
 
+	init_utc_offset();
+	init_sessions();
 	init_strings();
+	format_last_sync();
 
 	window = window_create();
 	window_set_window_handlers(window, (WindowHandlers) {
@@ -683,35 +1653,30 @@ init(void) {
 	});
 	window_stack_push(window, true);
 
+	connection_service_subscribe((ConnectionHandlers) {
+	    .pebble_app_connection_handler = connection_handler,
+	});
+
 	app_message_register_inbox_received(inbox_received_handler);
 	app_message_register_outbox_failed(outbox_failed_handler);
 	app_message_register_outbox_sent(outbox_sent_handler);
-	app_message_open(256, 2048);
+	if (app_message_open(MSG_COMMAND_SIZE, MSG_DATA_SIZE) == APP_MSG_OK)
+		start_from_saved_cursor();
 }
 
 static void
 deinit(void) {
+	save_acked_seq();
 	window_destroy(window);
-
-	for (unsigned i = 0; i < PAGE_LENGTH; i += 1) {
-		if (titles[i]) free((void *)titles[i]);
-		titles[i] = 0;
-
-		if (dates[i]) free((void *)dates[i]);
-		dates[i] = 0;
-	}
+	if (history_window) window_destroy(history_window);
+	if (format_timer) app_timer_cancel(format_timer);
 
 	if (cfg_wakeup_time >= 0) {
 		WakeupId res;
-		time_t now = time(0);
-		time_t t = clock_to_timestamp(TODAY,
-		    cfg_wakeup_time / 60, cfg_wakeup_time % 60);
-
-		if (t - now > 6 * 86400)
-			t -= 6 * 86400;
-		else if (t - now <= 120)
-			t += 86400;
+		time_t t;
 
+		page_read(&current_page);
+		t = next_wakeup_time();
 		res = wakeup_schedule(t, 0, true);
 
 		if (res < 0)
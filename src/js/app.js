@@ -23,66 +23,417 @@ var cfg_sign_key = "";
 var cfg_sign_key_format = "";
 var cfg_extra_fields = [];
 var cfg_wakeup_time = -1;
+var cfg_sync_budget = 60;
+var cfg_level_sampling = false;
+var cfg_upload_format = "csv";
+var cfg_batch_size = 1;
+var cfg_max_uploads = 2;
 
 var to_send = [];
-var senders = [new XMLHttpRequest(), new XMLHttpRequest()];
-var i_sender = 1;
-var jsSHA = require("sha");
+var last_seq = null;
+var missing = [];
+var resync_from = 0;
+var resync_to = -1;
+/* first sequence number of each outstanding gap fill */
+var resync_requests = [];
+var last_posted = 0;
+
+/* requests in dispatch order, covering the first dispatched items */
+var uploads = [];
+var dispatched = 0;
+
+var RETRY_BASE_DELAY = 2000;
+var RETRY_MAX_DELAY = 5 * 60 * 1000;
+var BREAKER_THRESHOLD = 5;
+var BREAKER_BASE_PAUSE = 10 * 60 * 1000;
+var BREAKER_MAX_PAUSE = 6 * 60 * 60 * 1000;
+var UPLOAD_TIMEOUT = 30000;
+
+var failures = 0;
+var retry_timer = null;
+var breaker_pause = 0;
+var signer = null;
+var Signer = require("signer").Signer;
+var deflate = require("deflate");
+var trace = require("trace");
+var messages = require("messages");
+var archive = require("archive");
+
+/* columnar batch, with times as deltas from the first one */
+function columnarPayload(lines) {
+   var result = { "time": 0, "dt": [], "event": [], "after": [],
+    "before": [] };
+   var previous = 0;
+
+   for (var i = 0; i < lines.length; i += 1) {
+      var fields = lines[i].split(",");
+      var t = Math.floor(Date.parse(fields[0]) / 1000);
+      if (i === 0) result.time = previous = t;
+      result.dt.push(t - previous);
+      result.event.push(fields[1]);
+      result.after.push(parseInt(fields[2], 10));
+      result.before.push(fields.length > 3 ? parseInt(fields[3], 10) : null);
+      previous = t;
+   }
 
-function sendPayload(payload) {
-   var data = new FormData();
-   data.append(cfg_data_field, payload);
+   return JSON.stringify(result);
+}
 
-   if (cfg_sign_field) {
-      var sha = new jsSHA(cfg_sign_algo, "TEXT");
-      sha.setHMACKey(cfg_sign_key, cfg_sign_key_format);
-      sha.update(payload);
-      data.append(cfg_sign_field, sha.getHMAC(cfg_sign_field_format));
+/* encode lines in the configured format, tagging base-64 payloads */
+function formatPayload(lines) {
+   if (cfg_upload_format === "columnar") {
+      return { text: columnarPayload(lines), format: "TEXT" };
+   } else if (cfg_upload_format === "deflate") {
+      return { text: deflate.base64(deflate.deflate(
+       deflate.textBytes(lines.join("\n")))), format: "B64" };
+   } else {
+      return { text: lines.join("\n"), format: "TEXT" };
    }
+}
 
-   if (cfg_extra_fields.length > 0) {
+/* signer keyed for the current configuration, or null */
+function updateSigner() {
+   signer = cfg_sign_field ? new Signer(cfg_sign_algo, cfg_sign_key,
+    cfg_sign_key_format, cfg_sign_field_format) : null;
+   if (signer) console.log("Signing with " + signer.mode + " " + signer.algo);
+}
+
+/* pass the form to callback, once signed */
+function buildForm(lines, callback) {
+   var data = new FormData();
+   var payload = formatPayload(lines);
+   data.append(cfg_data_field, payload.text);
+
+   function finish() {
       for (var i = 0; i < cfg_extra_fields.length; i += 1) {
          var decoded = decodeURIComponent(cfg_extra_fields[i]).split("=");
          var name = decoded.shift();
          var value = decoded.join("=");
          data.append(name, value);
       }
+      callback(data);
+   }
+
+   if (signer) {
+      /* base-64 payloads are signed on their decoded bytes */
+      signer.sign(payload.text, payload.format, function(signature) {
+         data.append(cfg_sign_field, signature);
+         finish();
+      });
+   } else {
+      finish();
    }
+}
+
+function startUpload(upload) {
+   upload.xhr = null;
+   upload.failed = false;
+   buildForm(upload.items.map(function(item) {
+      return item.split(";")[1];
+   }), function(data) {
+      /* signing may be asynchronous, the upload may be aborted meanwhile */
+      if (uploads.indexOf(upload) < 0) return;
+      upload.xhr = new XMLHttpRequest();
+      upload.xhr.addEventListener("load", function() { uploadDone(upload); });
+      upload.xhr.addEventListener("error", function() {
+         uploadError(upload);
+      });
+      upload.xhr.addEventListener("timeout", function() {
+         uploadError(upload);
+      });
+      upload.xhr.open("POST", cfg_endpoint, true);
+      upload.xhr.timeout = UPLOAD_TIMEOUT;
+      upload.xhr.send(data);
+   });
+}
+
+/* dispatch queued items until the pool of concurrent uploads is full */
+function pumpUploads() {
+   if (!cfg_endpoint || !cfg_data_field || retry_timer !== null) return;
+
+   /* a half-open breaker lets a single upload probe the endpoint */
+   var pool = breaker_pause ? 1 : cfg_max_uploads;
+   while (uploads.length < pool && dispatched < to_send.length) {
+      var count = Math.min(to_send.length - dispatched, cfg_batch_size);
+      var upload = { items: to_send.slice(dispatched, dispatched + count),
+       done: false, failed: false, xhr: null };
+      dispatched += count;
+      uploads.push(upload);
+      startUpload(upload);
+   }
+}
+
+function abortUploads() {
+   for (var i = 0; i < uploads.length; i += 1) {
+      if (uploads[i].xhr) uploads[i].xhr.abort();
+   }
+   uploads = [];
+   dispatched = 0;
+}
+
+function retryUploads() {
+   retry_timer = null;
+   for (var i = 0; i < uploads.length; i += 1) {
+      if (!uploads[i].failed) continue;
+      startUpload(uploads[i]);
+      /* after a pause, the others wait for this probe to succeed */
+      if (breaker_pause) break;
+   }
+   pumpUploads();
+}
+
+function scheduleRetry(delay) {
+   if (retry_timer !== null) clearTimeout(retry_timer);
+   retry_timer = setTimeout(retryUploads, delay);
+}
+
+function retryDelay(xhr) {
+   var retry_after = xhr.getResponseHeader
+    ? parseInt(xhr.getResponseHeader("Retry-After") || "", 10) : NaN;
+   var delay;
+
+   if (failures >= BREAKER_THRESHOLD) {
+      /* endpoint looks down, pause uploads and probe it again later */
+      breaker_pause = breaker_pause
+       ? Math.min(breaker_pause * 2, BREAKER_MAX_PAUSE) : BREAKER_BASE_PAUSE;
+      console.log("Pausing uploads for " + breaker_pause / 1000 + "s after "
+       + failures + " failures");
+      return breaker_pause;
+   }
+
+   /* exponential backoff with "equal jitter" */
+   delay = Math.min(RETRY_BASE_DELAY * Math.pow(2, failures - 1),
+    RETRY_MAX_DELAY);
+   delay = delay / 2 + Math.random() * delay / 2;
 
-   i_sender = 1 - i_sender;
-   senders[i_sender].open("POST", cfg_endpoint, true);
-   senders[i_sender].send(data);
+   if (retry_after > 0) delay = Math.max(delay, retry_after * 1000);
+   return delay;
 }
 
-function sendHead() {
-   if (to_send.length < 1) return;
-   sendPayload(to_send[0].split(";")[1]);
+/* the payload itself is refused, so sending it again cannot help */
+function isRejected(status) {
+   return status === 400 || status === 413 || status === 422;
+}
+
+/* endpoint or credentials refused, only a new configuration can help */
+function isConfigError(status) {
+   return status >= 400 && status < 500 && status !== 408 && status !== 429;
 }
 
 function enqueue(key, line) {
    to_send.push(key + ";" + line);
    localStorage.setItem("toSend", to_send.join("|"));
-   localStorage.setItem("lastSent", key);
-   if (to_send.length === 1) {
-      sendHead();
+   pumpUploads();
+}
+
+function saveMissing() {
+   localStorage.setItem("missing", missing.map(function(range) {
+      return range[0] + "-" + range[1];
+   }).join(","));
+}
+
+function requestResync(first, last) {
+   console.log("Requesting events " + first + " to " + last);
+   Pebble.sendAppMessage(messages.encodeCommand({ resyncFirst: first,
+    resyncLast: last }));
+   resync_requests.push(first);
+}
+
+function addMissing(first, last) {
+   console.log("Missing events " + first + " to " + last);
+   missing.push([first, last]);
+   saveMissing();
+   requestResync(first, last);
+}
+
+/* remove [first, last] from missing ranges, returning the removed count */
+function removeMissing(first, last) {
+   var result = 0;
+   var updated = [];
+
+   for (var i = 0; i < missing.length; i += 1) {
+      var range = missing[i];
+      if (range[1] < first || range[0] > last) {
+         updated.push(range);
+         continue;
+      }
+      result += Math.min(range[1], last) - Math.max(range[0], first) + 1;
+      if (range[0] < first) updated.push([range[0], first - 1]);
+      if (range[1] > last) updated.push([last + 1, range[1]]);
+   }
+
+   if (result > 0) {
+      missing = updated;
+      saveMissing();
+   }
+   return result;
+}
+
+function receiveEvent(seq, skipped, time, line) {
+   if (last_seq !== null && seq <= last_seq) {
+      if (skipped > 0) removeMissing(seq - skipped, seq - 1);
+      if (removeMissing(seq, seq) === 0
+       && (time < resync_from || time > resync_to)) {
+         console.log("Dropping duplicate event " + seq);
+         return;
+      }
+      archive.add(seq, line);
+      enqueue(seq, line);
+      return;
+   }
+
+   if (last_seq !== null && seq - skipped > last_seq + 1) {
+      addMissing(last_seq + 1, seq - skipped - 1);
+   }
+
+   last_seq = seq;
+   localStorage.setItem("lastSeq", seq);
+   archive.add(seq, line);
+   enqueue(seq, line);
+}
+
+/* the watch log restarted below the cursor, so its numbers are reused */
+function logReset(first) {
+   console.log("Watch log restarted at " + first + ", forgetting cursor "
+    + last_seq);
+   last_seq = first - 1;
+   localStorage.setItem("lastSeq", last_seq);
+   last_posted = 0;
+   localStorage.setItem("lastPosted", "0");
+   missing = [];
+   saveMissing();
+   resync_requests = [];
+   resync_from = 0;
+   resync_to = -1;
+}
+
+/* send archived events to the watch, one batch after the other */
+function sendHistory(from, to, max, batch) {
+   var events = archive.query(from, to, max);
+   var sent = 0;
+
+   console.log("Sending " + events.length + " archived events");
+
+   function sendBatch() {
+      var msg = {};
+      if (sent < events.length) {
+         msg.historyEvents = archive.toBytes(events.slice(sent,
+          sent + batch));
+         sent = Math.min(sent + batch, events.length);
+      }
+      if (sent >= events.length) msg.historyDone = events.length;
+      Pebble.sendAppMessage(messages.encodeCommand(msg),
+       sent < events.length ? sendBatch : null,
+       function() { console.log("History sending failed at " + sent); });
+   }
+
+   sendBatch();
+}
+
+function resyncDone(first, last) {
+   var lost = removeMissing(first, last);
+   if (lost > 0) {
+      console.log(lost + " events between " + first + " and " + last
+       + " are no longer on the watch");
+   }
+   var index = resync_requests.indexOf(first);
+   if (index >= 0) {
+      /* a gap fill, the manual window is still being resent */
+      resync_requests.splice(index, 1);
+   } else {
+      resync_from = 0;
+      resync_to = -1;
    }
 }
 
-function uploadDone() {
-   var sent_key = to_send.shift().split(";")[0];
+function sendCursor() {
+   if (last_seq !== null) {
+      /* a background sync waits for lastPosted before closing */
+      Pebble.sendAppMessage(messages.encodeCommand({ lastSeq: last_seq,
+       lastPosted: last_posted }));
+   } else {
+      Pebble.sendAppMessage(messages.encodeCommand({ lastSent:
+       parseInt(localStorage.getItem("lastSent") || "0", 10) }));
+   }
+}
+
+/* highest sequence number with every received event up to it posted */
+function postedCursor() {
+   var result = last_seq;
+
+   for (var i = 0; i < to_send.length; i += 1) {
+      result = Math.min(result, parseInt(to_send[i].split(";")[0], 10) - 1);
+   }
+   for (i = 0; i < missing.length; i += 1) {
+      result = Math.min(result, missing[i][0] - 1);
+   }
+
+   return result;
+}
+
+/* remove the confirmed prefix of the queue and report it to the watch */
+function ackUploads() {
+   var removed = 0;
+
+   while (uploads.length > 0 && uploads[0].done) {
+      removed += uploads[0].items.length;
+      uploads.shift();
+   }
+
+   if (removed === 0) return;
+
+   to_send.splice(0, removed);
+   dispatched -= removed;
    localStorage.setItem("toSend", to_send.join("|"));
-   if (to_send.length === 0) {
-      Pebble.sendAppMessage({ "lastPosted": parseInt(sent_key, 10) });
+
+   var cursor = postedCursor();
+   if (last_seq !== null && cursor > last_posted) {
+      last_posted = cursor;
+      localStorage.setItem("lastPosted", last_posted);
+      Pebble.sendAppMessage(messages.encodeCommand({
+       lastPosted: last_posted }));
+   }
+}
+
+function uploadDone(upload) {
+   var xhr = upload.xhr;
+   var was_probe = breaker_pause > 0;
+
+   if (xhr.status < 200 || xhr.status >= 300) {
+      if (!isRejected(xhr.status)) {
+         uploadError(upload);
+         return;
+      }
+      console.log("Dropping payload rejected with " + xhr.status + " "
+       + xhr.statusText + ": " + upload.items.join("|"));
+   }
+
+   failures = 0;
+   breaker_pause = 0;
+   upload.done = true;
+   trace.uploaded(upload.items);
+   ackUploads();
+   if (was_probe) {
+      /* the endpoint is back, release the uploads held behind the probe */
+      retryUploads();
+   } else {
+      pumpUploads();
    }
-   sendHead();
 }
 
-function uploadError() { console.log(this.statusText); }
+function uploadError(upload) {
+   var xhr = upload.xhr;
 
-senders[0].addEventListener("load", uploadDone);
-senders[0].addEventListener("error", uploadError);
-senders[1].addEventListener("load", uploadDone);
-senders[1].addEventListener("error", uploadError);
+   upload.failed = true;
+   failures += 1;
+   /* keep the queue but pause right away, until the configuration changes */
+   if (isConfigError(xhr.status)) {
+      failures = Math.max(failures, BREAKER_THRESHOLD);
+   }
+   console.log("Upload failed (" + xhr.status + " " + xhr.statusText
+    + "), attempt " + failures);
+   scheduleRetry(retryDelay(xhr));
+}
 
 Pebble.addEventListener("ready", function(e) {
    console.log("Battery- JS ready");
@@ -101,20 +452,52 @@ Pebble.addEventListener("ready", function(e) {
    cfg_sign_key = localStorage.getItem("cfgSignKey");
    cfg_sign_key_format = localStorage.getItem("cfgSignKeyFormat");
    cfg_wakeup_time = parseInt(localStorage.getItem("cfgWakeupTime") || "-1", 10);
+   cfg_sync_budget = parseInt(localStorage.getItem("cfgSyncBudget") || "60", 10);
+   cfg_level_sampling = localStorage.getItem("cfgLevelSampling") === "1";
+   cfg_upload_format = localStorage.getItem("cfgUploadFormat") || "csv";
+   cfg_batch_size = parseInt(localStorage.getItem("cfgBatchSize") || "1", 10);
+   cfg_max_uploads = parseInt(localStorage.getItem("cfgMaxUploads") || "2", 10);
+   updateSigner();
+
+   var str_last_seq = localStorage.getItem("lastSeq");
+   last_seq = str_last_seq ? parseInt(str_last_seq, 10) : null;
+   last_posted = parseInt(localStorage.getItem("lastPosted") || "0", 10);
+
+   var str_missing = localStorage.getItem("missing");
+   missing = (str_missing ? str_missing.split(",") : []).map(function(str) {
+      var bounds = str.split("-");
+      return [parseInt(bounds[0], 10), parseInt(bounds[1], 10)];
+   });
 
    if (cfg_endpoint && cfg_data_field) {
-      Pebble.sendAppMessage({ "lastSent":
-       parseInt(localStorage.getItem("lastSent") || "0", 10) });
+      sendCursor();
+      for (var i = 0; i < missing.length; i += 1) {
+         requestResync(missing[i][0], missing[i][1]);
+      }
    }
 
-   if (to_send.length >= 1) {
-      sendHead();
-   }
+   pumpUploads();
 });
 
 Pebble.addEventListener("appmessage", function(e) {
-   if (e.payload.dataKey && e.payload.dataLine) {
-      enqueue(e.payload.dataKey, e.payload.dataLine);
+   var msg = messages.decode(e.payload);
+
+   if (msg === null) {
+      console.log("Unexpected message " + JSON.stringify(e.payload));
+   } else if (msg.type === "data") {
+      /* batches hold consecutive events, one line each */
+      var lines = msg.line.split("\n");
+      if (msg.traceMs !== undefined) trace.received(msg);
+      if (msg.reset) logReset(msg.seq - (msg.skipped || 0));
+      receiveEvent(msg.seq, msg.skipped || 0, msg.time, lines[0]);
+      for (var i = 1; i < lines.length; i += 1) {
+         receiveEvent(msg.seq + i, 0,
+          Math.floor(Date.parse(lines[i].split(",")[0]) / 1000), lines[i]);
+      }
+   } else if (msg.type === "resync_done") {
+      resyncDone(msg.first, msg.last);
+   } else if (msg.type === "history_query") {
+      sendHistory(msg.from, msg.to, msg.max, msg.batch);
    }
 });
 
@@ -138,13 +521,22 @@ Pebble.addEventListener("showConfiguration", function() {
    }
 
    if (cfg_wakeup_time >= 0) {
-      settings += "&wakeup=" + cfg_wakeup_time.toString(10);
+      settings += "&wakeup=" + cfg_wakeup_time.toString(10)
+       + "&budget=" + cfg_sync_budget.toString(10);
    }
 
    if (cfg_extra_fields.length > 0) {
       settings += "&extra=" + cfg_extra_fields.join(",");
    }
 
+   if (cfg_level_sampling) {
+      settings += "&sampling=1";
+   }
+
+   settings += "&format=" + encodeURIComponent(cfg_upload_format)
+    + "&batch=" + cfg_batch_size.toString(10)
+    + "&uploads=" + cfg_max_uploads.toString(10);
+
    Pebble.openURL("https://cdn.rawgit.com/faelys/battery-minus/v1.0/config.html" + settings);
 });
 
@@ -187,6 +579,31 @@ Pebble.addEventListener("webviewclosed", function(e) {
       localStorage.setItem("cfgSignKeyFormat", cfg_sign_key_format);
    }
 
+   if (configData.uploadFormat) {
+      cfg_upload_format = configData.uploadFormat;
+      localStorage.setItem("cfgUploadFormat", cfg_upload_format);
+   }
+
+   if (configData.maxUploads) {
+      var maxUploads = parseInt(configData.maxUploads, 10);
+      if (maxUploads >= 1) {
+         cfg_max_uploads = maxUploads;
+         localStorage.setItem("cfgMaxUploads", cfg_max_uploads);
+      }
+      else
+         console.log("Invalid maxUploads \"" + configData.maxUploads + "\"");
+   }
+
+   if (configData.batchSize) {
+      var batchSize = parseInt(configData.batchSize, 10);
+      if (batchSize >= 1) {
+         cfg_batch_size = batchSize;
+         localStorage.setItem("cfgBatchSize", cfg_batch_size);
+      }
+      else
+         console.log("Invalid batchSize \"" + configData.batchSize + "\"");
+   }
+
    if (configData.wakeupTime !== null) {
       console.log("Received wakeupTime \"" + configData.wakeupTime + "\"");
       var wakeupComponents = configData.wakeupTime.split(":");
@@ -196,7 +613,8 @@ Pebble.addEventListener("webviewclosed", function(e) {
          if (wakeupH >= 0 && wakeupH < 24 && wakeupM >= 0 && wakeupM < 60) {
             cfg_wakeup_time = wakeupH * 60 + wakeupM;
             localStorage.setItem("cfgWakeupTime", cfg_wakeup_time);
-            Pebble.sendAppMessage({ "cfgWakeupTime": cfg_wakeup_time });
+            Pebble.sendAppMessage(messages.encodeCommand({
+             cfgWakeupTime: cfg_wakeup_time }));
          }
          else
             console.log("Invalid wakeupTime \"" + configData.wakeupTime + "\"");
@@ -205,22 +623,77 @@ Pebble.addEventListener("webviewclosed", function(e) {
          console.log("Invalid wakeupTime \"" + configData.wakeupTime + "\"");
    }
 
+   if (configData.syncBudget) {
+      var syncBudget = parseInt(configData.syncBudget, 10);
+      if (syncBudget >= 5 && syncBudget <= 600) {
+         cfg_sync_budget = syncBudget;
+         localStorage.setItem("cfgSyncBudget", cfg_sync_budget);
+         Pebble.sendAppMessage(messages.encodeCommand({
+          cfgSyncBudget: cfg_sync_budget }));
+      }
+      else
+         console.log("Invalid syncBudget \"" + configData.syncBudget + "\"");
+   }
+
+   if (configData.levelSampling !== undefined) {
+      cfg_level_sampling = !!configData.levelSampling;
+      localStorage.setItem("cfgLevelSampling", cfg_level_sampling ? "1" : "0");
+      Pebble.sendAppMessage(messages.encodeCommand({
+       cfgLevelSampling: cfg_level_sampling ? 1 : 0 }));
+   }
+
    if (configData.extraFields !== null) {
       cfg_extra_fields = configData.extraFields
        ? configData.extraFields.split(",") : [];
       localStorage.setItem("extraFields", cfg_extra_fields.join(","));
    }
 
+   updateSigner();
+
+   if (configData.resendSince && !configData.resend) {
+      var from = Math.floor(Date.parse(configData.resendSince) / 1000);
+      var to = Math.floor(Date.now() / 1000);
+      if (from >= 0) {
+         console.log("Requesting events since " + configData.resendSince);
+         resync_from = from;
+         resync_to = to;
+         Pebble.sendAppMessage(messages.encodeCommand({
+          resyncFrom: from, resyncTo: to }),
+          function() {},
+          function() {
+             console.log("Resend request failed");
+             resync_from = 0;
+             resync_to = -1;
+          });
+      }
+   }
+
+   if (retry_timer !== null) {
+      /* configuration may have fixed the endpoint, retry right away */
+      clearTimeout(retry_timer);
+      failures = 0;
+      breaker_pause = 0;
+      retryUploads();
+   }
+
    if (configData.resend) {
-      senders[0].abort();
-      senders[1].abort();
+      abortUploads();
       localStorage.setItem("toSend", "");
-      localStorage.setItem("lastSent", "0");
+      localStorage.setItem("lastSeq", "0");
+      localStorage.setItem("lastPosted", "0");
+      localStorage.setItem("missing", "");
       to_send = [];
+      missing = [];
+      last_seq = 0;
+      last_posted = 0;
       wasConfigured = false;
    }
 
    if (!wasConfigured && cfg_endpoint && cfg_data_field) {
-      Pebble.sendAppMessage({ "lastSent": 0 });
+      last_seq = 0;
+      localStorage.setItem("lastSeq", "0");
+      sendCursor();
    }
+
+   pumpUploads();
 });
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Append-only archive of every received event, so the watch can display
+ * more history than its own log holds.
+ *
+ * Events are stored in chunks of CHUNK_EVENTS, each under its own
+ * localStorage key "archive.<id>", as "seq,time,state" entries in base 36
+ * where state is (before << 8 | after) as in the watch log. The index in
+ * "archiveIndex" lists "id:first:last:count" for each chunk, first and last
+ * being the extreme event times, so a query only reads the chunks that
+ * overlap its range. Beyond MAX_CHUNKS, the oldest chunk is dropped.
+ */
+
+var CHUNK_EVENTS = 64;
+var MAX_CHUNKS = 160;
+
+/* special before values, see src/storage.h */
+var UNKNOWN = 0xf0;
+var APP_STARTED = 0xf1;
+var APP_CLOSED = 0xf2;
+var ANOMALOUS_VALUE = 0xf3;
+var SAMPLE = 0xf4;
+
+var index = null;
+var current = null;	/* entries of the newest chunk */
+
+function loadIndex() {
+   var str = localStorage.getItem("archiveIndex");
+   index = (str ? str.split(",") : []).map(function(item) {
+      var fields = item.split(":");
+      return { id: parseInt(fields[0], 10), first: parseInt(fields[1], 10),
+       last: parseInt(fields[2], 10), count: parseInt(fields[3], 10) };
+   });
+}
+
+function saveIndex() {
+   localStorage.setItem("archiveIndex", index.map(function(chunk) {
+      return chunk.id + ":" + chunk.first + ":" + chunk.last + ":"
+       + chunk.count;
+   }).join(","));
+}
+
+function readChunk(id) {
+   var str = localStorage.getItem("archive." + id);
+   return str ? str.split(";") : [];
+}
+
+/* before and after of the watch log, from the keyword and integers */
+function eventState(fields) {
+   var int_1 = parseInt(fields[2], 10);
+   var int_2 = parseInt(fields[3], 10);
+
+   switch (fields[1]) {
+      case "unknown": return [UNKNOWN, int_1];
+      case "start": return [APP_STARTED, int_1];
+      case "start+": return [APP_STARTED, int_1 | 0x80];
+      case "stop": return [APP_CLOSED, int_1];
+      case "stop+": return [APP_CLOSED, int_1 | 0x80];
+      case "error": return [ANOMALOUS_VALUE, int_1];
+      case "sample": return [SAMPLE, int_1];
+      case "sample+": return [SAMPLE, int_1 | 0x80];
+      case "+": return [int_2 | 0x80, int_1 | 0x80];
+      case "-": return [int_2, int_1];
+      case "charge": return [int_2, int_1 | 0x80];
+      case "dischg": return [int_2 | 0x80, int_1];
+      default: return null;
+   }
+}
+
+/* store a received event, given as its CSV line */
+function add(seq, line) {
+   var fields = line.split(",");
+   var time = Math.floor(Date.parse(fields[0]) / 1000);
+   var state = eventState(fields);
+   var chunk;
+
+   if (!state || isNaN(time)) {
+      console.log("Not archiving unexpected line \"" + line + "\"");
+      return;
+   }
+
+   if (index === null) loadIndex();
+   chunk = index[index.length - 1];
+
+   if (!chunk || chunk.count >= CHUNK_EVENTS) {
+      chunk = { id: chunk ? chunk.id + 1 : 1, first: time, last: time,
+       count: 0 };
+      index.push(chunk);
+      current = [];
+      if (index.length > MAX_CHUNKS) {
+         localStorage.removeItem("archive." + index.shift().id);
+      }
+   } else if (current === null) {
+      current = readChunk(chunk.id);
+   }
+
+   current.push(seq.toString(36) + "," + time.toString(36) + ","
+    + (state[0] * 256 + state[1]).toString(36));
+   chunk.first = Math.min(chunk.first, time);
+   chunk.last = Math.max(chunk.last, time);
+   chunk.count = current.length;
+   localStorage.setItem("archive." + chunk.id, current.join(";"));
+   saveIndex();
+}
+
+/* newest events at most, between from and to included, oldest first */
+function query(from, to, max) {
+   var events = [];
+   var seen = {};
+
+   if (index === null) loadIndex();
+
+   for (var i = 0; i < index.length; i += 1) {
+      if (index[i].last < from || index[i].first > to) continue;
+      var entries = readChunk(index[i].id);
+      for (var j = 0; j < entries.length; j += 1) {
+         var fields = entries[j].split(",");
+         var event = { seq: parseInt(fields[0], 36),
+          time: parseInt(fields[1], 36), state: parseInt(fields[2], 36) };
+         /* resent events are archived again, and a restarted watch log
+          * reuses sequence numbers */
+         var key = event.seq + ":" + event.time;
+         if (event.time < from || event.time > to || seen[key]) continue;
+         seen[key] = true;
+         events.push(event);
+      }
+   }
+
+   events.sort(function(a, b) { return a.time - b.time || a.seq - b.seq; });
+   return events.slice(Math.max(0, events.length - max));
+}
+
+/* packed struct event array, as in the watch log */
+function toBytes(events) {
+   var result = [];
+   for (var i = 0; i < events.length; i += 1) {
+      var t = events[i].time;
+      result.push(t & 0xff, (t >>> 8) & 0xff, (t >>> 16) & 0xff,
+       (t >>> 24) & 0xff, events[i].state >>> 8, events[i].state & 0xff);
+   }
+   return result;
+}
+
+module.exports.add = add;
+module.exports.query = query;
+module.exports.toBytes = toBytes;
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Minimal zlib (RFC 1950) compressor, using a single DEFLATE (RFC 1951)
+ * block with the fixed Huffman codes. Upload payloads are small and very
+ * repetitive, so LZ77 matching provides nearly all the gain and dynamic
+ * Huffman tables would not be worth their size.
+ */
+
+var WINDOW_SIZE = 32768;
+var MIN_MATCH = 3;
+var MAX_MATCH = 258;
+var MAX_CHAIN = 64;
+var HASH_SIZE = 4096;
+
+var LENGTH_BASE = [3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+ 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258];
+var LENGTH_EXTRA = [0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+ 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0];
+var DIST_BASE = [1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+ 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289,
+ 16385, 24577];
+var DIST_EXTRA = [0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+ 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13];
+
+function BitWriter() {
+   this.bytes = [];
+   this.acc = 0;
+   this.nbits = 0;
+}
+
+/* append the nbits low bits of value, least significant first */
+BitWriter.prototype.bits = function(value, nbits) {
+   this.acc |= value << this.nbits;
+   this.nbits += nbits;
+   while (this.nbits >= 8) {
+      this.bytes.push(this.acc & 0xff);
+      this.acc >>>= 8;
+      this.nbits -= 8;
+   }
+};
+
+/* append a Huffman code, which is stored most significant bit first */
+BitWriter.prototype.code = function(code, nbits) {
+   var reversed = 0;
+   for (var i = 0; i < nbits; i += 1) {
+      reversed = (reversed << 1) | ((code >>> i) & 1);
+   }
+   this.bits(reversed, nbits);
+};
+
+BitWriter.prototype.flush = function() {
+   if (this.nbits > 0) this.bytes.push(this.acc & 0xff);
+   this.acc = 0;
+   this.nbits = 0;
+};
+
+function writeLiteral(out, value) {
+   if (value < 144) out.code(0x30 + value, 8);
+   else if (value < 256) out.code(0x190 + value - 144, 9);
+   else if (value < 280) out.code(value - 256, 7);
+   else out.code(0xc0 + value - 280, 8);
+}
+
+function findIndex(base, value) {
+   var i = base.length - 1;
+   while (base[i] > value) i -= 1;
+   return i;
+}
+
+function writeMatch(out, length, distance) {
+   var i = findIndex(LENGTH_BASE, length);
+   writeLiteral(out, 257 + i);
+   if (LENGTH_EXTRA[i]) out.bits(length - LENGTH_BASE[i], LENGTH_EXTRA[i]);
+
+   i = findIndex(DIST_BASE, distance);
+   out.code(i, 5);
+   if (DIST_EXTRA[i]) out.bits(distance - DIST_BASE[i], DIST_EXTRA[i]);
+}
+
+function hash(data, i) {
+   return ((data[i] << 8) ^ (data[i + 1] << 4) ^ data[i + 2]) % HASH_SIZE;
+}
+
+function adler32(data) {
+   var a = 1, b = 0;
+   for (var i = 0; i < data.length; i += 1) {
+      a = (a + data[i]) % 65521;
+      b = (b + a) % 65521;
+   }
+   return ((b << 16) | a) >>> 0;
+}
+
+/* compress an array of bytes into a zlib stream, as an array of bytes */
+function deflate(data) {
+   var out = new BitWriter();
+   var head = [];
+   var prev = [];
+   var i = 0;
+   var check = adler32(data);
+
+   out.bytes.push(0x78, 0x01);
+   out.bits(1, 1);  /* final block */
+   out.bits(1, 2);  /* fixed Huffman codes */
+
+   while (i < data.length) {
+      var best_length = 0;
+      var best_distance = 0;
+
+      if (i + MIN_MATCH <= data.length) {
+         var h = hash(data, i);
+         var candidate = head[h];
+         var chain = MAX_CHAIN;
+         var limit = Math.min(MAX_MATCH, data.length - i);
+
+         while (candidate !== undefined && i - candidate <= WINDOW_SIZE
+          && chain > 0) {
+            var length = 0;
+            while (length < limit
+             && data[candidate + length] === data[i + length]) {
+               length += 1;
+            }
+            if (length > best_length) {
+               best_length = length;
+               best_distance = i - candidate;
+               if (length === limit) break;
+            }
+            candidate = prev[candidate];
+            chain -= 1;
+         }
+
+         prev[i] = head[h];
+         head[h] = i;
+      }
+
+      if (best_length >= MIN_MATCH) {
+         writeMatch(out, best_length, best_distance);
+         for (var j = 1; j < best_length; j += 1) {
+            if (i + j + MIN_MATCH <= data.length) {
+               var hj = hash(data, i + j);
+               prev[i + j] = head[hj];
+               head[hj] = i + j;
+            }
+         }
+         i += best_length;
+      } else {
+         writeLiteral(out, data[i]);
+         i += 1;
+      }
+   }
+
+   writeLiteral(out, 256);
+   out.flush();
+   out.bytes.push(check >>> 24, (check >>> 16) & 0xff,
+    (check >>> 8) & 0xff, check & 0xff);
+   return out.bytes;
+}
+
+var B64_CHARS
+ = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+function base64(bytes) {
+   var result = "";
+   for (var i = 0; i < bytes.length; i += 3) {
+      var n = (bytes[i] << 16) | ((bytes[i + 1] || 0) << 8)
+       | (bytes[i + 2] || 0);
+      result += B64_CHARS.charAt(n >>> 18)
+       + B64_CHARS.charAt((n >>> 12) & 63)
+       + (i + 1 < bytes.length ? B64_CHARS.charAt((n >>> 6) & 63) : "=")
+       + (i + 2 < bytes.length ? B64_CHARS.charAt(n & 63) : "=");
+   }
+   return result;
+}
+
+/* bytes of a base-64 string, skipping padding and whitespace */
+function base64Bytes(b64) {
+   var result = [];
+   var acc = 0, nbits = 0;
+   for (var i = 0; i < b64.length; i += 1) {
+      var value = B64_CHARS.indexOf(b64.charAt(i));
+      if (value < 0) continue;
+      acc = (acc << 6) | value;
+      nbits += 6;
+      if (nbits >= 8) {
+         nbits -= 8;
+         result.push((acc >>> nbits) & 0xff);
+      }
+   }
+   return result;
+}
+
+/* UTF-8 bytes of a string */
+function textBytes(text) {
+   var utf8 = unescape(encodeURIComponent(text));
+   var result = [];
+   for (var i = 0; i < utf8.length; i += 1) {
+      result.push(utf8.charCodeAt(i));
+   }
+   return result;
+}
+
+module.exports.deflate = deflate;
+module.exports.base64 = base64;
+module.exports.base64Bytes = base64Bytes;
+module.exports.textBytes = textBytes;
@@ -0,0 +1,80 @@
+/* Generated by tools/gen-messages.js from messages.json, do not edit */
+
+/* cursors, resync requests, configuration and archived events */
+function encodeCommand(msg) {
+   var payload = {};
+   if (msg.lastSent !== undefined) {
+      payload.lastSent = msg.lastSent | 0;
+   }
+   if (msg.lastPosted !== undefined) {
+      payload.lastPosted = msg.lastPosted | 0;
+   }
+   if (msg.lastSeq !== undefined) {
+      payload.lastSeq = msg.lastSeq | 0;
+   }
+   if (msg.resyncFirst !== undefined) {
+      payload.resyncFirst = msg.resyncFirst | 0;
+   }
+   if (msg.resyncLast !== undefined) {
+      payload.resyncLast = msg.resyncLast | 0;
+   }
+   if (msg.resyncFrom !== undefined) {
+      payload.resyncFrom = msg.resyncFrom | 0;
+   }
+   if (msg.resyncTo !== undefined) {
+      payload.resyncTo = msg.resyncTo | 0;
+   }
+   if (msg.cfgWakeupTime !== undefined) {
+      payload.cfgWakeupTime = msg.cfgWakeupTime | 0;
+   }
+   if (msg.cfgSyncBudget !== undefined) {
+      payload.cfgSyncBudget = msg.cfgSyncBudget | 0;
+   }
+   if (msg.cfgLevelSampling !== undefined) {
+      payload.cfgLevelSampling = msg.cfgLevelSampling | 0;
+   }
+   if (msg.historyEvents !== undefined) {
+      payload.historyEvents = msg.historyEvents;
+   }
+   if (msg.historyDone !== undefined) {
+      payload.historyDone = msg.historyDone | 0;
+   }
+   return payload;
+}
+
+/* message from the watch, with its type, or null when unknown */
+function decode(payload) {
+   if (payload.dataKey !== undefined
+    && payload.dataLine !== undefined
+    && payload.dataSeq !== undefined) {
+      return { type: "data",
+       time: payload.dataKey,
+       line: payload.dataLine,
+       seq: payload.dataSeq,
+       skipped: payload.dataSkipped,
+       traceMs: payload.traceMs,
+       traceFlush: payload.traceFlush,
+       traceSend: payload.traceSend,
+       reset: payload.dataReset };
+   }
+   if (payload.resyncFirst !== undefined
+    && payload.resyncLast !== undefined) {
+      return { type: "resync_done",
+       first: payload.resyncFirst,
+       last: payload.resyncLast };
+   }
+   if (payload.historyFrom !== undefined
+    && payload.historyTo !== undefined
+    && payload.historyMax !== undefined
+    && payload.historyBatch !== undefined) {
+      return { type: "history_query",
+       from: payload.historyFrom,
+       to: payload.historyTo,
+       max: payload.historyMax,
+       batch: payload.historyBatch };
+   }
+   return null;
+}
+
+module.exports.encodeCommand = encodeCommand;
+module.exports.decode = decode;
@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * HMAC signer with the key prepared once per configuration.
+ *
+ * When the runtime has crypto.subtle, the key is imported once and every
+ * payload is signed natively. Otherwise SHA-1, SHA-224 and SHA-256 use the
+ * small implementation below, which hashes the key pads once and starts
+ * each payload from a copy of the keyed states. SHA-384 and SHA-512 fall
+ * back to jsSHA, keyed again for each payload.
+ *
+ * Signatures are delivered to a callback, synchronously or not.
+ */
+
+var jsSHA = require("sha");
+var deflate = require("deflate");
+
+var BLOCK_SIZE = 64;
+var SUBTLE_HASHES = { "SHA-1": true, "SHA-256": true, "SHA-384": true,
+ "SHA-512": true };
+
+var SHA1_IV = [0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0];
+var SHA224_IV = [0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939,
+ 0xffc00b31, 0x68581511, 0x64f98fa7, 0xbefa4fa4];
+var SHA256_IV = [0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+ 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19];
+var SHA256_K = [
+ 0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+ 0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+ 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+ 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+ 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+ 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+ 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+ 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+ 0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+ 0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+ 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2];
+
+/********************
+ * BYTE CONVERSIONS *
+ ********************/
+
+function binaryBytes(str) {
+   var result = [];
+   for (var i = 0; i < str.length; i += 1) {
+      result.push(str.charCodeAt(i) & 0xff);
+   }
+   return result;
+}
+
+function hexBytes(hex) {
+   var result = [];
+   for (var i = 0; i + 1 < hex.length; i += 2) {
+      result.push(parseInt(hex.substr(i, 2), 16));
+   }
+   return result;
+}
+
+/* bytes of a string in one of the configuration formats */
+function decode(str, format) {
+   if (format === "HEX") return hexBytes(str);
+   if (format === "B64") return deflate.base64Bytes(str);
+   if (format === "BYTES") return binaryBytes(str);
+   return deflate.textBytes(str);
+}
+
+/* digest in the signature field format, TEXT being taken as BYTES */
+function encode(bytes, format) {
+   var result = "";
+   var i;
+
+   if (format === "HEX") {
+      for (i = 0; i < bytes.length; i += 1) {
+         result += (bytes[i] < 16 ? "0" : "") + bytes[i].toString(16);
+      }
+   } else if (format === "B64") {
+      result = deflate.base64(bytes);
+   } else {
+      for (i = 0; i < bytes.length; i += 1) {
+         result += String.fromCharCode(bytes[i]);
+      }
+   }
+
+   return result;
+}
+
+/****************************
+ * RESUMABLE SHA-1, SHA-256 *
+ ****************************/
+
+function rotl(x, n) {
+   return (x << n) | (x >>> (32 - n));
+}
+
+function rotr(x, n) {
+   return (x >>> n) | (x << (32 - n));
+}
+
+function sha1Block(h, w) {
+   var a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+
+   for (var i = 0; i < 80; i += 1) {
+      if (i >= 16) {
+         w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+      }
+      var f = i < 20 ? ((b & c) | (~b & d)) + 0x5a827999
+       : i < 40 ? (b ^ c ^ d) + 0x6ed9eba1
+       : i < 60 ? ((b & c) | (b & d) | (c & d)) + 0x8f1bbcdc
+       : (b ^ c ^ d) + 0xca62c1d6;
+      var t = (rotl(a, 5) + f + e + w[i]) | 0;
+      e = d;
+      d = c;
+      c = rotl(b, 30);
+      b = a;
+      a = t;
+   }
+
+   h[0] = (h[0] + a) | 0;
+   h[1] = (h[1] + b) | 0;
+   h[2] = (h[2] + c) | 0;
+   h[3] = (h[3] + d) | 0;
+   h[4] = (h[4] + e) | 0;
+}
+
+function sha256Block(h, w) {
+   var a = h[0], b = h[1], c = h[2], d = h[3];
+   var e = h[4], f = h[5], g = h[6], k = h[7];
+
+   for (var i = 0; i < 64; i += 1) {
+      if (i >= 16) {
+         var s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18)
+          ^ (w[i - 15] >>> 3);
+         var s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19)
+          ^ (w[i - 2] >>> 10);
+         w[i] = (w[i - 16] + s0 + w[i - 7] + s1) | 0;
+      }
+      var t1 = (k + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25))
+       + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i]) | 0;
+      var t2 = ((rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22))
+       + ((a & b) ^ (a & c) ^ (b & c))) | 0;
+      k = g;
+      g = f;
+      f = e;
+      e = (d + t1) | 0;
+      d = c;
+      c = b;
+      b = a;
+      a = (t1 + t2) | 0;
+   }
+
+   h[0] = (h[0] + a) | 0;
+   h[1] = (h[1] + b) | 0;
+   h[2] = (h[2] + c) | 0;
+   h[3] = (h[3] + d) | 0;
+   h[4] = (h[4] + e) | 0;
+   h[5] = (h[5] + f) | 0;
+   h[6] = (h[6] + g) | 0;
+   h[7] = (h[7] + k) | 0;
+}
+
+var ENGINES = {
+   "SHA-1": { iv: SHA1_IV, block: sha1Block, size: 20 },
+   "SHA-224": { iv: SHA224_IV, block: sha256Block, size: 28 },
+   "SHA-256": { iv: SHA256_IV, block: sha256Block, size: 32 }
+};
+
+/* hash state, with the pending bytes of an incomplete block */
+function HashState(engine) {
+   this.engine = engine;
+   this.h = engine.iv.slice();
+   this.pending = [];
+   this.length = 0;
+}
+
+HashState.prototype.copy = function() {
+   var result = new HashState(this.engine);
+   result.h = this.h.slice();
+   result.pending = this.pending.slice();
+   result.length = this.length;
+   return result;
+};
+
+/* message schedule, shared by every state */
+var W = new Array(80);
+
+HashState.prototype.block = function(data, offset) {
+   for (var i = 0; i < 16; i += 1) {
+      var j = offset + 4 * i;
+      W[i] = (data[j] << 24) | (data[j + 1] << 16) | (data[j + 2] << 8)
+       | data[j + 3];
+   }
+   this.engine.block(this.h, W);
+};
+
+HashState.prototype.update = function(bytes) {
+   var pending = this.pending;
+   var offset = 0;
+
+   this.length += bytes.length;
+
+   if (pending.length > 0) {
+      while (pending.length < BLOCK_SIZE && offset < bytes.length) {
+         pending.push(bytes[offset]);
+         offset += 1;
+      }
+      if (pending.length < BLOCK_SIZE) return;
+      this.block(pending, 0);
+      pending.length = 0;
+   }
+
+   for (; offset + BLOCK_SIZE <= bytes.length; offset += BLOCK_SIZE) {
+      this.block(bytes, offset);
+   }
+
+   while (offset < bytes.length) {
+      pending.push(bytes[offset]);
+      offset += 1;
+   }
+};
+
+HashState.prototype.digest = function() {
+   var bits = this.length * 8;
+   var padding = [0x80];
+   var result = [];
+
+   while ((this.pending.length + padding.length) % BLOCK_SIZE !== 56) {
+      padding.push(0);
+   }
+   padding.push(0, 0, 0, Math.floor(bits / 0x100000000) & 0xff,
+    (bits >>> 24) & 0xff, (bits >>> 16) & 0xff, (bits >>> 8) & 0xff,
+    bits & 0xff);
+   this.update(padding);
+
+   for (var i = 0; result.length < this.engine.size; i += 1) {
+      result.push((this.h[i] >>> 24) & 0xff, (this.h[i] >>> 16) & 0xff,
+       (this.h[i] >>> 8) & 0xff, this.h[i] & 0xff);
+   }
+   return result.slice(0, this.engine.size);
+};
+
+/**********
+ * SIGNER *
+ **********/
+
+function hasSubtle(algo) {
+   return typeof crypto !== "undefined" && crypto && crypto.subtle
+    && typeof Promise !== "undefined" && SUBTLE_HASHES[algo] === true;
+}
+
+/* keyed states, for the resumable engines */
+function prepareStates(engine, key) {
+   var inner = new HashState(engine);
+   var outer = new HashState(engine);
+   var ipad = [], opad = [];
+
+   if (key.length > BLOCK_SIZE) {
+      var hashed = new HashState(engine);
+      hashed.update(key);
+      key = hashed.digest();
+   }
+
+   for (var i = 0; i < BLOCK_SIZE; i += 1) {
+      ipad.push((key[i] || 0) ^ 0x36);
+      opad.push((key[i] || 0) ^ 0x5c);
+   }
+   inner.update(ipad);
+   outer.update(opad);
+
+   return { inner: inner, outer: outer };
+}
+
+function Signer(algo, key, key_format, output_format, options) {
+   var mode = (options && options.mode) || "auto";
+
+   this.algo = algo;
+   this.key = key;
+   this.key_format = key_format;
+   this.output_format = output_format;
+   this.key_bytes = decode(key, key_format);
+   this.subtle_key = null;
+   this.states = null;
+
+   if ((mode === "auto" || mode === "subtle") && hasSubtle(algo)) {
+      this.subtle_key = crypto.subtle.importKey("raw",
+       new Uint8Array(this.key_bytes), { name: "HMAC", hash: algo },
+       false, ["sign"]);
+      this.mode = "subtle";
+   } else if ((mode === "auto" || mode === "cached") && ENGINES[algo]) {
+      this.states = prepareStates(ENGINES[algo], this.key_bytes);
+      this.mode = "cached";
+   } else {
+      this.mode = "jssha";
+   }
+}
+
+/* signature computed without crypto.subtle */
+Signer.prototype.signSync = function(text, format) {
+   if (this.states === null && ENGINES[this.algo]) {
+      this.states = prepareStates(ENGINES[this.algo], this.key_bytes);
+   }
+
+   if (this.states !== null) {
+      var inner = this.states.inner.copy();
+      var outer = this.states.outer.copy();
+      inner.update(decode(text, format));
+      outer.update(inner.digest());
+      return encode(outer.digest(), this.output_format);
+   }
+
+   var sha = new jsSHA(this.algo, format);
+   sha.setHMACKey(this.key, this.key_format);
+   sha.update(text);
+   return sha.getHMAC(this.output_format);
+};
+
+/* sign text given in the TEXT or B64 format, and pass the signature to
+ * callback */
+Signer.prototype.sign = function(text, format, callback) {
+   var self = this;
+
+   if (this.mode !== "subtle") {
+      callback(this.signSync(text, format));
+      return;
+   }
+
+   this.subtle_key.then(function(key) {
+      return crypto.subtle.sign("HMAC", key,
+       new Uint8Array(decode(text, format)));
+   }).then(function(signature) {
+      callback(encode(Array.prototype.slice.call(new Uint8Array(signature)),
+       self.output_format));
+   }, function(error) {
+      console.log("Native HMAC failed (" + error + "), using JS");
+      self.mode = "fallback";
+      callback(self.signSync(text, format));
+   });
+};
+
+module.exports.Signer = Signer;
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Event freshness tracing, fed by watch builds with TRACE_FRESHNESS.
+ * Every latency is measured from the worker battery handler, so the stages
+ * are cumulative: flush, send, enqueue and post.
+ */
+
+var MAX_SAMPLES = 256;
+var REPORT_EVERY = 32;
+
+var stages = ["flush", "send", "enqueue", "post"];
+var samples = {};
+var handler_time = {};
+var posted = 0;
+
+for (var i = 0; i < stages.length; i += 1) samples[stages[i]] = [];
+
+function record(stage, value) {
+   var list = samples[stage];
+   list.push(value);
+   if (list.length > MAX_SAMPLES) list.shift();
+}
+
+function percentile(sorted, p) {
+   return sorted[Math.min(sorted.length - 1,
+    Math.floor(sorted.length * p / 100))];
+}
+
+function report() {
+   for (var i = 0; i < stages.length; i += 1) {
+      var sorted = samples[stages[i]].slice().sort(function(a, b) {
+         return a - b;
+      });
+      if (sorted.length === 0) continue;
+      console.log("Freshness " + stages[i] + " (" + sorted.length
+       + " events): p50 " + percentile(sorted, 50)
+       + " ms, p90 " + percentile(sorted, 90)
+       + " ms, p99 " + percentile(sorted, 99)
+       + " ms, max " + sorted[sorted.length - 1] + " ms");
+   }
+}
+
+/* decoded data message with trace fields, just before it is enqueued */
+function received(msg) {
+   var stamp = msg.time * 1000 + msg.traceMs;
+
+   handler_time[msg.seq] = stamp;
+   record("flush", msg.traceFlush);
+   record("send", msg.traceSend);
+   record("enqueue", Date.now() - stamp);
+}
+
+/* queue items ("seq;line") confirmed by the server */
+function uploaded(items) {
+   var now = Date.now();
+
+   for (var i = 0; i < items.length; i += 1) {
+      var seq = parseInt(items[i].split(";")[0], 10);
+      if (handler_time[seq] === undefined) continue;
+      record("post", now - handler_time[seq]);
+      delete handler_time[seq];
+      posted += 1;
+      if (posted % REPORT_EVERY === 0) report();
+   }
+}
+
+module.exports.received = received;
+module.exports.uploaded = uploaded;
+module.exports.report = report;
@@ -0,0 +1,237 @@
+/* Generated by tools/gen-messages.js from messages.json, do not edit */
+
+#ifndef BATTERY_MESSAGES_H
+#define BATTERY_MESSAGES_H
+
+#define MSG_KEY_LAST_SENT	110
+#define MSG_KEY_LAST_POSTED	120
+#define MSG_KEY_LAST_SEQ	130
+#define MSG_KEY_RESYNC_FIRST	140
+#define MSG_KEY_RESYNC_LAST	150
+#define MSG_KEY_RESYNC_FROM	160
+#define MSG_KEY_RESYNC_TO	170
+#define MSG_KEY_DATA_KEY	210
+#define MSG_KEY_DATA_LINE	220
+#define MSG_KEY_DATA_SEQ	230
+#define MSG_KEY_DATA_SKIPPED	240
+#define MSG_KEY_DATA_RESET	250
+#define MSG_KEY_CFG_WAKEUP_TIME	320
+#define MSG_KEY_CFG_SYNC_BUDGET	330
+#define MSG_KEY_CFG_LEVEL_SAMPLING	340
+#define MSG_KEY_TRACE_MS	510
+#define MSG_KEY_TRACE_FLUSH	520
+#define MSG_KEY_TRACE_SEND	530
+#define MSG_KEY_HISTORY_FROM	610
+#define MSG_KEY_HISTORY_TO	620
+#define MSG_KEY_HISTORY_MAX	630
+#define MSG_KEY_HISTORY_BATCH	640
+#define MSG_KEY_HISTORY_EVENTS	650
+#define MSG_KEY_HISTORY_DONE	660
+
+#ifndef MSG_KEYS_ONLY
+
+#include <pebble.h>
+#include "profile.h"
+
+/* integer tuple of any width, sign-extended when signed, or 0 */
+static inline uint32_t
+msg_tuple_int(const Tuple *tuple) {
+	bool is_signed = tuple->type == TUPLE_INT;
+
+	switch (tuple->length) {
+	    case 1:
+		return is_signed ? (uint32_t)tuple->value->int8
+		    : tuple->value->uint8;
+	    case 2:
+		return is_signed ? (uint32_t)tuple->value->int16
+		    : tuple->value->uint16;
+	    case 4:
+		return tuple->value->uint32;
+	    default:
+		return 0;
+	}
+}
+
+/* consecutive events, one CSV line each, starting at seq */
+
+#define MSG_DATA_SKIPPED	(1u << 0)
+#define MSG_DATA_TRACE_MS	(1u << 1)
+#define MSG_DATA_TRACE_FLUSH	(1u << 2)
+#define MSG_DATA_TRACE_SEND	(1u << 3)
+#define MSG_DATA_RESET		(1u << 4)
+#define MSG_DATA_SIZE		(1 + 7 * 8 + 4 + (PROFILE_SEND_BATCH * PROFILE_LINE_SIZE) + 4 + 4 + 2 + 2 + 4 + 1)
+
+struct msg_data {
+	uint32_t fields;	/* optional fields present */
+	int32_t time;
+	const char *line;
+	uint32_t seq;
+	uint32_t skipped;
+	uint16_t trace_ms;
+	uint16_t trace_flush;
+	int32_t trace_send;
+	uint8_t reset;
+};
+
+static inline void
+msg_data_write(DictionaryIterator *iter,
+    const struct msg_data *msg) {
+	dict_write_int32(iter, MSG_KEY_DATA_KEY, msg->time);
+	dict_write_cstring(iter, MSG_KEY_DATA_LINE, msg->line);
+	dict_write_uint32(iter, MSG_KEY_DATA_SEQ, msg->seq);
+	if (msg->fields & MSG_DATA_SKIPPED)
+		dict_write_uint32(iter, MSG_KEY_DATA_SKIPPED, msg->skipped);
+	if (msg->fields & MSG_DATA_TRACE_MS)
+		dict_write_uint16(iter, MSG_KEY_TRACE_MS, msg->trace_ms);
+	if (msg->fields & MSG_DATA_TRACE_FLUSH)
+		dict_write_uint16(iter, MSG_KEY_TRACE_FLUSH, msg->trace_flush);
+	if (msg->fields & MSG_DATA_TRACE_SEND)
+		dict_write_int32(iter, MSG_KEY_TRACE_SEND, msg->trace_send);
+	if (msg->fields & MSG_DATA_RESET)
+		dict_write_uint8(iter, MSG_KEY_DATA_RESET, msg->reset);
+}
+
+/* end of a resync stream, echoing the requested range */
+
+#define MSG_RESYNC_DONE_SIZE	(1 + 7 * 2 + 4 + 4)
+
+struct msg_resync_done {
+	uint32_t fields;	/* optional fields present */
+	uint32_t first;
+	uint32_t last;
+};
+
+static inline void
+msg_resync_done_write(DictionaryIterator *iter,
+    const struct msg_resync_done *msg) {
+	dict_write_uint32(iter, MSG_KEY_RESYNC_FIRST, msg->first);
+	dict_write_uint32(iter, MSG_KEY_RESYNC_LAST, msg->last);
+}
+
+/* request for the newest archived events between two times, in batches */
+
+#define MSG_HISTORY_QUERY_SIZE	(1 + 7 * 4 + 4 + 4 + 4 + 4)
+
+struct msg_history_query {
+	uint32_t fields;	/* optional fields present */
+	int32_t from;
+	int32_t to;
+	uint32_t max;
+	uint32_t batch;
+};
+
+static inline void
+msg_history_query_write(DictionaryIterator *iter,
+    const struct msg_history_query *msg) {
+	dict_write_int32(iter, MSG_KEY_HISTORY_FROM, msg->from);
+	dict_write_int32(iter, MSG_KEY_HISTORY_TO, msg->to);
+	dict_write_uint32(iter, MSG_KEY_HISTORY_MAX, msg->max);
+	dict_write_uint32(iter, MSG_KEY_HISTORY_BATCH, msg->batch);
+}
+
+/* cursors, resync requests, configuration and archived events */
+
+#define MSG_COMMAND_LAST_SENT	(1u << 0)
+#define MSG_COMMAND_LAST_POSTED	(1u << 1)
+#define MSG_COMMAND_LAST_SEQ	(1u << 2)
+#define MSG_COMMAND_RESYNC_FIRST	(1u << 3)
+#define MSG_COMMAND_RESYNC_LAST	(1u << 4)
+#define MSG_COMMAND_RESYNC_FROM	(1u << 5)
+#define MSG_COMMAND_RESYNC_TO	(1u << 6)
+#define MSG_COMMAND_CFG_WAKEUP_TIME	(1u << 7)
+#define MSG_COMMAND_CFG_SYNC_BUDGET	(1u << 8)
+#define MSG_COMMAND_CFG_LEVEL_SAMPLING	(1u << 9)
+#define MSG_COMMAND_HISTORY_EVENTS	(1u << 10)
+#define MSG_COMMAND_HISTORY_DONE	(1u << 11)
+#define MSG_COMMAND_SIZE	(1 + 7 * 12 + 4 + 4 + 4 + 4 + 4 + 4 + 4 + 4 + 4 + 4 + (PROFILE_HISTORY_BATCH * sizeof(struct event)) + 4)
+
+struct msg_command {
+	uint32_t fields;	/* optional fields present */
+	int32_t last_sent;
+	uint32_t last_posted;
+	uint32_t last_seq;
+	uint32_t resync_first;
+	uint32_t resync_last;
+	int32_t resync_from;
+	int32_t resync_to;
+	int32_t cfg_wakeup_time;
+	int32_t cfg_sync_budget;
+	int32_t cfg_level_sampling;
+	const uint8_t *history_events;
+	uint16_t history_events_length;
+	uint32_t history_done;
+};
+
+/* returns the key of an unexpected tuple, or 0 */
+static inline uint32_t
+msg_command_read(DictionaryIterator *iter,
+    struct msg_command *msg) {
+	uint32_t unexpected = 0;
+	Tuple *tuple;
+
+	memset(msg, 0, sizeof *msg);
+	for (tuple = dict_read_first(iter);
+	    tuple;
+	    tuple = dict_read_next(iter)) {
+		switch (tuple->key) {
+		    case MSG_KEY_LAST_SENT:
+			msg->last_sent = (int32_t)msg_tuple_int(tuple);
+			msg->fields |= MSG_COMMAND_LAST_SENT;
+			break;
+		    case MSG_KEY_LAST_POSTED:
+			msg->last_posted = msg_tuple_int(tuple);
+			msg->fields |= MSG_COMMAND_LAST_POSTED;
+			break;
+		    case MSG_KEY_LAST_SEQ:
+			msg->last_seq = msg_tuple_int(tuple);
+			msg->fields |= MSG_COMMAND_LAST_SEQ;
+			break;
+		    case MSG_KEY_RESYNC_FIRST:
+			msg->resync_first = msg_tuple_int(tuple);
+			msg->fields |= MSG_COMMAND_RESYNC_FIRST;
+			break;
+		    case MSG_KEY_RESYNC_LAST:
+			msg->resync_last = msg_tuple_int(tuple);
+			msg->fields |= MSG_COMMAND_RESYNC_LAST;
+			break;
+		    case MSG_KEY_RESYNC_FROM:
+			msg->resync_from = (int32_t)msg_tuple_int(tuple);
+			msg->fields |= MSG_COMMAND_RESYNC_FROM;
+			break;
+		    case MSG_KEY_RESYNC_TO:
+			msg->resync_to = (int32_t)msg_tuple_int(tuple);
+			msg->fields |= MSG_COMMAND_RESYNC_TO;
+			break;
+		    case MSG_KEY_CFG_WAKEUP_TIME:
+			msg->cfg_wakeup_time = (int32_t)msg_tuple_int(tuple);
+			msg->fields |= MSG_COMMAND_CFG_WAKEUP_TIME;
+			break;
+		    case MSG_KEY_CFG_SYNC_BUDGET:
+			msg->cfg_sync_budget = (int32_t)msg_tuple_int(tuple);
+			msg->fields |= MSG_COMMAND_CFG_SYNC_BUDGET;
+			break;
+		    case MSG_KEY_CFG_LEVEL_SAMPLING:
+			msg->cfg_level_sampling = (int32_t)msg_tuple_int(tuple);
+			msg->fields |= MSG_COMMAND_CFG_LEVEL_SAMPLING;
+			break;
+		    case MSG_KEY_HISTORY_EVENTS:
+			msg->history_events = tuple->value->data;
+			msg->history_events_length = tuple->length;
+			msg->fields |= MSG_COMMAND_HISTORY_EVENTS;
+			break;
+		    case MSG_KEY_HISTORY_DONE:
+			msg->history_done = msg_tuple_int(tuple);
+			msg->fields |= MSG_COMMAND_HISTORY_DONE;
+			break;
+		    default:
+			unexpected = tuple->key;
+			break;
+		}
+	}
+
+	return unexpected;
+}
+
+#endif /* MSG_KEYS_ONLY */
+
+#endif /* defined BATTERY_MESSAGES_H */
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef BATTERY_PROFILE_H
+#define BATTERY_PROFILE_H
+
+#include "storage.h"
+
+/*
+ * Per-platform memory profiles, selected at build time.
+ *
+ * PROFILE_LOG_WINDOW	number of latest events formatted for the menu
+ * PROFILE_SEND_BATCH	events packed into a single data message
+ * PROFILE_SYNC_RUNS	background sync runs kept for the status line
+ * PROFILE_HISTORY_ROWS	older events fetched from the phone archive
+ * PROFILE_HISTORY_BATCH	archived events packed into a single message
+ *
+ * Aplite has 24 kB for the whole app, so it only displays part of the
+ * log and sends small batches. The other platforms show the whole page.
+ * AppMessage buffers are sized from these, see MSG_*_SIZE in messages.h.
+ */
+
+#if defined(PBL_PLATFORM_APLITE)
+#define PROFILE_LOG_WINDOW	20
+#define PROFILE_SEND_BATCH	4
+#define PROFILE_SYNC_RUNS	4
+#define PROFILE_HISTORY_ROWS	24
+#define PROFILE_HISTORY_BATCH	8
+#else
+#define PROFILE_LOG_WINDOW	PAGE_LENGTH
+#define PROFILE_SEND_BATCH	8
+#define PROFILE_SYNC_RUNS	8
+#define PROFILE_HISTORY_ROWS	64
+#define PROFILE_HISTORY_BATCH	16
+#endif
+
+/* room for one CSV line and its separator */
+#define PROFILE_LINE_SIZE	40
+
+#endif /* defined BATTERY_PROFILE_H */
@@ -35,13 +35,341 @@ struct __attribute__((__packed__)) event {
  *  - APP_STARTED
  *  - APP_CLOSED
  *  - ANOMALOUS_VALUE  (then after has the whole 8-bit value)
+ *  - SAMPLE  (summary of periodic samples, showing that the state in after
+ *    still held at that time)
  */
 
 #define UNKNOWN         0xF0
 #define APP_STARTED     0xF1
 #define APP_CLOSED      0xF2
 #define ANOMALOUS_VALUE 0xF3
+#define SAMPLE          0xF4
 
-#define PAGE_LENGTH (PERSIST_DATA_MAX_LENGTH / sizeof(struct event))
+/*
+ * The log is a ring of events stored in a persistent page, along with the
+ * sequence number the next event will get. Sequence numbers start at 1 and
+ * are never reused, and the event with sequence number seq lives in slot
+ * (seq % PAGE_LENGTH), so it does not need to be stored.
+ *
+ * Successive commits of the page go to PAGE_SLOT_COUNT keys in turn, so a
+ * reset in the middle of a write leaves the previous commit intact and no
+ * key takes all the wear. Each commit carries a counter, which selects its
+ * key, and a checksum; the current page is the newest valid slot.
+ */
+
+#define PAGE_SLOT_KEY 10	/* first of the slot keys */
+#define PAGE_SLOT_COUNT 4
+
+#define PAGE_HEADER_SIZE (sizeof(uint32_t) + 2 * sizeof(uint16_t))
+#define PAGE_LENGTH \
+    ((PERSIST_DATA_MAX_LENGTH - PAGE_HEADER_SIZE) / sizeof(struct event))
+
+struct __attribute__((__packed__)) page {
+	uint32_t next_seq;
+	uint16_t commit;
+	uint16_t check;
+	struct event events[PAGE_LENGTH];
+};
+
+/*
+ * Freshness trace, only written when TRACE_FRESHNESS is defined at the top
+ * of both the worker and the app. Each slot matches the event in the same
+ * slot of the page: handler_ms is the sub-second part of the time at which
+ * battery_handler ran, and flush_ms the delay until the page was written.
+ */
+
+#define TRACE_KEY 2
+
+struct __attribute__((__packed__)) trace_entry {
+	uint16_t handler_ms;
+	uint16_t flush_ms;
+};
+
+/*
+ * Session index, kept by the worker along with the page: a session is a
+ * run of events in the same charging state, so the app can list sessions
+ * without formatting every event. Ids start at 0 and, like events, session
+ * id lives in slot (id % SESSION_LENGTH). The newest one (next_id - 1) is
+ * still open.
+ * Events before next_seq are folded into the index, and closed_at is the
+ * time of the last APP_CLOSED when the worker has not started since.
+ * The worker keeps the index in RAM and saves it now and then, so readers
+ * fold the events that the saved copy lags behind.
+ */
+
+#define SESSION_KEY 3
+
+struct __attribute__((__packed__)) session {
+	time_t start;
+	time_t end;		/* time of the latest event */
+	uint32_t first_seq;
+	uint32_t last_seq;
+	uint8_t start_level;	/* same format as event after */
+	uint8_t end_level;
+	uint16_t gap_minutes;	/* time without worker within the session */
+};
+
+#define SESSION_HEADER_SIZE (2 * sizeof(uint32_t) + sizeof(time_t))
+#define SESSION_LENGTH \
+    ((PERSIST_DATA_MAX_LENGTH - SESSION_HEADER_SIZE) / sizeof(struct session))
+
+struct __attribute__((__packed__)) session_index {
+	uint32_t next_id;
+	uint32_t next_seq;
+	time_t closed_at;
+	struct session sessions[SESSION_LENGTH];
+};
+
+/* single-key layouts, before commit slots and before sequence numbers */
+#define LEGACY_PAGE_KEY 1
+#define V1_PAGE_LENGTH \
+    ((PERSIST_DATA_MAX_LENGTH - sizeof(uint32_t)) / sizeof(struct event))
+#define LEGACY_PAGE_LENGTH (PERSIST_DATA_MAX_LENGTH / sizeof(struct event))
+#define LEGACY_PAGE_SIZE (LEGACY_PAGE_LENGTH * sizeof(struct event))
+
+struct __attribute__((__packed__)) page_v1 {
+	uint32_t next_seq;
+	struct event events[V1_PAGE_LENGTH];
+};
+
+/* sequence number of the oldest event that can still be in the page */
+static inline uint32_t
+page_first_seq(const struct page *page) {
+	return page->next_seq > PAGE_LENGTH ? page->next_seq - PAGE_LENGTH : 1;
+}
+
+/* event with the given sequence number, or 0 when it is not in the page */
+static inline struct event *
+page_event(struct page *page, uint32_t seq) {
+	struct event *result;
+
+	if (seq < page_first_seq(page) || seq >= page->next_seq) return 0;
+	result = page->events + seq % PAGE_LENGTH;
+	return result->time ? result : 0;
+}
+
+/* sequence number of the first stored event at or after seq */
+static inline uint32_t
+page_next_valid_seq(struct page *page, uint32_t seq) {
+	if (seq < page_first_seq(page)) seq = page_first_seq(page);
+	while (seq < page->next_seq && !page_event(page, seq)) seq += 1;
+	return seq;
+}
+
+/* number of events in the page after the cursor of the phone */
+static inline uint32_t
+page_backlog(const struct page *page, uint32_t cursor) {
+	uint32_t first = page_first_seq(page);
+
+	/* a cursor beyond the log is from before it restarted */
+	if (cursor >= page->next_seq || cursor + 1 < first) cursor = first - 1;
+	return page->next_seq - 1 > cursor
+	    ? page->next_seq - 1 - cursor : 0;
+}
+
+/* checksum of a page commit, nonzero even for an all-zero page */
+static inline uint16_t
+page_checksum(const struct page *page) {
+	const uint8_t *data = (const uint8_t *)page;
+	uint16_t a = 1, b = 0;
+
+	for (size_t i = 0; i < sizeof *page; i += 1) {
+		if (i == offsetof(struct page, check)) {
+			i += sizeof page->check - 1;
+			continue;
+		}
+		a = (a + data[i]) % 255;
+		b = (b + a) % 255;
+	}
+
+	return (uint16_t)(b << 8 | a);
+}
+
+/* assign sequence numbers to a page stored in the legacy layout */
+static inline void
+page_upgrade_legacy(struct page_v1 *page) {
+	unsigned index = 0;
+
+	/* both layouts hold the same number of events */
+	memmove(page->events, page, LEGACY_PAGE_SIZE);
+
+	if (page->events[0].time) {
+		for (index = 1;
+		    index < V1_PAGE_LENGTH
+		    && page->events[index - 1].time < page->events[index].time;
+		    index += 1);
+		index %= V1_PAGE_LENGTH;
+	}
+
+	page->next_seq = index + (page->events[index].time
+	    ? 2 * V1_PAGE_LENGTH : V1_PAGE_LENGTH);
+}
+
+/* load a page from the single-key layouts, returning false on error */
+static inline bool
+page_read_v1(struct page *page) {
+	struct page_v1 old;
+	int ret = persist_read_data(LEGACY_PAGE_KEY, &old, sizeof old);
+
+	if (ret == E_DOES_NOT_EXIST) {
+		APP_LOG(APP_LOG_LEVEL_INFO,
+		    "no event page found, initializing to zero");
+		memset(&old, 0, sizeof old);
+	} else if (ret == LEGACY_PAGE_SIZE) {
+		page_upgrade_legacy(&old);
+	} else if (ret != sizeof old) {
+		APP_LOG(APP_LOG_LEVEL_ERROR,
+		    "unexpected return value %d for persist_read_data", ret);
+		return false;
+	}
+
+	/* the slot layout is one event shorter, the oldest one is dropped */
+	memset(page, 0, sizeof *page);
+	page->next_seq = old.next_seq ? old.next_seq : 1;
+	for (uint32_t seq = page_first_seq(page); seq < page->next_seq;
+	    seq += 1)
+		page->events[seq % PAGE_LENGTH]
+		    = old.events[seq % V1_PAGE_LENGTH];
+
+	return true;
+}
+
+/* load the newest valid commit of the page, returning false on error */
+static inline bool
+page_read(struct page *page) {
+	struct page slot;
+	bool found = false;
+
+	for (unsigned i = 0; i < PAGE_SLOT_COUNT; i += 1) {
+		int ret = persist_read_data(PAGE_SLOT_KEY + i,
+		    &slot, sizeof slot);
+
+		if (ret != sizeof slot
+		    || slot.commit % PAGE_SLOT_COUNT != i
+		    || slot.check != page_checksum(&slot)
+		    || (found && (int16_t)(slot.commit - page->commit) <= 0))
+			continue;
+
+		*page = slot;
+		found = true;
+	}
+
+	return found || page_read_v1(page);
+}
+
+/* commit the page to the next slot, returning false on error */
+static inline bool
+page_write(struct page *page) {
+	int ret;
+
+	page->commit += 1;
+	page->check = page_checksum(page);
+
+	ret = persist_write_data(PAGE_SLOT_KEY
+	    + page->commit % PAGE_SLOT_COUNT, page, sizeof *page);
+	if (ret < 0 || (unsigned)ret != sizeof *page) {
+		APP_LOG(APP_LOG_LEVEL_ERROR,
+		    "unexpected return value %d for persist_write_data", ret);
+		return false;
+	}
+
+	return true;
+}
+
+/* newest session, or 0 when there is none */
+static inline struct session *
+session_current(struct session_index *index) {
+	return index->next_id
+	    ? index->sessions + (index->next_id - 1) % SESSION_LENGTH : 0;
+}
+
+/* session with the given id, or 0 when it is no longer in the index */
+static inline struct session *
+session_get(struct session_index *index, uint32_t id) {
+	if (id >= index->next_id || index->next_id - id > SESSION_LENGTH)
+		return 0;
+	return index->sessions + id % SESSION_LENGTH;
+}
+
+/* fold the event with sequence number seq into the index */
+static inline void
+session_update(struct session_index *index, uint32_t seq,
+    const struct event *event) {
+	struct session *current = session_current(index);
+	uint8_t level = event->after;
+	time_t closed_at = 0;
+
+	index->next_seq = seq + 1;
+
+	if (event->before == APP_CLOSED) {
+		index->closed_at = event->time;
+	} else if (event->before == APP_STARTED) {
+		closed_at = index->closed_at;
+		index->closed_at = 0;
+	}
+
+	/* anomalous values and unknown states belong to the open session */
+	if (event->before == ANOMALOUS_VALUE || level == UNKNOWN) {
+		if (current) current->last_seq = seq;
+		return;
+	}
+
+	if (!current || (current->end_level & 0x80) != (level & 0x80)) {
+		current = index->sessions + index->next_id % SESSION_LENGTH;
+		index->next_id += 1;
+		current->start = event->time;
+		current->first_seq = seq;
+		current->start_level = level;
+		current->gap_minutes = 0;
+	} else if (closed_at && event->time > closed_at) {
+		/* the worker stopped within a session that goes on */
+		uint32_t gap = current->gap_minutes
+		    + (event->time - closed_at) / 60;
+		current->gap_minutes = gap > UINT16_MAX ? UINT16_MAX : gap;
+	}
+
+	current->end = event->time;
+	current->last_seq = seq;
+	current->end_level = level;
+}
+
+/* fold the events of the page that are not in the index yet */
+static inline void
+session_catch_up(struct session_index *index, struct page *page) {
+	uint32_t seq = page_next_valid_seq(page, index->next_seq);
+
+	while (seq < page->next_seq) {
+		session_update(index, seq, page_event(page, seq));
+		seq = page_next_valid_seq(page, seq + 1);
+	}
+}
+
+/* load the index and bring it up to date with the page */
+static inline void
+session_read(struct session_index *index, struct page *page) {
+	int ret = persist_read_data(SESSION_KEY, index, sizeof *index);
+
+	if (ret != sizeof *index || index->next_seq > page->next_seq) {
+		if (ret != E_DOES_NOT_EXIST)
+			APP_LOG(APP_LOG_LEVEL_WARNING,
+			    "rebuilding the session index (%d)", ret);
+		memset(index, 0, sizeof *index);
+	}
+
+	session_catch_up(index, page);
+}
+
+static inline bool
+session_write(struct session_index *index) {
+	int ret = persist_write_data(SESSION_KEY, index, sizeof *index);
+
+	if (ret < 0 || (unsigned)ret != sizeof *index) {
+		APP_LOG(APP_LOG_LEVEL_ERROR,
+		    "unexpected return value %d for persist_write_data", ret);
+		return false;
+	}
+
+	return true;
+}
 
 #endif /* defined BATTERY_STORAGE_H */
@@ -0,0 +1,782 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * battery-log: offline inspector for Battery- logs
+ *
+ * Decodes raw dumps of the persistent event page (one or more pages
+ * concatenated, in any known layout) and CSV lines as produced by
+ * event_csv_image(), optionally prefixed by "<seq>;" as in the phone queue.
+ * Input files are mapped and streamed, so memory use does not depend on
+ * their size.
+ *
+ * Build on the host with:
+ *	cc -O2 -o battery-log tools/battery-log.c
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* special values of event.before, see src/storage.h */
+#define UNKNOWN         0xF0
+#define APP_STARTED     0xF1
+#define APP_CLOSED      0xF2
+#define ANOMALOUS_VALUE 0xF3
+#define SAMPLE          0xF4
+
+#define EVENT_SIZE 6
+
+/*************************
+ * NORMALIZED EVENT DATA *
+ *************************/
+
+struct record {
+	const char *source;
+	uint64_t position;	/* page index or line number */
+	uint32_t seq;		/* 0 when unknown */
+	int64_t time;
+	const char *keyword;
+	int after;
+	int before;		/* -1 when absent */
+};
+
+static const char *const keywords[] = { "error", "charge", "dischg", "+",
+    "-", "unknown", "start", "start+", "stop", "stop+", "sample",
+    "sample+" };
+
+static const char *
+find_keyword(const char *s, size_t length) {
+	for (size_t i = 0; i < sizeof keywords / sizeof *keywords; i += 1)
+		if (strlen(keywords[i]) == length
+		    && !memcmp(keywords[i], s, length))
+			return keywords[i];
+	return 0;
+}
+
+/* same mapping as event_csv_image() in src/battery-minus.c */
+static void
+decode_event(struct record *r, const uint8_t *raw) {
+	uint8_t before = raw[4], after = raw[5];
+
+	r->time = (int32_t)((uint32_t)raw[0] | (uint32_t)raw[1] << 8
+	    | (uint32_t)raw[2] << 16 | (uint32_t)raw[3] << 24);
+	r->before = -1;
+
+	switch (before) {
+	    case UNKNOWN:
+		r->keyword = "unknown";
+		r->after = after;
+		break;
+	    case APP_STARTED:
+		r->keyword = (after & 0x80) ? "start+" : "start";
+		r->after = after & 0x7f;
+		break;
+	    case APP_CLOSED:
+		r->keyword = (after & 0x80) ? "stop+" : "stop";
+		r->after = after & 0x7f;
+		break;
+	    case ANOMALOUS_VALUE:
+		r->keyword = "error";
+		r->after = after;
+		break;
+	    case SAMPLE:
+		r->keyword = (after & 0x80) ? "sample+" : "sample";
+		r->after = after & 0x7f;
+		break;
+	    default:
+		r->keyword = (before & 0x80)
+		    ? ((after & 0x80) ? "+" : "dischg")
+		    : ((after & 0x80) ? "charge" : "-");
+		r->after = after & 0x7f;
+		r->before = before & 0x7f;
+		break;
+	}
+}
+
+/* days since 1970-01-01 of a proleptic Gregorian date */
+static int64_t
+days_from_civil(int64_t y, unsigned m, unsigned d) {
+	int64_t era;
+	unsigned yoe, doy, doe;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = (unsigned)(y - era * 400);
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (int64_t)doe - 719468;
+}
+
+static bool
+parse_digits(const char *s, unsigned n, unsigned *result) {
+	*result = 0;
+	for (unsigned i = 0; i < n; i += 1) {
+		if (s[i] < '0' || s[i] > '9') return false;
+		*result = *result * 10 + (unsigned)(s[i] - '0');
+	}
+	return true;
+}
+
+/* parse the fixed "YYYY-MM-DDTHH:MM:SSZ" layout */
+static bool
+parse_time(const char *s, size_t length, int64_t *result) {
+	unsigned y, mo, d, h, mi, se;
+
+	if (length != 20 || s[4] != '-' || s[7] != '-' || s[10] != 'T'
+	    || s[13] != ':' || s[16] != ':' || s[19] != 'Z'
+	    || !parse_digits(s, 4, &y) || !parse_digits(s + 5, 2, &mo)
+	    || !parse_digits(s + 8, 2, &d) || !parse_digits(s + 11, 2, &h)
+	    || !parse_digits(s + 14, 2, &mi) || !parse_digits(s + 17, 2, &se)
+	    || mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59
+	    || se > 60)
+		return false;
+
+	*result = days_from_civil(y, mo, d) * 86400 + h * 3600 + mi * 60 + se;
+	return true;
+}
+
+static bool
+parse_int(const char *s, size_t length, int *result) {
+	unsigned u;
+
+	if (length < 1 || length > 3 || !parse_digits(s, length, &u))
+		return false;
+	*result = (int)u;
+	return true;
+}
+
+/* parse "[<seq>;]<RFC3339>,<keyword>,<int>[,<int>]" */
+static bool
+parse_line(struct record *r, const char *line, size_t length) {
+	const char *field[5];
+	size_t field_length[5];
+	unsigned n = 0;
+	const char *semicolon = memchr(line, ';', length);
+	const char *end = line + length;
+	const char *p;
+
+	r->seq = 0;
+	if (semicolon) {
+		unsigned long long seq = 0;
+		for (p = line; p < semicolon; p += 1) {
+			if (*p < '0' || *p > '9') return false;
+			seq = seq * 10 + (unsigned)(*p - '0');
+		}
+		if (seq > UINT32_MAX) return false;
+		r->seq = (uint32_t)seq;
+		line = semicolon + 1;
+	}
+
+	for (p = line; n < 5; p += 1) {
+		if (p == end || *p == ',') {
+			field[n] = line;
+			field_length[n] = (size_t)(p - line);
+			n += 1;
+			line = p + 1;
+			if (p == end) break;
+		}
+	}
+
+	if (n < 3 || n > 4
+	    || !parse_time(field[0], field_length[0], &r->time)
+	    || !(r->keyword = find_keyword(field[1], field_length[1]))
+	    || !parse_int(field[2], field_length[2], &r->after))
+		return false;
+
+	r->before = -1;
+	if (n == 4 && !parse_int(field[3], field_length[3], &r->before))
+		return false;
+
+	return true;
+}
+
+/**********
+ * OUTPUT *
+ **********/
+
+#define OUTPUT_CSV	0
+#define OUTPUT_JSON	1
+#define OUTPUT_NONE	2
+
+static int output_format = OUTPUT_CSV;
+
+static void
+format_time(char *buffer, size_t size, int64_t t) {
+	time_t tt = (time_t)t;
+	struct tm tm;
+
+	if (!gmtime_r(&tt, &tm) || !strftime(buffer, size, "%FT%TZ", &tm))
+		snprintf(buffer, size, "@%" PRIi64, t);
+}
+
+static void
+output_record(const struct record *r) {
+	char date[32];
+
+	if (output_format == OUTPUT_NONE) return;
+	format_time(date, sizeof date, r->time);
+
+	if (output_format == OUTPUT_JSON) {
+		printf("{\"source\":\"%s\",\"position\":%" PRIu64
+		    ",\"seq\":", r->source, r->position);
+		if (r->seq) printf("%" PRIu32, r->seq);
+		else fputs("null", stdout);
+		printf(",\"time\":%" PRIi64 ",\"date\":\"%s\",\"event\":\"%s\""
+		    ",\"after\":%d,\"before\":", r->time, date, r->keyword,
+		    r->after);
+		if (r->before >= 0) printf("%d}\n", r->before);
+		else fputs("null}\n", stdout);
+		return;
+	}
+
+	printf("%s,%" PRIu64 ",", r->source, r->position);
+	if (r->seq) printf("%" PRIu32, r->seq);
+	printf(",%" PRIi64 ",%s,%s,%d,", r->time, date, r->keyword, r->after);
+	if (r->before >= 0) printf("%d", r->before);
+	putchar('\n');
+}
+
+/**************
+ * STATISTICS *
+ **************/
+
+#define STAT_FIRST_DAY	16436	/* 2015-01-01 */
+#define STAT_DAYS	8192
+
+static bool want_stats;
+static bool want_verify;
+
+static uint64_t stat_events;
+static uint64_t stat_anomalies;
+static uint64_t stat_unknown;
+static uint64_t stat_out_of_range;
+static uint32_t stat_per_day[STAT_DAYS];
+
+static uint64_t stat_sessions;
+static int64_t stat_session_seconds;
+static int64_t stat_session_gain;
+
+static uint64_t verify_disorders;
+static uint64_t verify_duplicates;
+static uint64_t verify_seq_errors;
+static uint64_t verify_bad_pages;
+static uint64_t verify_bad_lines;
+
+/* per-input state, reset for every file */
+struct stream {
+	int64_t last_time;
+	uint32_t last_seq;
+	bool charging;
+	int64_t charge_start;
+	int charge_level;
+};
+
+static bool
+is_charging_keyword(const char *keyword) {
+	return !strcmp(keyword, "charge") || !strcmp(keyword, "+")
+	    || !strcmp(keyword, "start+") || !strcmp(keyword, "stop+");
+}
+
+static void
+account_record(struct stream *st, const struct record *r) {
+	int64_t day = r->time / 86400 - STAT_FIRST_DAY;
+	bool charging;
+
+	if (want_verify) {
+		if (st->last_time && r->time < st->last_time) {
+			verify_disorders += 1;
+			fprintf(stderr, "%s:%" PRIu64 ": time goes back by %"
+			    PRIi64 " s\n", r->source, r->position,
+			    st->last_time - r->time);
+		} else if (r->time == st->last_time) {
+			verify_duplicates += 1;
+			fprintf(stderr, "%s:%" PRIu64 ": duplicate timestamp\n",
+			    r->source, r->position);
+		}
+		if (r->seq && st->last_seq && r->seq != st->last_seq + 1) {
+			verify_seq_errors += 1;
+			fprintf(stderr, "%s:%" PRIu64 ": sequence %" PRIu32
+			    " after %" PRIu32 "\n", r->source, r->position,
+			    r->seq, st->last_seq);
+		}
+	}
+	st->last_time = r->time;
+	if (r->seq) st->last_seq = r->seq;
+
+	if (!want_stats) return;
+
+	stat_events += 1;
+	if (day >= 0 && day < STAT_DAYS) stat_per_day[day] += 1;
+	else stat_out_of_range += 1;
+	if (!strcmp(r->keyword, "error")) {
+		stat_anomalies += 1;
+		return;
+	}
+	if (!strcmp(r->keyword, "unknown")) stat_unknown += 1;
+
+	/* a charge session runs from the first charging to the first
+	 * discharging event, app stops while charging do not end it */
+	charging = is_charging_keyword(r->keyword);
+	if (!strcmp(r->keyword, "stop+") || !strcmp(r->keyword, "stop"))
+		return;
+	if (charging && !st->charging) {
+		st->charging = true;
+		st->charge_start = r->time;
+		st->charge_level = r->before >= 0 ? r->before : r->after;
+	} else if (!charging && st->charging) {
+		st->charging = false;
+		stat_sessions += 1;
+		stat_session_seconds += r->time - st->charge_start;
+		stat_session_gain += (r->before >= 0 ? r->before : r->after)
+		    - st->charge_level;
+	}
+}
+
+static void
+print_stats(void) {
+	char date[32];
+
+	printf("events\t%" PRIu64 "\n", stat_events);
+	printf("anomalies\t%" PRIu64 "\n", stat_anomalies);
+	printf("unknown\t%" PRIu64 "\n", stat_unknown);
+	if (stat_out_of_range)
+		printf("out_of_range\t%" PRIu64 "\n", stat_out_of_range);
+	printf("charge_sessions\t%" PRIu64 "\n", stat_sessions);
+	if (stat_sessions)
+		printf("charge_avg_minutes\t%.1f\ncharge_avg_gain\t%.1f\n",
+		    (double)stat_session_seconds / 60.0 / (double)stat_sessions,
+		    (double)stat_session_gain / (double)stat_sessions);
+
+	for (unsigned i = 0; i < STAT_DAYS; i += 1) {
+		if (!stat_per_day[i]) continue;
+		format_time(date, sizeof date,
+		    ((int64_t)i + STAT_FIRST_DAY) * 86400);
+		date[10] = 0;
+		printf("day\t%s\t%" PRIu32 "\n", date, stat_per_day[i]);
+	}
+}
+
+/***************
+ * PAGE INPUTS *
+ ***************/
+
+/*
+ * Known layouts of the persistent page, newest first. Unless one is
+ * selected explicitly, a dump is decoded with the layout whose size divides
+ * the file size and under which most of its first pages look sound, and
+ * refused when several layouts fit equally well.
+ */
+struct layout {
+	const char *name;
+	size_t size;		/* bytes per page */
+	size_t header;		/* bytes before the first event */
+	size_t next_seq;	/* offset of next_seq, or SIZE_MAX */
+	size_t check;		/* offset of the checksum, or SIZE_MAX */
+	size_t length;		/* events per page */
+};
+
+static const struct layout layouts[] = {
+	{ "slot", 8 + 41 * EVENT_SIZE, 8, 0, 6, 41 },
+	{ "seq", 4 + 42 * EVENT_SIZE, 4, 0, SIZE_MAX, 42 },
+	{ "legacy", 42 * EVENT_SIZE, 0, SIZE_MAX, SIZE_MAX, 42 },
+};
+
+/* same as page_checksum() in src/storage.h */
+static uint16_t
+page_checksum(const uint8_t *page, size_t size, size_t check) {
+	unsigned a = 1, b = 0;
+
+	for (size_t i = 0; i < size; i += 1) {
+		if (i == check || i == check + 1) continue;
+		a = (a + page[i]) % 255;
+		b = (b + a) % 255;
+	}
+
+	return (uint16_t)(b << 8 | a);
+}
+
+static uint32_t
+read_u32(const uint8_t *p) {
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16
+	    | (uint32_t)p[3] << 24;
+}
+
+/* event times before 2013, when the first Pebble shipped, are garbage */
+#define MIN_EVENT_TIME 1356998400
+#define GUESS_PAGES 64
+
+/* whether a page decodes into sensible events with the layout */
+static bool
+page_is_sound(const uint8_t *page, const struct layout *layout) {
+	const uint8_t *events = page + layout->header;
+	uint32_t max_time = (uint32_t)time(0) + 86400;
+	uint32_t previous = 0;
+	unsigned descents = 0;
+
+	if (layout->check != SIZE_MAX)
+		return (page[layout->check] | page[layout->check + 1] << 8)
+		    == page_checksum(page, layout->size, layout->check);
+
+	/* a sequence number cannot have grown anywhere near a time */
+	if (layout->next_seq != SIZE_MAX
+	    && (!read_u32(page + layout->next_seq)
+	      || read_u32(page + layout->next_seq) >= MIN_EVENT_TIME))
+		return false;
+
+	for (size_t i = 0; i < layout->length; i += 1) {
+		uint32_t t = read_u32(events + i * EVENT_SIZE);
+
+		if (!t) continue;
+		if (t < MIN_EVENT_TIME || t > max_time) return false;
+		if (t < previous) descents += 1;
+		previous = t;
+	}
+
+	/* slots are written in time order, wrapping around once */
+	return descents <= 1;
+}
+
+/* layout of a dump without --layout, or 0 after reporting why not */
+static const struct layout *
+guess_layout(const char *source, const uint8_t *data, size_t size) {
+	const struct layout *result = 0, *tie = 0;
+	size_t best = 0;
+
+	for (size_t i = 0; i < sizeof layouts / sizeof *layouts; i += 1) {
+		const struct layout *layout = layouts + i;
+		size_t sound = 0;
+
+		if (size % layout->size) continue;
+		for (size_t offset = 0; offset < size
+		    && offset < GUESS_PAGES * layout->size;
+		    offset += layout->size)
+			sound += page_is_sound(data + offset, layout);
+
+		if (!result || sound > best) {
+			result = layout;
+			tie = 0;
+			best = sound;
+		} else if (sound == best)
+			tie = layout;
+	}
+
+	if (!result) {
+		fprintf(stderr, "%s: size %zu matches no page layout\n",
+		    source, size);
+		return 0;
+	}
+
+	if (!best) {
+		fprintf(stderr, "%s: no page layout fits, "
+		    "select one with --layout\n", source);
+		return 0;
+	}
+
+	if (tie) {
+		fprintf(stderr, "%s: layouts %s and %s both fit, "
+		    "select one with --layout\n", source, result->name,
+		    tie->name);
+		return 0;
+	}
+
+	return result;
+}
+
+static void
+process_page(const char *source, uint64_t index, const uint8_t *page,
+    const struct layout *layout) {
+	const uint8_t *events = page + layout->header;
+	struct stream st = { 0 };
+	struct record r = { .source = source, .position = index };
+	uint32_t next_seq, first_seq, seq;
+	size_t start = 0;
+
+	if (layout->check != SIZE_MAX
+	    && (page[layout->check] | page[layout->check + 1] << 8)
+	    != page_checksum(page, layout->size, layout->check)) {
+		verify_bad_pages += want_verify;
+		return;
+	}
+
+	if (layout->next_seq != SIZE_MAX) {
+		next_seq = read_u32(page + layout->next_seq);
+		if (!next_seq) {
+			verify_bad_pages += want_verify;
+			return;
+		}
+		first_seq = next_seq > layout->length
+		    ? next_seq - (uint32_t)layout->length : 1;
+	} else {
+		/* legacy pages are ordered by time, find the oldest slot */
+		for (start = 1; start < layout->length
+		    && read_u32(events + (start - 1) * EVENT_SIZE)
+		      < read_u32(events + start * EVENT_SIZE);
+		    start += 1);
+		start %= layout->length;
+		if (!read_u32(events + start * EVENT_SIZE)) start = 0;
+		first_seq = next_seq = 0;
+	}
+
+	for (size_t i = 0; i < layout->length; i += 1) {
+		size_t slot;
+
+		if (next_seq) {
+			seq = first_seq + (uint32_t)i;
+			if (seq >= next_seq) break;
+			slot = seq % layout->length;
+		} else {
+			seq = 0;
+			slot = (start + i) % layout->length;
+		}
+
+		if (!read_u32(events + slot * EVENT_SIZE)) continue;
+		decode_event(&r, events + slot * EVENT_SIZE);
+		r.seq = seq;
+		output_record(&r);
+		account_record(&st, &r);
+	}
+}
+
+static const struct layout *forced_layout;
+
+static void
+process_pages(const char *source, const uint8_t *data, size_t size) {
+	const struct layout *layout = forced_layout;
+
+	if (!layout) layout = guess_layout(source, data, size);
+
+	if (!layout) {
+		verify_bad_pages += 1;
+		return;
+	} else if (size % layout->size) {
+		fprintf(stderr, "%s: size %zu does not match layout %s\n",
+		    source, size, layout->name);
+		verify_bad_pages += 1;
+		return;
+	}
+
+	for (size_t offset = 0; offset < size; offset += layout->size) {
+		madvise((void *)((uintptr_t)(data + offset) & ~(uintptr_t)4095),
+		    layout->size, MADV_SEQUENTIAL);
+		process_page(source, offset / layout->size, data + offset,
+		    layout);
+	}
+}
+
+/**************
+ * CSV INPUTS *
+ **************/
+
+static void
+process_lines(const char *source, const uint8_t *data, size_t size) {
+	const char *p = (const char *)data;
+	const char *end = p + size;
+	struct stream st = { 0 };
+	struct record r = { .source = source };
+
+	while (p < end) {
+		const char *eol = memchr(p, '\n', (size_t)(end - p));
+		size_t length = (size_t)((eol ? eol : end) - p);
+
+		r.position += 1;
+		if (length && p[length - 1] == '\r') length -= 1;
+
+		if (length && parse_line(&r, p, length)) {
+			output_record(&r);
+			account_record(&st, &r);
+		} else if (length) {
+			verify_bad_lines += 1;
+			if (want_verify)
+				fprintf(stderr, "%s:%" PRIu64
+				    ": unparsable line\n", source, r.position);
+		}
+
+		p = eol ? eol + 1 : end;
+	}
+}
+
+/******************
+ * FILE MANAGEMENT *
+ ******************/
+
+#define INPUT_AUTO	0
+#define INPUT_PAGES	1
+#define INPUT_CSV	2
+
+static bool
+looks_like_text(const uint8_t *data, size_t size) {
+	size_t n = size < 64 ? size : 64;
+
+	for (size_t i = 0; i < n; i += 1)
+		if (data[i] != '\n' && data[i] != '\r'
+		    && (data[i] < 0x20 || data[i] > 0x7e))
+			return false;
+	return n > 0;
+}
+
+static int
+process_file(const char *path, int input_type) {
+	struct stat st;
+	const uint8_t *data;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return 1;
+	}
+
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	data = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap: %s\n", path, strerror(errno));
+		return 1;
+	}
+	madvise((void *)data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+	if (input_type == INPUT_AUTO)
+		input_type = looks_like_text(data, (size_t)st.st_size)
+		    ? INPUT_CSV : INPUT_PAGES;
+
+	if (input_type == INPUT_CSV)
+		process_lines(path, data, (size_t)st.st_size);
+	else
+		process_pages(path, data, (size_t)st.st_size);
+
+	munmap((void *)data, (size_t)st.st_size);
+	return 0;
+}
+
+static void
+usage(FILE *out, const char *name) {
+	fprintf(out, "Usage: %s [options] file...\n"
+	    "  -f, --format=csv|json|none  normalized output format\n"
+	    "  -i, --input=auto|pages|csv  input type\n"
+	    "  -l, --layout=NAME           page layout (slot, seq, legacy)\n"
+	    "  -s, --stats                 print statistics\n"
+	    "  -v, --verify                check ordering and duplicates\n"
+	    "  -h, --help                  show this help\n", name);
+}
+
+int
+main(int argc, char **argv) {
+	static const struct option options[] = {
+		{ "format", required_argument, 0, 'f' },
+		{ "input", required_argument, 0, 'i' },
+		{ "layout", required_argument, 0, 'l' },
+		{ "stats", no_argument, 0, 's' },
+		{ "verify", no_argument, 0, 'v' },
+		{ "help", no_argument, 0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+	int input_type = INPUT_AUTO;
+	bool has_format = false;
+	int c, errors = 0;
+
+	while ((c = getopt_long(argc, argv, "f:i:l:svh", options, 0)) != -1) {
+		switch (c) {
+		    case 'f':
+			has_format = true;
+			if (!strcmp(optarg, "csv")) output_format = OUTPUT_CSV;
+			else if (!strcmp(optarg, "json"))
+				output_format = OUTPUT_JSON;
+			else if (!strcmp(optarg, "none"))
+				output_format = OUTPUT_NONE;
+			else {
+				usage(stderr, argv[0]);
+				return 2;
+			}
+			break;
+		    case 'i':
+			if (!strcmp(optarg, "auto")) input_type = INPUT_AUTO;
+			else if (!strcmp(optarg, "pages"))
+				input_type = INPUT_PAGES;
+			else if (!strcmp(optarg, "csv")) input_type = INPUT_CSV;
+			else {
+				usage(stderr, argv[0]);
+				return 2;
+			}
+			break;
+		    case 'l':
+			for (size_t i = 0;
+			    i < sizeof layouts / sizeof *layouts; i += 1)
+				if (!strcmp(optarg, layouts[i].name))
+					forced_layout = layouts + i;
+			if (!forced_layout) {
+				usage(stderr, argv[0]);
+				return 2;
+			}
+			break;
+		    case 's':
+			want_stats = true;
+			break;
+		    case 'v':
+			want_verify = true;
+			break;
+		    case 'h':
+			usage(stdout, argv[0]);
+			return 0;
+		    default:
+			usage(stderr, argv[0]);
+			return 2;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(stderr, argv[0]);
+		return 2;
+	}
+
+	/* statistics replace the event listing unless asked otherwise */
+	if ((want_stats || want_verify) && !has_format)
+		output_format = OUTPUT_NONE;
+
+	for (int i = optind; i < argc; i += 1)
+		errors += process_file(argv[i], input_type);
+
+	if (want_stats) print_stats();
+
+	if (want_verify) {
+		printf("disorders\t%" PRIu64 "\nduplicates\t%" PRIu64
+		    "\nsequence_errors\t%" PRIu64 "\nbad_pages\t%" PRIu64
+		    "\nbad_lines\t%" PRIu64 "\n", verify_disorders,
+		    verify_duplicates, verify_seq_errors, verify_bad_pages,
+		    verify_bad_lines);
+		if (verify_disorders || verify_seq_errors || verify_bad_pages
+		    || verify_bad_lines)
+			errors += 1;
+	}
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * csv-ingest-bench: throughput of csv-ingest against a naive parser
+ *
+ * Generates random lines in the format of event_csv_image(), checks that
+ * both parsers agree on them, and reports lines per second for each.
+ *
+ * Usage: csv-ingest-bench [lines [rounds]]
+ *
+ * Build on the host with:
+ *	cc -O2 -o csv-ingest-bench tools/csv-ingest-bench.c tools/csv-ingest.c
+ */
+
+#define _DEFAULT_SOURCE
+
+#include "csv-ingest.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/****************
+ * NAIVE PARSER *
+ ****************/
+
+/* generic CSV handling: copy each line, split it, convert with libc */
+static size_t
+naive_ingest(struct csv_columns *columns, const char *data, size_t length) {
+	char line[256];
+	const char *p = data, *end = data + length;
+
+	while (p < end && columns->count < columns->capacity) {
+		const char *eol = memchr(p, '\n', (size_t)(end - p));
+		size_t n = (size_t)((eol ? eol : end) - p);
+		char *field[5], *save = 0, *tok;
+		unsigned count = 0;
+		struct tm tm;
+		int keyword = -1;
+
+		if (n >= sizeof line) n = sizeof line - 1;
+		memcpy(line, p, n);
+		line[n] = 0;
+		p = eol ? eol + 1 : end;
+		if (n == 0) continue;
+
+		for (tok = strtok_r(line, ",", &save); tok && count < 5;
+		    tok = strtok_r(0, ",", &save))
+			field[count++] = tok;
+
+		memset(&tm, 0, sizeof tm);
+		if (count < 3 || count > 4
+		    || sscanf(field[0], "%4d-%2d-%2dT%2d:%2d:%2dZ", &tm.tm_year,
+		      &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min,
+		      &tm.tm_sec) != 6) {
+			columns->errors += 1;
+			continue;
+		}
+
+		tm.tm_year -= 1900;
+		tm.tm_mon -= 1;
+		for (int k = CSV_ERROR; k <= CSV_SAMPLE_CHARGING; k += 1)
+			if (!strcmp(field[1], csv_keyword_name(k))) keyword = k;
+		if (keyword < 0) {
+			columns->errors += 1;
+			continue;
+		}
+
+		columns->time[columns->count] = timegm(&tm);
+		columns->keyword[columns->count] = (uint8_t)keyword;
+		columns->after[columns->count]
+		    = (uint8_t)strtol(field[2], 0, 10);
+		columns->before[columns->count] = count > 3
+		    ? (int16_t)strtol(field[3], 0, 10) : -1;
+		columns->count += 1;
+	}
+
+	return (size_t)(p - data);
+}
+
+/*************
+ * GENERATOR *
+ *************/
+
+static size_t
+generate(char *buffer, size_t lines) {
+	size_t length = 0;
+	time_t t = 1451606400;
+
+	for (size_t i = 0; i < lines; i += 1) {
+		int keyword = rand() % (CSV_SAMPLE_CHARGING + 1);
+		char stamp[32];
+
+		t += rand() % 7200;
+		strftime(stamp, sizeof stamp, "%FT%TZ", gmtime(&t));
+
+		if (keyword >= CSV_CHARGE && keyword <= CSV_DISCHARGING)
+			length += (size_t)sprintf(buffer + length,
+			    "%s,%s,%d,%d\n", stamp, csv_keyword_name(keyword),
+			    rand() % 101, rand() % 101);
+		else
+			length += (size_t)sprintf(buffer + length, "%s,%s,%d\n",
+			    stamp, csv_keyword_name(keyword), rand() % 101);
+	}
+
+	return length;
+}
+
+/********
+ * MAIN *
+ ********/
+
+static bool
+alloc_columns(struct csv_columns *c, size_t capacity) {
+	c->time = calloc(capacity, sizeof *c->time);
+	c->keyword = calloc(capacity, sizeof *c->keyword);
+	c->after = calloc(capacity, sizeof *c->after);
+	c->before = calloc(capacity, sizeof *c->before);
+	c->capacity = capacity;
+	c->count = c->errors = 0;
+	return c->time && c->keyword && c->after && c->before;
+}
+
+static double
+now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int
+main(int argc, char **argv) {
+	size_t lines = argc > 1 ? strtoul(argv[1], 0, 10) : 1000000;
+	unsigned rounds = argc > 2 ? (unsigned)strtoul(argv[2], 0, 10) : 5;
+	char *buffer = malloc(lines * 40 + 1);
+	struct csv_columns fast, naive;
+	size_t length;
+	double best_fast = 0, best_naive = 0;
+
+	if (!buffer || !alloc_columns(&fast, lines)
+	    || !alloc_columns(&naive, lines)) {
+		fprintf(stderr, "Unable to allocate %zu lines\n", lines);
+		return EXIT_FAILURE;
+	}
+
+	srand(1);
+	length = generate(buffer, lines);
+
+	for (unsigned r = 0; r < rounds; r += 1) {
+		double start, fast_time, naive_time;
+
+		fast.count = fast.errors = 0;
+		start = now();
+		csv_ingest(&fast, buffer, length, 1);
+		fast_time = now() - start;
+
+		naive.count = naive.errors = 0;
+		start = now();
+		naive_ingest(&naive, buffer, length);
+		naive_time = now() - start;
+
+		if (r == 0 || fast_time < best_fast) best_fast = fast_time;
+		if (r == 0 || naive_time < best_naive) best_naive = naive_time;
+	}
+
+	if (fast.count != lines || naive.count != lines
+	    || memcmp(fast.time, naive.time, lines * sizeof *fast.time)
+	    || memcmp(fast.keyword, naive.keyword, lines)
+	    || memcmp(fast.after, naive.after, lines)
+	    || memcmp(fast.before, naive.before,
+	      lines * sizeof *fast.before)) {
+		fprintf(stderr, "Parsers disagree (%zu and %zu records)\n",
+		    fast.count, naive.count);
+		return EXIT_FAILURE;
+	}
+
+	printf("%zu lines, %zu bytes, best of %u rounds\n",
+	    lines, length, rounds);
+	printf("csv-ingest: %12.0f lines/s %8.1f MB/s\n",
+	    lines / best_fast, length / best_fast / 1e6);
+	printf("naive:      %12.0f lines/s %8.1f MB/s\n",
+	    lines / best_naive, length / best_naive / 1e6);
+	printf("speedup:    %12.1fx\n", best_naive / best_fast);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * csv-ingest: bulk parser for Battery- CSV lines
+ *
+ * Delimiters are located 64 bytes at a time, as bit masks of commas and
+ * newlines, so that lines are split without looking at each byte, and the
+ * time field is checked against its fixed layout in a single comparison.
+ * SSE2 is used when available, with a portable fallback otherwise (or when
+ * CSV_INGEST_SCALAR is defined).
+ *
+ * Build on the host along with a program using it, e.g.:
+ *	cc -O2 -o csv-ingest-bench tools/csv-ingest-bench.c tools/csv-ingest.c
+ */
+
+#include "csv-ingest.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__SSE2__) && !defined(CSV_INGEST_SCALAR)
+#define CSV_INGEST_SSE2
+#include <emmintrin.h>
+#endif
+
+#define BLOCK_SIZE 64
+#define MAX_COMMAS 3
+#define TIME_LENGTH 20
+
+static const char *const keyword_names[] = { "error", "charge", "dischg",
+    "+", "-", "unknown", "start", "start+", "stop", "stop+", "sample",
+    "sample+" };
+
+const char *
+csv_keyword_name(enum csv_keyword keyword) {
+	if ((unsigned)keyword >= sizeof keyword_names / sizeof *keyword_names)
+		return 0;
+	return keyword_names[keyword];
+}
+
+/*********************
+ * DELIMITER SCANNER *
+ *********************/
+
+/* bit i of *structurals is set when p[i] is a comma or a newline,
+ * and bit i of *newlines when it is a newline */
+static void
+scan_block(const char *p, uint64_t *structurals, uint64_t *newlines) {
+#ifdef CSV_INGEST_SSE2
+	const __m128i comma = _mm_set1_epi8(',');
+	const __m128i newline = _mm_set1_epi8('\n');
+	uint64_t c = 0, n = 0;
+
+	for (unsigned i = 0; i < BLOCK_SIZE / 16; i += 1) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+		c |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+		    _mm_cmpeq_epi8(v, comma)) << (16 * i);
+		n |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+		    _mm_cmpeq_epi8(v, newline)) << (16 * i);
+	}
+
+	*structurals = c | n;
+	*newlines = n;
+#else
+	uint64_t c = 0, n = 0;
+
+	for (unsigned i = 0; i < BLOCK_SIZE; i += 1) {
+		c |= (uint64_t)(p[i] == ',') << i;
+		n |= (uint64_t)(p[i] == '\n') << i;
+	}
+
+	*structurals = c | n;
+	*newlines = n;
+#endif
+}
+
+static unsigned
+lowest_bit(uint64_t mask) {
+#if defined(__GNUC__)
+	return (unsigned)__builtin_ctzll(mask);
+#else
+	unsigned result = 0;
+	while (!(mask & 1)) {
+		mask >>= 1;
+		result += 1;
+	}
+	return result;
+#endif
+}
+
+/*****************
+ * FIELD DECODER *
+ *****************/
+
+/* days since 1970-01-01 of a proleptic Gregorian date */
+static int64_t
+days_from_civil(int64_t y, unsigned m, unsigned d) {
+	int64_t era;
+	unsigned yoe, doy, doe;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = (unsigned)(y - era * 400);
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (int64_t)doe - 719468;
+}
+
+/* decode "YYYY-MM-DDTHH:MM:SSZ", of which the caller guarantees that
+ * TIME_LENGTH bytes are readable */
+static bool
+decode_time(const char *s, int64_t *result) {
+	uint8_t d[TIME_LENGTH];
+	unsigned y, mo, day, h, mi, se;
+
+#ifdef CSV_INGEST_SSE2
+	/* digits in 0-3, 5-6, 8-9, 11-12, 14-15, separators in 4, 7, 10, 13 */
+	const __m128i layout = _mm_setr_epi8(0, 0, 0, 0, '-', 0, 0, '-',
+	    0, 0, 'T', 0, 0, ':', 0, 0);
+	__m128i v = _mm_loadu_si128((const __m128i *)s);
+	__m128i digits = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+	unsigned is_digit = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(
+	    _mm_min_epu8(digits, _mm_set1_epi8(9)), digits));
+	unsigned is_separator = (unsigned)_mm_movemask_epi8(
+	    _mm_cmpeq_epi8(v, layout));
+
+	if ((is_digit & 0xDB6F) != 0xDB6F
+	    || (is_separator & 0x2490) != 0x2490)
+		return false;
+	_mm_storeu_si128((__m128i *)d, digits);
+#else
+	static const char layout[] = "0000-00-00T00:00";
+
+	for (unsigned i = 0; i < 16; i += 1) {
+		d[i] = (uint8_t)(s[i] - '0');
+		if (layout[i] == '0' ? d[i] > 9 : s[i] != layout[i])
+			return false;
+	}
+#endif
+
+	d[17] = (uint8_t)(s[17] - '0');
+	d[18] = (uint8_t)(s[18] - '0');
+	if (s[16] != ':' || d[17] > 9 || d[18] > 9 || s[19] != 'Z')
+		return false;
+
+	y = d[0] * 1000u + d[1] * 100u + d[2] * 10u + d[3];
+	mo = d[5] * 10u + d[6];
+	day = d[8] * 10u + d[9];
+	h = d[11] * 10u + d[12];
+	mi = d[14] * 10u + d[15];
+	se = d[17] * 10u + d[18];
+
+	if (mo < 1 || mo > 12 || day < 1 || day > 31 || h > 23 || mi > 59
+	    || se > 60)
+		return false;
+
+	*result = days_from_civil(y, mo, day) * 86400
+	    + h * 3600 + mi * 60 + se;
+	return true;
+}
+
+static int
+decode_keyword(const char *s, size_t length) {
+	switch (length) {
+	    case 1:
+		return s[0] == '+' ? CSV_CHARGING
+		    : s[0] == '-' ? CSV_DISCHARGING : -1;
+	    case 4:
+		return memcmp(s, "stop", 4) ? -1 : CSV_STOP;
+	    case 5:
+		return !memcmp(s, "error", 5) ? CSV_ERROR
+		    : !memcmp(s, "start", 5) ? CSV_START
+		    : !memcmp(s, "stop+", 5) ? CSV_STOP_CHARGING : -1;
+	    case 6:
+		return !memcmp(s, "charge", 6) ? CSV_CHARGE
+		    : !memcmp(s, "dischg", 6) ? CSV_DISCHG
+		    : !memcmp(s, "start+", 6) ? CSV_START_CHARGING
+		    : !memcmp(s, "sample", 6) ? CSV_SAMPLE : -1;
+	    case 7:
+		return !memcmp(s, "unknown", 7) ? CSV_UNKNOWN
+		    : !memcmp(s, "sample+", 7) ? CSV_SAMPLE_CHARGING : -1;
+	    default:
+		return -1;
+	}
+}
+
+/* 1 to 3 decimal digits, at most 255 */
+static int
+decode_int(const char *s, size_t length) {
+	unsigned result = 0;
+
+	if (length < 1 || length > 3) return -1;
+
+	for (size_t i = 0; i < length; i += 1) {
+		unsigned digit = (unsigned)(s[i] - '0');
+		if (digit > 9) return -1;
+		result = result * 10 + digit;
+	}
+
+	return result > 255 ? -1 : (int)result;
+}
+
+/* store the record of a line, given the offsets of its commas */
+static void
+store_line(struct csv_columns *columns, const char *line, size_t length,
+    const size_t *commas, unsigned comma_count) {
+	size_t n = columns->count;
+	size_t after_end;
+	int keyword, after, before = -1;
+
+	if (length == 0) return;
+
+	if (comma_count < 2 || comma_count > MAX_COMMAS
+	    || commas[0] != TIME_LENGTH
+	    || !decode_time(line, &columns->time[n])) {
+		columns->errors += 1;
+		return;
+	}
+
+	after_end = comma_count > 2 ? commas[2] : length;
+	keyword = decode_keyword(line + commas[0] + 1,
+	    commas[1] - commas[0] - 1);
+	after = decode_int(line + commas[1] + 1, after_end - commas[1] - 1);
+	if (comma_count > 2)
+		before = decode_int(line + commas[2] + 1,
+		    length - commas[2] - 1);
+
+	if (keyword < 0 || after < 0 || (comma_count > 2 && before < 0)) {
+		columns->errors += 1;
+		return;
+	}
+
+	columns->keyword[n] = (uint8_t)keyword;
+	columns->after[n] = (uint8_t)after;
+	columns->before[n] = (int16_t)before;
+	columns->count = n + 1;
+}
+
+/**********
+ * DRIVER *
+ **********/
+
+size_t
+csv_ingest(struct csv_columns *columns, const char *data, size_t length,
+    int final) {
+	size_t commas[MAX_COMMAS + 1];
+	unsigned comma_count = 0;
+	size_t line_start = 0;
+	char tail[BLOCK_SIZE];
+
+	for (size_t base = 0; base < length; base += BLOCK_SIZE) {
+		uint64_t structurals, newlines;
+
+		if (length - base >= BLOCK_SIZE) {
+			scan_block(data + base, &structurals, &newlines);
+		} else {
+			memset(tail, 0, sizeof tail);
+			memcpy(tail, data + base, length - base);
+			scan_block(tail, &structurals, &newlines);
+		}
+
+		while (structurals) {
+			unsigned bit = lowest_bit(structurals);
+			size_t pos = base + bit;
+
+			structurals &= structurals - 1;
+
+			if (!((newlines >> bit) & 1)) {
+				if (comma_count <= MAX_COMMAS)
+					commas[comma_count] = pos - line_start;
+				comma_count += 1;
+				continue;
+			}
+
+			if (columns->count >= columns->capacity)
+				return line_start;
+
+			store_line(columns, data + line_start,
+			    pos - line_start, commas, comma_count);
+			line_start = pos + 1;
+			comma_count = 0;
+		}
+	}
+
+	if (final && line_start < length
+	    && columns->count < columns->capacity) {
+		store_line(columns, data + line_start, length - line_start,
+		    commas, comma_count);
+		line_start = length;
+	}
+
+	return line_start;
+}
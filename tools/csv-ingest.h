@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * csv-ingest: bulk parser for Battery- CSV lines
+ *
+ * Parses the exact "<RFC3339>,<keyword>,<int>[,<int>]" lines produced by
+ * event_csv_image() in src/battery-minus.c into columnar arrays. Lines are
+ * separated by '\n', and times always use the "YYYY-MM-DDTHH:MM:SSZ"
+ * layout, which is what makes a fixed-offset decoder possible.
+ */
+
+#ifndef CSV_INGEST_H
+#define CSV_INGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* keywords of event_csv_image(), in the order of battery-log */
+enum csv_keyword {
+	CSV_ERROR,
+	CSV_CHARGE,
+	CSV_DISCHG,
+	CSV_CHARGING,
+	CSV_DISCHARGING,
+	CSV_UNKNOWN,
+	CSV_START,
+	CSV_START_CHARGING,
+	CSV_STOP,
+	CSV_STOP_CHARGING,
+	CSV_SAMPLE,
+	CSV_SAMPLE_CHARGING,
+};
+
+/* caller-allocated columns, each with room for capacity records */
+struct csv_columns {
+	int64_t *time;		/* seconds since the epoch */
+	uint8_t *keyword;	/* enum csv_keyword */
+	uint8_t *after;
+	int16_t *before;	/* -1 when absent */
+	size_t capacity;
+	size_t count;		/* records stored so far */
+	size_t errors;		/* malformed lines skipped so far */
+};
+
+/* appends the records of complete lines in data to columns, and returns
+ * the number of bytes consumed, which is less than length when columns
+ * are full or when data ends with an unterminated line and final is 0 */
+size_t
+csv_ingest(struct csv_columns *columns, const char *data, size_t length,
+    int final);
+
+/* keyword as it appears in CSV lines */
+const char *
+csv_keyword_name(enum csv_keyword keyword);
+
+#endif /* CSV_INGEST_H */
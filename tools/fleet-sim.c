@@ -0,0 +1,1565 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * fleet-sim: many simulated watches syncing to a local ingest stand-in
+ *
+ * Runs the real worker and application of each device on top of
+ * tools/mem-shim for days of simulated time, with the phone side of
+ * src/js/app.js modeled in C: cursor, missing ranges, upload queue,
+ * batches, concurrent uploads, retries and circuit breaker. Uploads reach
+ * a server stand-in, which parses them with tools/csv-ingest.c and checks
+ * the sequence numbers of their events against those generated on the
+ * watch.
+ *
+ * The worker and the application keep their state in file-scope
+ * variables, so each device runs in its own process: a pool of --jobs
+ * processes forks a child per device, and that child forks again for
+ * each launch of the application, which starts afresh as on the watch.
+ * The persistent storage, the phone state and the server view of a device
+ * live in memory shared by its processes.
+ *
+ * The device loop steps every minute: battery (draining, charging when
+ * the user plugs the watch in, glitches of a worn battery, levels
+ * reported in steps), connection to the phone, wakeups, launches requested
+ * by the worker and launches by the user. While the application runs, the
+ * link has a latency and loses messages, the JS only answers once started,
+ * and the connection does not change. The JS only runs along the
+ * application, so uploads cut short when it closes wait for the next
+ * launch.
+ *
+ * Reported for the fleet and for each class of devices: events generated,
+ * delivered, delivered more than once, still pending on the watch or the
+ * phone, skipped by the watch after folding them, and lost; server
+ * requests per device-day and in the busiest hour; flash writes per
+ * device-day.
+ *
+ * Population files hold "name value" lines, "#" starting a comment, and
+ * "class <name>" lines starting a class of devices. Lines before the first
+ * class change the defaults of all of them:
+ *	share			relative number of devices in the class
+ *	drain_hours		full discharge time
+ *	charge_hours		full charge time
+ *	charge_at		level at which the watch gets plugged in
+ *	charge_hour		hour of a nightly charge, -1 for none
+ *	unplug_at		level at which the watch gets unplugged
+ *	level_step		granularity of the reported level
+ *	glitches_per_day	one-minute drops of the reported level
+ *	wakeup_time		minute of the day of the sync, -1 for none
+ *	wakeup_spread		random shift of wakeup_time, in minutes
+ *	sync_budget		background sync time limit, in seconds
+ *	opens_per_day		launches by the user, between 7:00 and 23:00
+ *	open_s			time the user keeps the app open
+ *	connected		share of the time spent near the phone
+ *	disconnect_for_min	mean time away from the phone
+ *	latency_ms		one-way latency of the link
+ *	loss			probability of losing a message
+ *	js_start_ms		time for the JS to be ready after a launch
+ *	batch_size		events per upload (cfgBatchSize)
+ *	max_uploads		concurrent uploads (cfgMaxUploads)
+ *	upload_ms		upload round trip
+ *	server_error		probability of a 503 from the server
+ *	request_loss		probability of a request not reaching it
+ *	response_loss		probability of a response not coming back
+ *
+ * Usage: fleet-sim [options] population
+ *
+ * Build on the host, from the top directory, with:
+ *	cc -O2 -Itools/mem-shim -Isrc -Dmain=app_main -c \
+ *	    src/battery-minus.c src/simple_dialog.c
+ *	cc -O2 -Itools/mem-shim -Isrc -Dmain=worker_main -c \
+ *	    worker_src/battery-minus_worker.c
+ *	cc -O2 -Itools/mem-shim -Isrc -o fleet-sim tools/fleet-sim.c \
+ *	    tools/mem-shim/shim.c tools/csv-ingest.c battery-minus.o \
+ *	    simple_dialog.o battery-minus_worker.o -lm
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "shim.h"
+#include "messages.h"
+#include "profile.h"
+#include "storage.h"
+#include "csv-ingest.h"
+
+#undef time_t
+#undef malloc
+#undef free
+
+#define SIM_START	1459987200	/* 2016-04-07T00:00:00Z */
+#define MAX_CLASSES	16
+#define CLASS_NAME_SIZE	32
+
+/* phone side, from src/js/app.js */
+#define QUEUE_LENGTH		8192
+#define MAX_MISSING		32
+#define MAX_COMMANDS		64
+#define MAX_UPLOADS		16
+#define RETRY_BASE_DELAY	2000
+#define RETRY_MAX_DELAY		(5 * 60 * 1000)
+#define BREAKER_THRESHOLD	5
+#define BREAKER_BASE_PAUSE	(10 * 60 * 1000)
+#define BREAKER_MAX_PAUSE	(6 * 60 * 60 * 1000)
+#define UPLOAD_TIMEOUT		30000
+
+/* link and firmware */
+#define OUTBOX_TIMEOUT_MS	3000
+#define PHONE_MS		5
+#define APP_RUN_LIMIT_MS	(15 * 60 * 1000)
+
+int app_main(void);
+int worker_main(void);
+
+/**************
+ * POPULATION *
+ **************/
+
+struct device_class {
+	char name[CLASS_NAME_SIZE];
+	double share;
+	double drain_hours;
+	double charge_hours;
+	double charge_at;
+	double charge_hour;
+	double unplug_at;
+	double level_step;
+	double glitches_per_day;
+	double wakeup_time;
+	double wakeup_spread;
+	double sync_budget;
+	double opens_per_day;
+	double open_s;
+	double connected;
+	double disconnect_for_min;
+	double latency_ms;
+	double loss;
+	double js_start_ms;
+	double batch_size;
+	double max_uploads;
+	double upload_ms;
+	double server_error;
+	double request_loss;
+	double response_loss;
+};
+
+static const struct device_class default_class = {
+	.name = "default",
+	.share = 1,
+	.drain_hours = 120,
+	.charge_hours = 2,
+	.charge_at = 20,
+	.charge_hour = -1,
+	.unplug_at = 100,
+	.level_step = 10,
+	.wakeup_time = 8 * 60,
+	.wakeup_spread = 60,
+	.sync_budget = 60,
+	.opens_per_day = 2,
+	.open_s = 20,
+	.connected = 0.9,
+	.disconnect_for_min = 60,
+	.latency_ms = 50,
+	.loss = 0.01,
+	.js_start_ms = 1500,
+	.batch_size = 1,
+	.max_uploads = 2,
+	.upload_ms = 400,
+	.server_error = 0.001,
+	.request_loss = 0.002,
+	.response_loss = 0.002
+};
+
+static struct device_class classes[MAX_CLASSES];
+static unsigned class_count;
+
+static bool
+set_parameter(struct device_class *c, const char *name, double value) {
+	static const struct {
+		const char *name;
+		size_t offset;
+	} fields[] = {
+	    { "share", offsetof(struct device_class, share) },
+	    { "drain_hours", offsetof(struct device_class, drain_hours) },
+	    { "charge_hours", offsetof(struct device_class, charge_hours) },
+	    { "charge_at", offsetof(struct device_class, charge_at) },
+	    { "charge_hour", offsetof(struct device_class, charge_hour) },
+	    { "unplug_at", offsetof(struct device_class, unplug_at) },
+	    { "level_step", offsetof(struct device_class, level_step) },
+	    { "glitches_per_day",
+	      offsetof(struct device_class, glitches_per_day) },
+	    { "wakeup_time", offsetof(struct device_class, wakeup_time) },
+	    { "wakeup_spread", offsetof(struct device_class, wakeup_spread) },
+	    { "sync_budget", offsetof(struct device_class, sync_budget) },
+	    { "opens_per_day", offsetof(struct device_class, opens_per_day) },
+	    { "open_s", offsetof(struct device_class, open_s) },
+	    { "connected", offsetof(struct device_class, connected) },
+	    { "disconnect_for_min",
+	      offsetof(struct device_class, disconnect_for_min) },
+	    { "latency_ms", offsetof(struct device_class, latency_ms) },
+	    { "loss", offsetof(struct device_class, loss) },
+	    { "js_start_ms", offsetof(struct device_class, js_start_ms) },
+	    { "batch_size", offsetof(struct device_class, batch_size) },
+	    { "max_uploads", offsetof(struct device_class, max_uploads) },
+	    { "upload_ms", offsetof(struct device_class, upload_ms) },
+	    { "server_error", offsetof(struct device_class, server_error) },
+	    { "request_loss", offsetof(struct device_class, request_loss) },
+	    { "response_loss", offsetof(struct device_class, response_loss) }
+	};
+
+	for (size_t i = 0; i < sizeof fields / sizeof *fields; i += 1)
+		if (!strcmp(name, fields[i].name)) {
+			*(double *)((char *)c + fields[i].offset) = value;
+			return true;
+		}
+
+	return false;
+}
+
+/* name of the first invalid parameter, or 0 */
+static const char *
+check_class(const struct device_class *c) {
+	if (c->share < 0) return "share";
+	if (c->drain_hours <= 0) return "drain_hours";
+	if (c->charge_hours <= 0) return "charge_hours";
+	if (c->charge_hour >= 24) return "charge_hour";
+	if (c->unplug_at <= c->charge_at || c->unplug_at > 100)
+		return "unplug_at";
+	if (c->level_step < 1 || c->level_step > 100) return "level_step";
+	if (c->wakeup_time >= 24 * 60) return "wakeup_time";
+	if (c->sync_budget < 5 || c->sync_budget > 600) return "sync_budget";
+	if (c->connected < 0 || c->connected > 1) return "connected";
+	if (c->disconnect_for_min <= 0) return "disconnect_for_min";
+	if (c->batch_size < 1) return "batch_size";
+	if (c->max_uploads < 1 || c->max_uploads > MAX_UPLOADS)
+		return "max_uploads";
+	if (c->server_error + c->request_loss + c->response_loss > 1)
+		return "response_loss";
+	return 0;
+}
+
+static int
+read_population(const char *path) {
+	char line[256], name[64], class_name[CLASS_NAME_SIZE];
+	struct device_class defaults = default_class;
+	struct device_class *current = &defaults;
+	double value, total = 0;
+	unsigned line_no = 0;
+	FILE *f = fopen(path, "r");
+
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof line, f)) {
+		char *comment = strchr(line, '#');
+		char extra;
+
+		line_no += 1;
+		if (comment) *comment = 0;
+		if (sscanf(line, " %63s", name) != 1) continue;
+
+		if (!strcmp(name, "class")) {
+			if (sscanf(line, " class %31s %c", class_name, &extra)
+			    != 1 || class_count >= MAX_CLASSES) {
+				fprintf(stderr, "%s:%u: invalid class\n",
+				    path, line_no);
+				fclose(f);
+				return -1;
+			}
+			current = classes + class_count++;
+			*current = defaults;
+			strcpy(current->name, class_name);
+			continue;
+		}
+
+		if (sscanf(line, " %63s %lf %c", name, &value, &extra) != 2
+		    || !set_parameter(current, name, value)) {
+			fprintf(stderr, "%s:%u: invalid line\n", path, line_no);
+			fclose(f);
+			return -1;
+		}
+	}
+
+	fclose(f);
+
+	/* a file without class describes a single one */
+	if (!class_count) classes[class_count++] = defaults;
+
+	for (unsigned i = 0; i < class_count; i += 1) {
+		const char *invalid = check_class(classes + i);
+
+		if (invalid) {
+			fprintf(stderr, "%s: invalid %s in class %s\n", path,
+			    invalid, classes[i].name);
+			return -1;
+		}
+		total += classes[i].share;
+	}
+
+	if (total <= 0) {
+		fprintf(stderr, "%s: no device in any class\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**********
+ * RANDOM *
+ **********/
+
+/* lives with the device, so that app launches advance it too */
+static uint64_t *rng_state;
+
+/* xorshift64*, so runs are reproducible from the seed */
+static double
+uniform(void) {
+	*rng_state ^= *rng_state >> 12;
+	*rng_state ^= *rng_state << 25;
+	*rng_state ^= *rng_state >> 27;
+	return (double)((*rng_state * UINT64_C(2685821657736338717)) >> 11)
+	    / (double)(UINT64_C(1) << 53);
+}
+
+static double
+exponential(double mean) {
+	return -mean * log(1.0 - uniform());
+}
+
+/* splitmix64, spreading the seed over devices */
+static uint64_t
+device_seed(uint64_t seed, unsigned index) {
+	uint64_t z = seed + (index + 1) * UINT64_C(0x9e3779b97f4a7c15);
+
+	z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+	z ^= z >> 31;
+	return z ? z : 1;
+}
+
+/*****************
+ * SHARED MEMORY *
+ *****************/
+
+/* localStorage of the JS */
+struct phone {
+	uint32_t last_seq;
+	uint32_t last_posted;
+	uint32_t missing[MAX_MISSING][2];
+	unsigned missing_count;
+	struct {
+		uint32_t seq;
+		char line[PROFILE_LINE_SIZE];
+	} queue[QUEUE_LENGTH];		/* to_send, as a ring */
+	unsigned queue_head;
+	unsigned queue_count;
+};
+
+struct device_result {
+	unsigned cls;
+	bool is_done;
+	uint32_t generated;
+	uint32_t delivered;
+	uint32_t duplicates;
+	uint32_t pending;
+	uint32_t folded;
+	uint32_t lost;
+	uint32_t requests;
+	uint32_t server_errors;
+	uint32_t parse_errors;
+	uint32_t queue_overflows;
+	unsigned long flash_writes;
+	unsigned launches[3];		/* user, wakeup, worker */
+	unsigned stuck_runs;
+};
+
+#define LAUNCH_USER	0
+#define LAUNCH_WAKEUP	1
+#define LAUNCH_WORKER	2
+
+struct device {
+	const struct device_class *cls;
+	uint64_t rng;
+	struct shim_persist persist;
+	struct phone phone;
+	struct device_result result;
+	int32_t wakeup_time;		/* scheduled by the last app run */
+	int64_t app_end_ms;
+	uint32_t seq_capacity;
+	uint8_t *delivered;		/* bitmaps of sequence numbers */
+	uint8_t *skipped;
+};
+
+struct fleet {
+	unsigned next_device;
+	unsigned days;
+	uint32_t hourly[];		/* server requests per simulated hour */
+};
+
+static struct fleet *fleet;
+static struct device_result *results;
+static struct device *device;
+
+static void *
+shared_alloc(size_t size) {
+	void *result = mmap(0, size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (result == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	return result;
+}
+
+static bool
+bit_test(const uint8_t *bitmap, uint32_t seq) {
+	return bitmap[seq / 8] & (1u << seq % 8);
+}
+
+/* returns whether the bit was already set */
+static bool
+bit_set(uint8_t *bitmap, uint32_t seq) {
+	bool result = bit_test(bitmap, seq);
+
+	bitmap[seq / 8] |= (uint8_t)(1u << seq % 8);
+	return result;
+}
+
+/**********
+ * SERVER *
+ **********/
+
+struct upload {
+	unsigned count;		/* queued items, after those of earlier ones */
+	bool is_done;
+	bool is_failed;
+	int server_status;	/* 200 or 503, 0 when the request is lost */
+	int status;		/* seen by the phone, 0 on timeout */
+	int64_t server_at;	/* -1 once handled */
+	int64_t done_at;
+};
+
+static void
+server_receive(const struct upload *upload, unsigned first) {
+	struct phone *phone = &device->phone;
+	struct device_result *r = &device->result;
+	int64_t hour = (shim_now - SIM_START) / 3600;
+	struct csv_columns columns = { .capacity = upload->count };
+	char *data, *cursor;
+
+	r->requests += 1;
+	if (hour >= 0 && hour < (int64_t)fleet->days * 24)
+		__atomic_fetch_add(&fleet->hourly[hour], 1, __ATOMIC_RELAXED);
+	if (upload->server_status != 200) {
+		r->server_errors += 1;
+		return;
+	}
+
+	/* the body of the request, one line per event */
+	data = cursor = malloc(upload->count * PROFILE_LINE_SIZE);
+	if (!data) shim_fail("out of memory");
+	for (unsigned i = 0; i < upload->count; i += 1) {
+		unsigned slot = (phone->queue_head + first + i) % QUEUE_LENGTH;
+		size_t length = strlen(phone->queue[slot].line);
+
+		memcpy(cursor, phone->queue[slot].line, length);
+		cursor[length] = '\n';
+		cursor += length + 1;
+
+		if (phone->queue[slot].seq >= device->seq_capacity)
+			shim_fail("sequence number out of range");
+		if (bit_set(device->delivered, phone->queue[slot].seq))
+			r->duplicates += 1;
+	}
+
+	/* the ingest stand-in parses it */
+	columns.time = malloc(upload->count * sizeof *columns.time);
+	columns.keyword = malloc(upload->count);
+	columns.after = malloc(upload->count);
+	columns.before = malloc(upload->count * sizeof *columns.before);
+	if (!columns.time || !columns.keyword || !columns.after
+	    || !columns.before)
+		shim_fail("out of memory");
+	csv_ingest(&columns, data, (size_t)(cursor - data), 1);
+	r->parse_errors += (uint32_t)(columns.errors
+	    + (upload->count - columns.count - columns.errors));
+
+	free(columns.time);
+	free(columns.keyword);
+	free(columns.after);
+	free(columns.before);
+	free(data);
+}
+
+/*********
+ * PHONE *
+ *********/
+
+struct command {
+	int64_t due;
+	uint32_t keys[2];
+	uint32_t values[2];
+	unsigned count;
+};
+
+/* state of the JS, lost when the application closes */
+static int64_t js_ready_at;
+static bool is_js_ready;
+static struct command commands[MAX_COMMANDS];
+static unsigned command_head;
+static unsigned command_count;
+static struct upload uploads[MAX_UPLOADS];
+static unsigned upload_count;
+static unsigned dispatched;
+static unsigned failures;
+static int64_t breaker_pause;
+static int64_t retry_at = -1;
+
+static void
+send_command(uint32_t key, uint32_t value, uint32_t key2,
+    uint32_t value2) {
+	struct command *command;
+	int64_t due = shim_clock_ms() + (int64_t)device->cls->latency_ms;
+
+	/* Pebble.sendAppMessage failures are only logged by the JS */
+	if (!shim_connected || uniform() < device->cls->loss
+	    || command_count >= MAX_COMMANDS)
+		return;
+
+	if (command_count) {
+		const struct command *last = commands
+		    + (command_head + command_count - 1) % MAX_COMMANDS;
+		if (last->due > due) due = last->due;
+	}
+
+	command = commands + (command_head + command_count) % MAX_COMMANDS;
+	command_count += 1;
+	command->due = due;
+	command->keys[0] = key;
+	command->values[0] = value;
+	command->keys[1] = key2;
+	command->values[1] = value2;
+	command->count = key2 ? 2 : 1;
+}
+
+static void
+deliver_command(void) {
+	struct command *command = commands + command_head;
+	DictionaryIterator *iter = shim_inbox_begin();
+
+	command_head = (command_head + 1) % MAX_COMMANDS;
+	command_count -= 1;
+	for (unsigned i = 0; i < command->count; i += 1)
+		dict_write_uint32(iter, command->keys[i], command->values[i]);
+	shim_deliver();
+}
+
+static void
+request_resync(uint32_t first, uint32_t last) {
+	send_command(MSG_KEY_RESYNC_FIRST, first, MSG_KEY_RESYNC_LAST, last);
+}
+
+static void
+add_missing(uint32_t first, uint32_t last) {
+	struct phone *phone = &device->phone;
+
+	if (phone->missing_count >= MAX_MISSING) return;
+	phone->missing[phone->missing_count][0] = first;
+	phone->missing[phone->missing_count][1] = last;
+	phone->missing_count += 1;
+	request_resync(first, last);
+}
+
+/* remove [first, last] from missing ranges, returning the removed count */
+static uint32_t
+remove_missing(uint32_t first, uint32_t last) {
+	struct phone *phone = &device->phone;
+	uint32_t updated[MAX_MISSING][2];
+	unsigned count = 0;
+	uint32_t result = 0;
+
+	for (unsigned i = 0; i < phone->missing_count; i += 1) {
+		uint32_t *range = phone->missing[i];
+
+		if (range[1] < first || range[0] > last) {
+			updated[count][0] = range[0];
+			updated[count++][1] = range[1];
+			continue;
+		}
+		result += (range[1] < last ? range[1] : last)
+		    - (range[0] > first ? range[0] : first) + 1;
+		if (range[0] < first && count < MAX_MISSING) {
+			updated[count][0] = range[0];
+			updated[count++][1] = first - 1;
+		}
+		if (range[1] > last && count < MAX_MISSING) {
+			updated[count][0] = last + 1;
+			updated[count++][1] = range[1];
+		}
+	}
+
+	if (result > 0) {
+		memcpy(phone->missing, updated, sizeof updated);
+		phone->missing_count = count;
+	}
+	return result;
+}
+
+static void
+start_upload(struct upload *upload) {
+	const struct device_class *c = device->cls;
+	int64_t now = shim_clock_ms();
+	double draw = uniform();
+
+	upload->is_failed = false;
+	upload->server_status = upload->status = 200;
+	upload->server_at = now + (int64_t)(c->upload_ms / 2);
+	upload->done_at = now + (int64_t)c->upload_ms;
+
+	if (draw < c->request_loss) {
+		upload->server_status = upload->status = 0;
+		upload->server_at = -1;
+		upload->done_at = now + UPLOAD_TIMEOUT;
+	} else if (draw < c->request_loss + c->server_error) {
+		upload->server_status = upload->status = 503;
+	} else if (draw < c->request_loss + c->server_error
+	    + c->response_loss) {
+		upload->status = 0;
+		upload->done_at = now + UPLOAD_TIMEOUT;
+	}
+}
+
+/* dispatch queued items until the pool of concurrent uploads is full */
+static void
+pump_uploads(void) {
+	const struct device_class *c = device->cls;
+	unsigned queued = device->phone.queue_count;
+
+	unsigned pool = breaker_pause ? 1 : (unsigned)c->max_uploads;
+
+	if (!is_js_ready || retry_at >= 0) return;
+
+	/* a half-open breaker lets a single upload probe the endpoint */
+	while (upload_count < pool && dispatched < queued) {
+		struct upload *upload = uploads + upload_count++;
+
+		upload->count = queued - dispatched < (unsigned)c->batch_size
+		    ? queued - dispatched : (unsigned)c->batch_size;
+		upload->is_done = false;
+		dispatched += upload->count;
+		start_upload(upload);
+	}
+}
+
+static void
+enqueue(uint32_t seq, const char *line, size_t length) {
+	struct phone *phone = &device->phone;
+	unsigned slot;
+
+	if (phone->queue_count >= QUEUE_LENGTH) {
+		device->result.queue_overflows += 1;
+		return;
+	}
+
+	slot = (phone->queue_head + phone->queue_count) % QUEUE_LENGTH;
+	if (length >= PROFILE_LINE_SIZE) length = PROFILE_LINE_SIZE - 1;
+	phone->queue[slot].seq = seq;
+	memcpy(phone->queue[slot].line, line, length);
+	phone->queue[slot].line[length] = 0;
+	phone->queue_count += 1;
+	pump_uploads();
+}
+
+static void
+receive_event(uint32_t seq, uint32_t skipped, const char *line,
+    size_t length) {
+	struct phone *phone = &device->phone;
+
+	/* whatever the watch skipped is gone, folded into later events */
+	for (uint32_t s = seq - skipped; s < seq; s += 1)
+		if (s < device->seq_capacity) bit_set(device->skipped, s);
+
+	if (seq <= phone->last_seq) {
+		if (skipped > 0) remove_missing(seq - skipped, seq - 1);
+		/* outside of a resync window, so a duplicate is dropped */
+		if (remove_missing(seq, seq) == 0) return;
+		enqueue(seq, line, length);
+		return;
+	}
+
+	if (seq - skipped > phone->last_seq + 1)
+		add_missing(phone->last_seq + 1, seq - skipped - 1);
+
+	phone->last_seq = seq;
+	enqueue(seq, line, length);
+}
+
+/* appmessage handler, on a data message or a resync marker */
+static void
+receive_message(DictionaryIterator *iter) {
+	uint32_t seq = 0, skipped = 0, first = 0, last = 0;
+	const char *line = 0;
+	bool has_seq = false, has_first = false, has_last = false;
+	bool is_reset = false;
+
+	for (Tuple *tuple = dict_read_first(iter); tuple;
+	    tuple = dict_read_next(iter)) {
+		if (tuple->key == MSG_KEY_DATA_SEQ) {
+			seq = tuple->value->uint32;
+			has_seq = true;
+		} else if (tuple->key == MSG_KEY_DATA_SKIPPED)
+			skipped = tuple->value->uint32;
+		else if (tuple->key == MSG_KEY_DATA_LINE)
+			line = tuple->value->cstring;
+		else if (tuple->key == MSG_KEY_DATA_RESET)
+			is_reset = true;
+		else if (tuple->key == MSG_KEY_RESYNC_FIRST) {
+			first = tuple->value->uint32;
+			has_first = true;
+		} else if (tuple->key == MSG_KEY_RESYNC_LAST) {
+			last = tuple->value->uint32;
+			has_last = true;
+		}
+	}
+
+	if (has_seq && line && is_reset) {
+		/* the watch log restarted below the cursor, see logReset */
+		device->phone.last_seq = seq - skipped - 1;
+		device->phone.last_posted = 0;
+		device->phone.missing_count = 0;
+	}
+
+	if (has_seq && line) {
+		/* batches hold consecutive events, one line each */
+		for (uint32_t i = 0; ; i += 1) {
+			const char *end = strchr(line, '\n');
+			size_t length = end ? (size_t)(end - line)
+			    : strlen(line);
+
+			receive_event(seq + i, i ? 0 : skipped, line, length);
+			if (!end) break;
+			line = end + 1;
+		}
+	} else if (has_first && has_last)
+		remove_missing(first, last);
+}
+
+/* highest sequence number with every received event up to it posted */
+static uint32_t
+posted_cursor(void) {
+	const struct phone *phone = &device->phone;
+	uint32_t result = phone->last_seq;
+
+	for (unsigned i = 0; i < phone->queue_count; i += 1) {
+		uint32_t seq = phone->queue[(phone->queue_head + i)
+		    % QUEUE_LENGTH].seq;
+		if (seq - 1 < result) result = seq - 1;
+	}
+	for (unsigned i = 0; i < phone->missing_count; i += 1)
+		if (phone->missing[i][0] - 1 < result)
+			result = phone->missing[i][0] - 1;
+
+	return result;
+}
+
+/* remove the confirmed prefix of the queue and report it to the watch */
+static void
+ack_uploads(void) {
+	struct phone *phone = &device->phone;
+	unsigned removed = 0, count = 0;
+	uint32_t cursor;
+
+	while (count < upload_count && uploads[count].is_done) {
+		removed += uploads[count].count;
+		count += 1;
+	}
+	if (removed == 0) return;
+
+	memmove(uploads, uploads + count,
+	    (upload_count - count) * sizeof *uploads);
+	upload_count -= count;
+	phone->queue_head = (phone->queue_head + removed) % QUEUE_LENGTH;
+	phone->queue_count -= removed;
+	dispatched -= removed;
+
+	cursor = posted_cursor();
+	if (cursor > phone->last_posted) {
+		phone->last_posted = cursor;
+		send_command(MSG_KEY_LAST_POSTED, cursor, 0, 0);
+	}
+}
+
+static int64_t
+retry_delay(void) {
+	double delay;
+
+	if (failures >= BREAKER_THRESHOLD) {
+		/* endpoint looks down, pause uploads */
+		breaker_pause = breaker_pause
+		    ? (breaker_pause * 2 < BREAKER_MAX_PAUSE
+		      ? breaker_pause * 2 : BREAKER_MAX_PAUSE)
+		    : BREAKER_BASE_PAUSE;
+		return breaker_pause;
+	}
+
+	/* exponential backoff with "equal jitter" */
+	delay = RETRY_BASE_DELAY * pow(2, failures - 1);
+	if (delay > RETRY_MAX_DELAY) delay = RETRY_MAX_DELAY;
+	return (int64_t)(delay / 2 + uniform() * delay / 2);
+}
+
+/* first item of an upload, in the queue */
+static unsigned
+upload_first(const struct upload *upload) {
+	unsigned result = 0;
+
+	for (const struct upload *u = uploads; u < upload; u += 1)
+		result += u->count;
+	return result;
+}
+
+static void
+retry_uploads(void) {
+	retry_at = -1;
+	for (unsigned i = 0; i < upload_count; i += 1) {
+		if (!uploads[i].is_failed) continue;
+		start_upload(uploads + i);
+		/* after a pause, the others wait for this probe to succeed */
+		if (breaker_pause) break;
+	}
+	pump_uploads();
+}
+
+static void
+upload_finished(struct upload *upload) {
+	bool was_probe = breaker_pause > 0;
+
+	upload->done_at = -1;
+
+	if (upload->status == 200) {
+		failures = 0;
+		breaker_pause = 0;
+		upload->is_done = true;
+		ack_uploads();
+		if (was_probe)
+			retry_uploads();
+		else
+			pump_uploads();
+		return;
+	}
+
+	upload->is_failed = true;
+	failures += 1;
+	retry_at = shim_clock_ms() + retry_delay();
+}
+
+static void
+js_ready(void) {
+	struct phone *phone = &device->phone;
+
+	is_js_ready = true;
+	send_command(MSG_KEY_LAST_SEQ, phone->last_seq,
+	    MSG_KEY_LAST_POSTED, phone->last_posted);
+	for (unsigned i = 0; i < phone->missing_count; i += 1)
+		request_resync(phone->missing[i][0], phone->missing[i][1]);
+	pump_uploads();
+}
+
+/*******************
+ * APPLICATION RUN *
+ *******************/
+
+static int64_t outbox_due = -1;
+static AppMessageResult outbox_result;
+
+/* fate of a new outbox message, decided when it is sent */
+static void
+check_outbox(void) {
+	const struct device_class *c = device->cls;
+	int64_t now = shim_clock_ms();
+	int64_t arrival = now + (int64_t)c->latency_ms;
+
+	if (!shim_outbox_pending || outbox_due >= 0) return;
+
+	if (!shim_connected) {
+		outbox_due = now;
+		outbox_result = APP_MSG_NOT_CONNECTED;
+	} else if (uniform() < c->loss) {
+		outbox_due = now + OUTBOX_TIMEOUT_MS;
+		outbox_result = APP_MSG_SEND_TIMEOUT;
+	} else if (js_ready_at > arrival) {
+		/* no JS to handle it yet */
+		outbox_due = arrival + (int64_t)c->latency_ms;
+		outbox_result = APP_MSG_SEND_REJECTED;
+	} else {
+		outbox_due = arrival + PHONE_MS + (int64_t)c->latency_ms;
+		outbox_result = APP_MSG_OK;
+	}
+}
+
+static void
+finish_outbox(void) {
+	outbox_due = -1;
+	if (outbox_result == APP_MSG_OK) receive_message(&shim_outbox);
+	shim_outbox_done(outbox_result);
+}
+
+static int64_t
+earliest(int64_t a, int64_t b) {
+	return b >= 0 && b < a ? b : a;
+}
+
+void
+app_event_loop(void) {
+	const struct device_class *c = device->cls;
+	int64_t start = shim_clock_ms();
+	int64_t close_at = shim_launch_reason == APP_LAUNCH_USER
+	    ? start + (int64_t)(c->open_s * 1000) : INT64_MAX;
+
+	js_ready_at = shim_connected ? start + (int64_t)c->js_start_ms
+	    : INT64_MAX;
+
+	while (shim_window_count() > 0) {
+		int64_t next = shim_next_timer_ms(), now;
+		struct upload *upload = 0;
+
+		check_outbox();
+		next = earliest(next, outbox_due);
+		next = earliest(next, is_js_ready ? -1 : js_ready_at);
+		next = earliest(next, command_count
+		    ? commands[command_head].due : -1);
+		next = earliest(next, retry_at);
+		next = earliest(next, close_at);
+		for (unsigned i = 0; i < upload_count; i += 1) {
+			int64_t t = earliest(earliest(INT64_MAX,
+			    uploads[i].server_at), uploads[i].done_at);
+			if (t < next) {
+				next = t;
+				upload = uploads + i;
+			}
+		}
+
+		if (next == INT64_MAX || next > start + APP_RUN_LIMIT_MS) {
+			device->result.stuck_runs += 1;
+			break;
+		}
+
+		shim_advance_to(next);
+		now = shim_clock_ms();
+
+		if (upload && upload->server_at >= 0
+		    && upload->server_at <= now) {
+			upload->server_at = -1;
+			server_receive(upload, upload_first(upload));
+		} else if (upload && upload->done_at >= 0
+		    && upload->done_at <= now)
+			upload_finished(upload);
+		else if (!is_js_ready && js_ready_at <= now)
+			js_ready();
+		else if (outbox_due >= 0 && outbox_due <= now)
+			finish_outbox();
+		else if (command_count && commands[command_head].due <= now)
+			deliver_command();
+		else if (retry_at >= 0 && retry_at <= now)
+			retry_uploads();
+		else if (close_at <= now)
+			window_stack_pop_all(true);
+		else
+			shim_fire_timer();
+	}
+
+	/* closing the application stops the JS and aborts its uploads */
+	device->app_end_ms = shim_clock_ms();
+}
+
+/**********
+ * DEVICE *
+ **********/
+
+struct battery_model {
+	double level;
+	double charge_target;
+	bool is_charging;
+	bool is_glitching;
+};
+
+static struct battery_model battery;
+static int64_t connection_toggle_at;	/* minute of the next change */
+static unsigned long launches_seen;
+
+static void
+launch_app(AppLaunchReason reason, unsigned kind) {
+	pid_t pid;
+	int status;
+
+	device->app_end_ms = shim_clock_ms();
+	fflush(stderr);
+
+	pid = fork();
+	if (pid < 0) shim_fail("unable to fork the application");
+	if (pid == 0) {
+		shim_launch_reason = reason;
+		app_main();
+		device->wakeup_time = shim_wakeup_time;
+		_exit(0);
+	}
+
+	if (waitpid(pid, &status, 0) != pid
+	    || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		shim_fail("application run failed");
+
+	device->result.launches[kind] += 1;
+	shim_advance_to(device->app_end_ms);
+}
+
+static void
+next_charge_target(void) {
+	const struct device_class *c = device->cls;
+
+	battery.charge_target = c->charge_at + 10 * (uniform() - 0.5);
+}
+
+static void
+step_battery(int minute_of_day) {
+	const struct device_class *c = device->cls;
+	BatteryChargeState state;
+	double step = c->level_step;
+	int reported;
+
+	if (battery.is_charging) {
+		battery.level += 100 / (c->charge_hours * 60);
+		if (battery.level >= c->unplug_at) {
+			battery.is_charging = false;
+			next_charge_target();
+		}
+	} else {
+		battery.level -= 100 / (c->drain_hours * 60);
+		if (battery.level <= battery.charge_target
+		    || (c->charge_hour >= 0
+		      && minute_of_day == (int)c->charge_hour * 60
+		      && battery.level < c->unplug_at - step))
+			battery.is_charging = true;
+	}
+	if (battery.level > 100) battery.level = 100;
+	if (battery.level < 0) battery.level = 0;
+
+	reported = (int)(ceil(battery.level / step) * step);
+	if (reported > 100) reported = 100;
+
+	/* a worn battery reads low for a moment under load */
+	battery.is_glitching = !battery.is_glitching
+	    && uniform() < c->glitches_per_day / (24 * 60);
+	if (battery.is_glitching)
+		reported = reported > step ? reported - (int)step : 0;
+
+	state.charge_percent = (uint8_t)reported;
+	state.is_charging = state.is_plugged = battery.is_charging;
+	if (state.charge_percent == shim_battery.charge_percent
+	    && state.is_charging == shim_battery.is_charging)
+		return;
+
+	shim_battery = state;
+	if (shim_battery_handler) shim_battery_handler(state);
+}
+
+/* time away from the phone, and near it, as alternating exponentials */
+static void
+step_connection(int64_t minute) {
+	const struct device_class *c = device->cls;
+	double mean;
+
+	if (minute < connection_toggle_at) return;
+
+	if (minute > 0) {
+		shim_connected = !shim_connected;
+		if (shim_connection_handlers.pebble_app_connection_handler)
+			shim_connection_handlers
+			    .pebble_app_connection_handler(shim_connected);
+	}
+
+	mean = shim_connected
+	    ? c->disconnect_for_min * c->connected / (1 - c->connected)
+	    : c->disconnect_for_min;
+	connection_toggle_at = c->connected >= 1 && shim_connected
+	    ? INT64_MAX : minute + 1 + (int64_t)exponential(mean);
+	if (c->connected <= 0 && !shim_connected)
+		connection_toggle_at = INT64_MAX;
+}
+
+void
+worker_event_loop(void) {
+	const struct device_class *c = device->cls;
+	int64_t minutes = (int64_t)fleet->days * 24 * 60;
+
+	for (int64_t minute = 0; minute < minutes; minute += 1) {
+		int minute_of_day = (int)(minute % (24 * 60));
+
+		shim_advance_to((SIM_START + minute * 60) * 1000);
+		step_battery(minute_of_day);
+		step_connection(minute);
+
+		if (shim_tick_handler && minute_of_day % 60 == 0
+		    && (shim_tick_units & HOUR_UNIT)) {
+			time_t host_time = shim_now;
+			struct tm tm;
+			shim_tick_handler(gmtime_r(&host_time, &tm),
+			    HOUR_UNIT);
+		}
+
+		if (minute == 0) {
+			/* installed and configured by the user */
+			launch_app(APP_LAUNCH_USER, LAUNCH_USER);
+			continue;
+		}
+
+		if (device->wakeup_time && shim_now >= device->wakeup_time) {
+			device->wakeup_time = 0;
+			launch_app(APP_LAUNCH_WAKEUP, LAUNCH_WAKEUP);
+		}
+
+		if (shim_app_launches != launches_seen) {
+			launches_seen = shim_app_launches;
+			launch_app(APP_LAUNCH_WORKER, LAUNCH_WORKER);
+		}
+
+		if (minute_of_day >= 7 * 60 && minute_of_day < 23 * 60
+		    && uniform() < c->opens_per_day / (16 * 60))
+			launch_app(APP_LAUNCH_USER, LAUNCH_USER);
+	}
+}
+
+/* where every generated event ended up */
+static void
+account_events(void) {
+	struct device_result *r = &device->result;
+	const struct phone *phone = &device->phone;
+	uint8_t *queued = calloc(device->seq_capacity / 8 + 1, 1);
+	struct page page;
+	uint32_t first;
+
+	if (!queued || !page_read(&page)) shim_fail("unable to read the log");
+	first = page_first_seq(&page);
+	r->generated = page.next_seq - 1;
+	r->flash_writes = shim_persist->writes;
+
+	for (unsigned i = 0; i < phone->queue_count; i += 1)
+		bit_set(queued, phone->queue[(phone->queue_head + i)
+		    % QUEUE_LENGTH].seq);
+
+	for (uint32_t seq = 1; seq < page.next_seq; seq += 1) {
+		bool is_missing = false;
+
+		for (unsigned i = 0; i < phone->missing_count; i += 1)
+			if (seq >= phone->missing[i][0]
+			    && seq <= phone->missing[i][1])
+				is_missing = true;
+
+		if (bit_test(device->delivered, seq))
+			r->delivered += 1;
+		else if (bit_test(device->skipped, seq))
+			r->folded += 1;
+		else if (bit_test(queued, seq) || (seq >= first
+		    && (seq > phone->last_seq || is_missing)))
+			r->pending += 1;
+		else
+			r->lost += 1;
+	}
+
+	free(queued);
+}
+
+static void
+run_device(unsigned index, uint64_t seed) {
+	const struct device_class *c;
+	size_t bitmap_size;
+	double draw, total = 0;
+	uint32_t capacity = fleet->days * 24 * 60 + 64;
+	int32_t wakeup;
+
+	bitmap_size = capacity / 8 + 1;
+	device = shared_alloc(sizeof *device + 2 * bitmap_size);
+	device->delivered = (uint8_t *)(device + 1);
+	device->skipped = device->delivered + bitmap_size;
+	device->seq_capacity = capacity;
+	device->rng = device_seed(seed, index);
+	rng_state = &device->rng;
+	shim_persist = &device->persist;
+
+	for (unsigned i = 0; i < class_count; i += 1)
+		total += classes[i].share;
+	draw = uniform() * total;
+	for (device->result.cls = 0;
+	    device->result.cls + 1 < class_count
+	    && draw >= classes[device->result.cls].share;
+	    device->result.cls += 1)
+		draw -= classes[device->result.cls].share;
+	c = device->cls = classes + device->result.cls;
+
+	/* configuration sent by the JS when the user set things up */
+	wakeup = (int32_t)c->wakeup_time;
+	if (wakeup >= 0) {
+		wakeup += (int32_t)lround((uniform() * 2 - 1)
+		    * c->wakeup_spread);
+		wakeup = (wakeup % (24 * 60) + 24 * 60) % (24 * 60);
+		persist_write_int(MSG_KEY_CFG_WAKEUP_TIME, wakeup + 1);
+	}
+	persist_write_int(MSG_KEY_CFG_SYNC_BUDGET, (int32_t)c->sync_budget);
+	shim_persist->writes = 0;
+
+	shim_now = SIM_START;
+	shim_now_ms = 0;
+	battery.level = 40 + 60 * uniform();
+	next_charge_target();
+	shim_battery.charge_percent = (uint8_t)(ceil(battery.level
+	    / c->level_step) * c->level_step);
+	if (shim_battery.charge_percent > 100)
+		shim_battery.charge_percent = 100;
+	shim_connected = uniform() < c->connected;
+
+	if (worker_main() != 0) shim_fail("worker failed to start");
+	account_events();
+
+	device->result.is_done = true;
+	results[index] = device->result;
+}
+
+/**********
+ * REPORT *
+ **********/
+
+struct totals {
+	unsigned devices;
+	unsigned failed;
+	uint64_t generated;
+	uint64_t delivered;
+	uint64_t duplicates;
+	uint64_t pending;
+	uint64_t folded;
+	uint64_t lost;
+	uint64_t requests;
+	uint64_t server_errors;
+	uint64_t parse_errors;
+	uint64_t queue_overflows;
+	uint64_t launches[3];
+	uint64_t stuck_runs;
+	double *writes;		/* per device-day, for percentiles */
+};
+
+static void
+add_result(struct totals *t, const struct device_result *r, double days) {
+	if (!r->is_done) {
+		t->failed += 1;
+		return;
+	}
+
+	t->writes[t->devices++] = r->flash_writes / days;
+	t->generated += r->generated;
+	t->delivered += r->delivered;
+	t->duplicates += r->duplicates;
+	t->pending += r->pending;
+	t->folded += r->folded;
+	t->lost += r->lost;
+	t->requests += r->requests;
+	t->server_errors += r->server_errors;
+	t->parse_errors += r->parse_errors;
+	t->queue_overflows += r->queue_overflows;
+	t->stuck_runs += r->stuck_runs;
+	for (unsigned i = 0; i < 3; i += 1)
+		t->launches[i] += r->launches[i];
+}
+
+static int
+compare_doubles(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double
+percentile(const double *sorted, unsigned count, double p) {
+	return count ? sorted[(unsigned)(p * (count - 1) + 0.5)] : 0;
+}
+
+static double
+mean(const double *values, unsigned count) {
+	double sum = 0;
+
+	for (unsigned i = 0; i < count; i += 1) sum += values[i];
+	return count ? sum / count : 0;
+}
+
+static double
+percent(uint64_t part, uint64_t whole) {
+	return whole ? 100.0 * part / whole : 0;
+}
+
+static void
+report(unsigned devices, unsigned days, unsigned jobs, uint64_t seed,
+    const char *population, double seconds) {
+	struct totals all, per_class[MAX_CLASSES];
+	double device_days;
+	uint32_t peak = 0;
+	unsigned peak_hour = 0;
+
+	memset(&all, 0, sizeof all);
+	memset(per_class, 0, sizeof per_class);
+	all.writes = calloc(devices, sizeof *all.writes);
+	for (unsigned i = 0; i < class_count; i += 1)
+		per_class[i].writes = calloc(devices, sizeof *all.writes);
+
+	for (unsigned i = 0; i < devices; i += 1) {
+		add_result(&all, results + i, days);
+		add_result(per_class + results[i].cls, results + i, days);
+	}
+	for (unsigned h = 0; h < days * 24; h += 1)
+		if (fleet->hourly[h] > peak) {
+			peak = fleet->hourly[h];
+			peak_hour = h;
+		}
+
+	qsort(all.writes, all.devices, sizeof *all.writes, compare_doubles);
+	device_days = (double)all.devices * days;
+
+	printf("%s: %u devices, %u days, %u jobs, seed %llu\n", population,
+	    devices, days, jobs, (unsigned long long)seed);
+	printf("wall       %10.2f s, %.1f device-days/s, %.0f events/s\n",
+	    seconds, device_days / seconds, all.generated / seconds);
+	printf("events     %10llu generated, %.2f per device-day\n",
+	    (unsigned long long)all.generated,
+	    device_days ? all.generated / device_days : 0);
+	printf("   %10llu delivered   %6.2f%%\n"
+	    "   %10llu duplicates  %6.2f%%\n"
+	    "   %10llu pending     %6.2f%%\n"
+	    "   %10llu folded      %6.2f%%\n"
+	    "   %10llu lost        %6.2f%%\n",
+	    (unsigned long long)all.delivered,
+	    percent(all.delivered, all.generated),
+	    (unsigned long long)all.duplicates,
+	    percent(all.duplicates, all.generated),
+	    (unsigned long long)all.pending,
+	    percent(all.pending, all.generated),
+	    (unsigned long long)all.folded,
+	    percent(all.folded, all.generated),
+	    (unsigned long long)all.lost, percent(all.lost, all.generated));
+	printf("server     %10llu requests, %.2f per device-day,"
+	    " %.2f per second on average\n",
+	    (unsigned long long)all.requests,
+	    device_days ? all.requests / device_days : 0,
+	    all.requests / (days * 86400.0));
+	printf("   peak %u in an hour (day %u, %02u:00), %.2f per second\n",
+	    peak, peak_hour / 24 + 1, peak_hour % 24, peak / 3600.0);
+	printf("   %llu server errors, %llu unparsed lines\n",
+	    (unsigned long long)all.server_errors,
+	    (unsigned long long)all.parse_errors);
+	printf("flash      writes per device-day: mean %.1f, p50 %.1f,"
+	    " p95 %.1f, max %.1f\n",
+	    mean(all.writes, all.devices),
+	    percentile(all.writes, all.devices, 0.5),
+	    percentile(all.writes, all.devices, 0.95),
+	    all.devices ? all.writes[all.devices - 1] : 0);
+	printf("launches   per device-day: %.2f user, %.2f wakeup,"
+	    " %.2f worker\n",
+	    device_days ? all.launches[LAUNCH_USER] / device_days : 0,
+	    device_days ? all.launches[LAUNCH_WAKEUP] / device_days : 0,
+	    device_days ? all.launches[LAUNCH_WORKER] / device_days : 0);
+	if (all.stuck_runs)
+		printf("   %llu runs still busy after %d minutes\n",
+		    (unsigned long long)all.stuck_runs,
+		    APP_RUN_LIMIT_MS / 60000);
+	if (all.queue_overflows)
+		printf("   %llu events dropped by a full phone queue\n",
+		    (unsigned long long)all.queue_overflows);
+	if (all.failed)
+		printf("%u devices failed\n", all.failed);
+
+	printf("\n  %-16s %7s %8s %9s %6s %8s %7s %6s %10s %8s %8s\n",
+	    "class", "devices", "events/d", "delivered", "dup", "pending",
+	    "folded", "lost", "requests/d", "writes/d", "p95");
+	for (unsigned i = 0; i < class_count; i += 1) {
+		struct totals *t = per_class + i;
+		double dd = (double)t->devices * days;
+
+		qsort(t->writes, t->devices, sizeof *t->writes,
+		    compare_doubles);
+		printf("  %-16s %7u %8.1f %8.2f%% %5.2f%% %7.2f%% %6.2f%%"
+		    " %5.2f%% %10.2f %8.1f %8.1f\n",
+		    classes[i].name, t->devices,
+		    dd ? t->generated / dd : 0,
+		    percent(t->delivered, t->generated),
+		    percent(t->duplicates, t->generated),
+		    percent(t->pending, t->generated),
+		    percent(t->folded, t->generated),
+		    percent(t->lost, t->generated),
+		    dd ? t->requests / dd : 0,
+		    percentile(t->writes, t->devices, 0.5),
+		    percentile(t->writes, t->devices, 0.95));
+		free(t->writes);
+	}
+
+	free(all.writes);
+}
+
+/********
+ * MAIN *
+ ********/
+
+static void
+usage(FILE *out, const char *name) {
+	fprintf(out, "Usage: %s [options] population\n"
+	    "  -n, --devices=N   simulated devices (default 1000)\n"
+	    "  -d, --days=N      simulated days (default 14)\n"
+	    "  -j, --jobs=N      parallel processes (default: online CPUs)\n"
+	    "  -s, --seed=N      random seed (default 1)\n"
+	    "  -v, --verbose     show the logs of the app and the worker\n"
+	    "  -h, --help        show this help\n", name);
+}
+
+static bool
+parse_count(const char *s, unsigned max, unsigned *result) {
+	char *end;
+	unsigned long value = strtoul(s, &end, 10);
+
+	if (!*s || *end || value < 1 || value > max) return false;
+	*result = (unsigned)value;
+	return true;
+}
+
+/* pool process: claim devices until there are none left */
+static void
+run_jobs(unsigned devices, uint64_t seed) {
+	unsigned index;
+
+	while ((index = __atomic_fetch_add(&fleet->next_device, 1,
+	    __ATOMIC_RELAXED)) < devices) {
+		pid_t pid = fork();
+		int status;
+
+		if (pid < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (pid == 0) {
+			run_device(index, seed);
+			exit(0);
+		}
+		/* a failed device keeps is_done false and is reported */
+		waitpid(pid, &status, 0);
+	}
+}
+
+int
+main(int argc, char **argv) {
+	static const struct option options[] = {
+		{ "devices", required_argument, 0, 'n' },
+		{ "days", required_argument, 0, 'd' },
+		{ "jobs", required_argument, 0, 'j' },
+		{ "seed", required_argument, 0, 's' },
+		{ "verbose", no_argument, 0, 'v' },
+		{ "help", no_argument, 0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+	unsigned devices = 1000, days = 14, jobs = 0;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t seed = 1;
+	struct timespec begin, end;
+	int c;
+
+	shim_log_level = 0;
+
+	while ((c = getopt_long(argc, argv, "n:d:j:s:vh", options, 0))
+	    != -1) {
+		switch (c) {
+		    case 'n':
+			if (!parse_count(optarg, 10000000, &devices)) {
+				usage(stderr, argv[0]);
+				return 2;
+			}
+			break;
+		    case 'd':
+			if (!parse_count(optarg, 3650, &days)) {
+				usage(stderr, argv[0]);
+				return 2;
+			}
+			break;
+		    case 'j':
+			if (!parse_count(optarg, 4096, &jobs)) {
+				usage(stderr, argv[0]);
+				return 2;
+			}
+			break;
+		    case 's':
+			seed = strtoull(optarg, 0, 10);
+			break;
+		    case 'v':
+			shim_log_level = APP_LOG_LEVEL_DEBUG;
+			break;
+		    case 'h':
+			usage(stdout, argv[0]);
+			return 0;
+		    default:
+			usage(stderr, argv[0]);
+			return 2;
+		}
+	}
+
+	if (optind + 1 != argc) {
+		usage(stderr, argv[0]);
+		return 2;
+	}
+	if (read_population(argv[optind]) < 0) return 1;
+	if (!jobs) jobs = cpus > 0 ? (unsigned)cpus : 1;
+	if (jobs > devices) jobs = devices;
+
+	fleet = shared_alloc(sizeof *fleet
+	    + days * 24 * sizeof *fleet->hourly);
+	fleet->days = days;
+	results = shared_alloc(devices * sizeof *results);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	fflush(stdout);
+	for (unsigned i = 0; i < jobs; i += 1) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (pid == 0) {
+			run_jobs(devices, seed);
+			exit(0);
+		}
+	}
+	while (wait(0) > 0)
+		continue;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	report(devices, days, jobs, seed, argv[optind],
+	    (double)(end.tv_sec - begin.tv_sec)
+	    + (end.tv_nsec - begin.tv_nsec) / 1e9);
+
+	for (unsigned i = 0; i < devices; i += 1)
+		if (!results[i].is_done) return 1;
+	return 0;
+}
@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * gen-messages: AppMessage codec generator
+ *
+ * Reads messages.json and writes src/messages.h (key numbers, fixed-layout
+ * structures, writers for watch messages and readers for phone messages,
+ * the latter left out when MSG_KEYS_ONLY is defined, as in the worker),
+ * src/js/messages.js (the reverse) and the appKeys of appinfo.json.
+ *
+ * Usage: node tools/gen-messages.js [repository root]
+ *
+ * Phone messages may only use int32 and uint32 fields, along with cstring
+ * and bytes fields. PebbleKit JS usually sends 32-bit integers, but the
+ * watch reads them from tuples of 1, 2 or 4 bytes, as signed or unsigned.
+ *
+ * cstring and bytes fields need a "size" expression, the most they can
+ * hold. bytes fields also get a NAME_length member in the structure, and
+ * are arrays of numbers on the JS side.
+ */
+
+var fs = require("fs");
+var path = require("path");
+
+var root = process.argv[2] || path.join(__dirname, "..");
+var schema = JSON.parse(fs.readFileSync(path.join(root, "messages.json")));
+
+var C_TYPES = { int32: "int32_t", uint32: "uint32_t", int16: "int16_t",
+ uint16: "uint16_t", int8: "int8_t", uint8: "uint8_t",
+ cstring: "const char *", bytes: "const uint8_t *" };
+var SIZES = { int32: 4, uint32: 4, int16: 2, uint16: 2, int8: 1, uint8: 1 };
+var HEADER = "/* Generated by tools/gen-messages.js from messages.json,"
+ + " do not edit */\n";
+
+function fail(message) {
+   console.error("gen-messages: " + message);
+   process.exit(1);
+}
+
+function upper(name) {
+   return name.toUpperCase();
+}
+
+function keyDefine(field) {
+   return "MSG_KEY_" + field.key.replace(/([A-Z])/g, "_$1").toUpperCase();
+}
+
+function flagDefine(message, field) {
+   return "MSG_" + upper(message.name) + "_" + upper(field.name);
+}
+
+function camel(name) {
+   return name.replace(/_([a-z])/g, function(m, c) { return c.toUpperCase(); });
+}
+
+/* tab-aligned "#define NAME VALUE" */
+function define(name, value) {
+   var tabs = Math.max(1, 3 - Math.floor(name.length / 8));
+   return "#define " + name + new Array(tabs + 1).join("\t") + value + "\n";
+}
+
+/***********************
+ * SCHEMA VERIFICATION *
+ ***********************/
+
+var keys = {};
+
+schema.messages.forEach(function(message) {
+   if (message.from !== "watch" && message.from !== "phone") {
+      fail(message.name + ": unknown origin " + message.from);
+   }
+   message.fields.forEach(function(field) {
+      if (!C_TYPES[field.type]) {
+         fail(message.name + "." + field.name + ": unknown type "
+          + field.type);
+      }
+      if (!SIZES[field.type] && !field.size) {
+         fail(message.name + "." + field.name + ": " + field.type
+          + " without size");
+      }
+      if (message.from === "phone" && SIZES[field.type]
+       && SIZES[field.type] !== 4) {
+         fail(message.name + "." + field.name
+          + ": phone messages only carry 32-bit integers");
+      }
+      if (keys[field.key] !== undefined && keys[field.key] !== field.id) {
+         fail(field.key + " has ids " + keys[field.key] + " and " + field.id);
+      }
+      keys[field.key] = field.id;
+   });
+});
+
+/************
+ * C HEADER *
+ ************/
+
+function cSize(message) {
+   var terms = ["1", "7 * " + message.fields.length];
+   message.fields.forEach(function(field) {
+      terms.push(SIZES[field.type] ? String(SIZES[field.type])
+       : "(" + field.size + ")");
+   });
+   return "(" + terms.join(" + ") + ")";
+}
+
+function cWriter(message) {
+   var out = "static inline void\nmsg_" + message.name
+    + "_write(DictionaryIterator *iter,\n    const struct msg_"
+    + message.name + " *msg) {\n";
+
+   message.fields.forEach(function(field) {
+      var call = field.type === "bytes"
+       ? "dict_write_data(iter, " + keyDefine(field) + ",\n\t    msg->"
+        + field.name + ", msg->" + field.name + "_length);\n"
+       : "dict_write_" + field.type + "(iter, " + keyDefine(field)
+        + ", msg->" + field.name + ");\n";
+      if (field.optional && field.type === "bytes") {
+         call = call.replace("\n\t    ", "\n\t\t    ");
+      }
+      if (field.optional) {
+         out += "\tif (msg->fields & " + flagDefine(message, field) + ")\n"
+          + "\t\t" + call;
+      } else {
+         out += "\t" + call;
+      }
+   });
+
+   return out + "}\n";
+}
+
+function cReader(message) {
+   var out = "/* returns the key of an unexpected tuple, or 0 */\n"
+    + "static inline uint32_t\nmsg_" + message.name
+    + "_read(DictionaryIterator *iter,\n    struct msg_" + message.name
+    + " *msg) {\n"
+    + "\tuint32_t unexpected = 0;\n\tTuple *tuple;\n\n"
+    + "\tmemset(msg, 0, sizeof *msg);\n"
+    + "\tfor (tuple = dict_read_first(iter);\n\t    tuple;\n"
+    + "\t    tuple = dict_read_next(iter)) {\n"
+    + "\t\tswitch (tuple->key) {\n";
+
+   message.fields.forEach(function(field) {
+      out += "\t\t    case " + keyDefine(field) + ":\n";
+      if (field.type === "bytes") {
+         out += "\t\t\tmsg->" + field.name + " = tuple->value->data;\n"
+          + "\t\t\tmsg->" + field.name + "_length = tuple->length;\n";
+      } else if (SIZES[field.type]) {
+         out += "\t\t\tmsg->" + field.name + " = "
+          + (field.type === "uint32" ? "" : "(" + C_TYPES[field.type] + ")")
+          + "msg_tuple_int(tuple);\n";
+      } else {
+         out += "\t\t\tmsg->" + field.name + " = tuple->value->"
+          + field.type + ";\n";
+      }
+      if (field.optional) {
+         out += "\t\t\tmsg->fields |= " + flagDefine(message, field) + ";\n";
+      }
+      out += "\t\t\tbreak;\n";
+   });
+
+   return out + "\t\t    default:\n\t\t\tunexpected = tuple->key;\n"
+    + "\t\t\tbreak;\n\t\t}\n\t}\n\n\treturn unexpected;\n}\n";
+}
+
+/* helper of the readers, as PebbleKit JS may send narrower integers */
+var C_TUPLE_INT = "\n/* integer tuple of any width, sign-extended when signed,"
+ + " or 0 */\n"
+ + "static inline uint32_t\nmsg_tuple_int(const Tuple *tuple) {\n"
+ + "\tbool is_signed = tuple->type == TUPLE_INT;\n\n"
+ + "\tswitch (tuple->length) {\n"
+ + "\t    case 1:\n"
+ + "\t\treturn is_signed ? (uint32_t)tuple->value->int8\n"
+ + "\t\t    : tuple->value->uint8;\n"
+ + "\t    case 2:\n"
+ + "\t\treturn is_signed ? (uint32_t)tuple->value->int16\n"
+ + "\t\t    : tuple->value->uint16;\n"
+ + "\t    case 4:\n"
+ + "\t\treturn tuple->value->uint32;\n"
+ + "\t    default:\n"
+ + "\t\treturn 0;\n"
+ + "\t}\n}\n";
+
+function cHeader() {
+   var out = HEADER + "\n#ifndef BATTERY_MESSAGES_H\n"
+    + "#define BATTERY_MESSAGES_H\n\n";
+   var ids = Object.keys(keys).sort(function(a, b) {
+      return keys[a] - keys[b];
+   });
+
+   ids.forEach(function(key) {
+      out += define(keyDefine({ key: key }), keys[key]);
+   });
+
+   /* the worker has no AppMessage, only values persisted under the keys */
+   out += "\n#ifndef MSG_KEYS_ONLY\n\n#include <pebble.h>\n"
+    + "#include \"profile.h\"\n" + C_TUPLE_INT;
+
+   schema.messages.forEach(function(message) {
+      var bit = 0;
+
+      out += "\n/* " + message.doc + " */\n\n";
+      message.fields.forEach(function(field) {
+         if (field.optional) {
+            out += define(flagDefine(message, field), "(1u << " + bit + ")");
+            bit += 1;
+         }
+      });
+      out += define("MSG_" + upper(message.name) + "_SIZE", cSize(message));
+
+      out += "\nstruct msg_" + message.name + " {\n"
+       + "\tuint32_t fields;\t/* optional fields present */\n";
+      message.fields.forEach(function(field) {
+         var type = C_TYPES[field.type];
+         out += "\t" + type + (type.slice(-1) === "*" ? "" : " ")
+          + field.name + ";\n";
+         if (field.type === "bytes") {
+            out += "\tuint16_t " + field.name + "_length;\n";
+         }
+      });
+      out += "};\n\n";
+
+      out += message.from === "watch" ? cWriter(message) : cReader(message);
+   });
+
+   return out + "\n#endif /* MSG_KEYS_ONLY */\n"
+    + "\n#endif /* defined BATTERY_MESSAGES_H */\n";
+}
+
+/*************
+ * JS MODULE *
+ *************/
+
+function jsDecoder(message) {
+   var required = message.fields.filter(function(field) {
+      return !field.optional;
+   });
+   var out = "   if (" + required.map(function(field) {
+      return "payload." + field.key + " !== undefined";
+   }).join("\n    && ") + ") {\n"
+    + "      return { type: \"" + message.name + "\"";
+
+   message.fields.forEach(function(field) {
+      out += ",\n       " + camel(field.name) + ": payload." + field.key;
+   });
+
+   return out + " };\n   }\n";
+}
+
+function jsEncoder(message) {
+   var name = "encode" + camel("_" + message.name);
+   var out = "/* " + message.doc + " */\nfunction " + name + "(msg) {\n"
+    + "   var payload = {};\n";
+
+   message.fields.forEach(function(field) {
+      var value = "msg." + camel(field.name)
+       + (SIZES[field.type] ? " | 0" : "");
+      if (field.optional) {
+         out += "   if (msg." + camel(field.name) + " !== undefined) {\n"
+          + "      payload." + field.key + " = " + value + ";\n   }\n";
+      } else {
+         out += "   payload." + field.key + " = " + value + ";\n";
+      }
+   });
+
+   return { name: name, text: out + "   return payload;\n}\n" };
+}
+
+function jsModule() {
+   var out = HEADER + "\n";
+   var exported = [];
+
+   schema.messages.forEach(function(message) {
+      if (message.from !== "phone") return;
+      var encoder = jsEncoder(message);
+      out += encoder.text + "\n";
+      exported.push(encoder.name);
+   });
+
+   out += "/* message from the watch, with its type, or null when unknown */\n"
+    + "function decode(payload) {\n";
+   schema.messages.forEach(function(message) {
+      if (message.from === "watch") out += jsDecoder(message);
+   });
+   out += "   return null;\n}\n\n";
+   exported.push("decode");
+
+   exported.forEach(function(name) {
+      out += "module.exports." + name + " = " + name + ";\n";
+   });
+
+   return out;
+}
+
+/***********
+ * APPINFO *
+ ***********/
+
+function appKeys(appinfo) {
+   var ids = Object.keys(keys).sort(function(a, b) {
+      return keys[a] - keys[b];
+   });
+   var block = "\"appKeys\": {\n" + ids.map(function(key) {
+      return "    \"" + key + "\": " + keys[key];
+   }).join(",\n") + "\n  }";
+
+   if (!/"appKeys": \{[^}]*\}/.test(appinfo)) fail("no appKeys in appinfo");
+   return appinfo.replace(/"appKeys": \{[^}]*\}/, block);
+}
+
+fs.writeFileSync(path.join(root, "src", "messages.h"), cHeader());
+fs.writeFileSync(path.join(root, "src", "js", "messages.js"), jsModule());
+fs.writeFileSync(path.join(root, "appinfo.json"),
+ appKeys(fs.readFileSync(path.join(root, "appinfo.json"), "utf8")));
@@ -0,0 +1,514 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * link-sim: AppMessage link simulator for comparing sync protocols
+ *
+ * Replays the sync of a backlog of events over a simulated Bluetooth link,
+ * for each scenario file given, and reports events per second, round trips
+ * and bytes on the air per synced event.
+ *
+ * The watch side models app_message_outbox_begin/send: a data message
+ * carries up to "batch" consecutive events as CSV lines, and up to
+ * "window" messages may be in flight. Batch 1 and window 1 is the old
+ * stop-and-wait send_event/outbox_sent_handler loop, batch
+ * PROFILE_SEND_BATCH and window 1 the current one. The firmware only
+ * allows a single message in the outbox, so wider windows are there to
+ * measure what a windowed protocol would gain.
+ *
+ * The phone side models the JS appmessage handler, which takes a fixed
+ * time per message plus a time per event before the acknowledgement.
+ *
+ * A message may be lost, in which case the outbox fails after the
+ * timeout, or NACKed, in which case it fails after a round trip. Either
+ * way, in-flight messages after it are dropped and the stream restarts
+ * from the first unacknowledged event after the retry delay. Disconnects
+ * fail the messages in flight and the stream resumes on reconnection,
+ * after a cursor round trip as in connection_handler().
+ *
+ * Scenario files hold "name value" lines, "#" starting a comment:
+ *	latency_ms		one-way latency
+ *	bandwidth		bytes per second
+ *	loss			probability of losing a message
+ *	nack			probability of a NACK
+ *	timeout_ms		outbox failure delay after a loss
+ *	retry_ms		delay before resending after a failure
+ *	phone_ms		JS handler time per message
+ *	phone_event_ms		JS handler time per event
+ *	disconnect_every_s	mean connected time, 0 for a stable link
+ *	disconnect_for_s	mean disconnected time
+ *	events			backlog to sync
+ *
+ * Usage: link-sim [options] scenario...
+ *
+ * Build on the host with:
+ *	cc -O2 -o link-sim tools/link-sim.c -lm
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* dictionary header, and per tuple key, type and length */
+#define DICT_HEADER	1
+#define TUPLE_HEADER	7
+/* Bluetooth and Pebble protocol framing around each message */
+#define FRAME_OVERHEAD	12
+/* framed acknowledgement or NACK */
+#define ACK_SIZE	(FRAME_OVERHEAD + 2)
+/* "2016-01-01T00:00:00Z,-,60,61", and its separator */
+#define LINE_SIZE	28
+
+#define MAX_WINDOW	64
+
+/************
+ * SCENARIO *
+ ************/
+
+struct scenario {
+	const char *name;
+	double latency_ms;
+	double bandwidth;
+	double loss;
+	double nack;
+	double timeout_ms;
+	double retry_ms;
+	double phone_ms;
+	double phone_event_ms;
+	double disconnect_every_s;
+	double disconnect_for_s;
+	unsigned events;
+};
+
+static const struct scenario default_scenario = {
+	.latency_ms = 50,
+	.bandwidth = 2000,
+	.timeout_ms = 3000,
+	.retry_ms = 1000,
+	.phone_ms = 5,
+	.phone_event_ms = 1,
+	.disconnect_for_s = 10,
+	.events = 41
+};
+
+static bool
+set_parameter(struct scenario *s, const char *name, double value) {
+	static const struct {
+		const char *name;
+		size_t offset;
+	} fields[] = {
+	    { "latency_ms", offsetof(struct scenario, latency_ms) },
+	    { "bandwidth", offsetof(struct scenario, bandwidth) },
+	    { "loss", offsetof(struct scenario, loss) },
+	    { "nack", offsetof(struct scenario, nack) },
+	    { "timeout_ms", offsetof(struct scenario, timeout_ms) },
+	    { "retry_ms", offsetof(struct scenario, retry_ms) },
+	    { "phone_ms", offsetof(struct scenario, phone_ms) },
+	    { "phone_event_ms", offsetof(struct scenario, phone_event_ms) },
+	    { "disconnect_every_s",
+	      offsetof(struct scenario, disconnect_every_s) },
+	    { "disconnect_for_s",
+	      offsetof(struct scenario, disconnect_for_s) }
+	};
+
+	if (!strcmp(name, "events")) {
+		if (value < 1) return false;
+		s->events = (unsigned)value;
+		return true;
+	}
+
+	for (size_t i = 0; i < sizeof fields / sizeof *fields; i += 1)
+		if (!strcmp(name, fields[i].name)) {
+			*(double *)((char *)s + fields[i].offset) = value;
+			return true;
+		}
+
+	return false;
+}
+
+static int
+read_scenario(struct scenario *s, const char *path) {
+	char line[256], name[64];
+	double value;
+	unsigned line_no = 0;
+	FILE *f = fopen(path, "r");
+
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	*s = default_scenario;
+	s->name = path;
+
+	while (fgets(line, sizeof line, f)) {
+		char *comment = strchr(line, '#');
+		char extra;
+
+		line_no += 1;
+		if (comment) *comment = 0;
+		if (sscanf(line, " %63s", name) != 1) continue;
+
+		if (sscanf(line, " %63s %lf %c", name, &value, &extra) != 2
+		    || !set_parameter(s, name, value)) {
+			fprintf(stderr, "%s:%u: invalid line\n", path, line_no);
+			fclose(f);
+			return -1;
+		}
+	}
+
+	fclose(f);
+
+	if (s->bandwidth <= 0) {
+		fprintf(stderr, "%s: bandwidth must be positive\n", path);
+		return -1;
+	}
+
+	/* every message must have a chance to get through */
+	if (s->loss < 0 || s->loss >= 1 || s->nack < 0 || s->nack >= 1
+	    || s->loss + s->nack >= 1) {
+		fprintf(stderr, "%s: loss and nack must be in [0, 1), "
+		    "and so must their sum\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**********
+ * RANDOM *
+ **********/
+
+static uint64_t rng_state;
+
+/* xorshift64*, so runs are reproducible from the seed */
+static double
+uniform(void) {
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (double)((rng_state * UINT64_C(2685821657736338717)) >> 11)
+	    / (double)(UINT64_C(1) << 53);
+}
+
+static double
+exponential(double mean) {
+	return -mean * log(1.0 - uniform());
+}
+
+/**************
+ * SIMULATION *
+ **************/
+
+struct protocol {
+	const char *name;
+	unsigned batch;
+	unsigned window;
+};
+
+struct result {
+	double seconds;
+	uint64_t events;
+	uint64_t messages;	/* round trips, including failed ones */
+	uint64_t bytes;		/* both directions */
+	uint64_t failures;
+	uint64_t disconnects;
+};
+
+struct flight {
+	unsigned first;		/* index of the first event */
+	unsigned count;
+	double done;		/* time of the acknowledgement or failure */
+	bool is_ok;
+};
+
+/* connection state, with disconnects as an alternating renewal process */
+static double link_down_at;
+static double link_up_at;
+
+static void
+link_init(const struct scenario *s, double now) {
+	link_up_at = now;
+	link_down_at = s->disconnect_every_s > 0
+	    ? now + exponential(s->disconnect_every_s * 1000) : INFINITY;
+}
+
+static void
+link_advance(const struct scenario *s, double now) {
+	while (now >= link_up_at && now >= link_down_at) {
+		link_up_at = link_down_at
+		    + exponential(s->disconnect_for_s * 1000);
+		link_down_at = link_up_at
+		    + exponential(s->disconnect_every_s * 1000);
+	}
+}
+
+static size_t
+message_size(unsigned count) {
+	/* time and seq integers, and the "\n"-joined lines */
+	return FRAME_OVERHEAD + DICT_HEADER + 3 * TUPLE_HEADER + 4 + 4
+	    + count * LINE_SIZE;
+}
+
+static void
+simulate(const struct scenario *s, const struct protocol *p,
+    struct result *r) {
+	struct flight flights[MAX_WINDOW];
+	unsigned in_flight = 0, head = 0;
+	unsigned next = 0, synced = 0;
+	double now = 0, link_free = 0;
+
+	memset(r, 0, sizeof *r);
+	link_init(s, 0);
+
+	while (synced < s->events) {
+		link_advance(s, now);
+
+		if (now < link_up_at) {
+			/* disconnected, resume with a cursor round trip */
+			r->disconnects += 1;
+			now = link_up_at + 2 * s->latency_ms
+			    + ACK_SIZE * 2000.0 / s->bandwidth;
+			r->bytes += 2 * ACK_SIZE;
+			link_free = now;
+			continue;
+		}
+
+		while (in_flight < p->window && next < s->events) {
+			struct flight *f
+			    = &flights[(head + in_flight) % MAX_WINDOW];
+			size_t size;
+			double start, arrival, draw;
+
+			f->first = next;
+			f->count = s->events - next < p->batch
+			    ? s->events - next : p->batch;
+			size = message_size(f->count);
+			next += f->count;
+			in_flight += 1;
+			r->messages += 1;
+			r->bytes += size;
+
+			start = now > link_free ? now : link_free;
+			link_free = start + size * 1000.0 / s->bandwidth;
+			arrival = link_free + s->latency_ms;
+			draw = uniform();
+
+			if (draw < s->loss) {
+				f->is_ok = false;
+				f->done = start + s->timeout_ms;
+			} else {
+				f->is_ok = draw >= s->loss + s->nack;
+				f->done = arrival + s->phone_ms
+				    + (f->is_ok ? f->count * s->phone_event_ms
+				      : 0)
+				    + ACK_SIZE * 1000.0 / s->bandwidth
+				    + s->latency_ms;
+				r->bytes += ACK_SIZE;
+			}
+
+			if (f->done > link_down_at) {
+				/* the outbox fails right away */
+				f->is_ok = false;
+				f->done = link_down_at > start
+				    ? link_down_at : start;
+			}
+		}
+
+		/* acknowledgements come back in order */
+		struct flight *f = &flights[head];
+		if (f->done > now) now = f->done;
+		head = (head + 1) % MAX_WINDOW;
+		in_flight -= 1;
+
+		if (f->is_ok) {
+			synced += f->count;
+			continue;
+		}
+
+		/* go back to the first unacknowledged event */
+		r->failures += 1;
+		in_flight = 0;
+		next = synced;
+		link_advance(s, now);
+		if (now >= link_up_at) now += s->retry_ms;
+		link_free = now;
+	}
+
+	r->seconds = now / 1000;
+	r->events = synced;
+}
+
+/**********
+ * REPORT *
+ **********/
+
+static void
+run_scenario(const struct scenario *s, const struct protocol *protocols,
+    size_t protocol_count, unsigned runs, uint64_t seed) {
+	printf("%s: %u events, %.0f ms, %.0f B/s, loss %.3f, nack %.3f",
+	    s->name, s->events, s->latency_ms, s->bandwidth, s->loss,
+	    s->nack);
+	if (s->disconnect_every_s > 0)
+		printf(", down %.0f s every %.0f s", s->disconnect_for_s,
+		    s->disconnect_every_s);
+	printf("\n  %-16s %10s %10s %10s %10s %10s\n", "protocol",
+	    "events/s", "trips", "B/event", "failures", "disconn.");
+
+	for (size_t i = 0; i < protocol_count; i += 1) {
+		struct result total, r;
+		const struct protocol *p = protocols + i;
+
+		memset(&total, 0, sizeof total);
+		/* same seed for every protocol, so they see the same link */
+		rng_state = seed ? seed : 1;
+
+		for (unsigned run = 0; run < runs; run += 1) {
+			simulate(s, p, &r);
+			total.seconds += r.seconds;
+			total.events += r.events;
+			total.messages += r.messages;
+			total.bytes += r.bytes;
+			total.failures += r.failures;
+			total.disconnects += r.disconnects;
+		}
+
+		printf("  %-16s %10.1f %10.1f %10.1f %10.2f %10.2f\n",
+		    p->name, total.events / total.seconds,
+		    (double)total.messages / runs,
+		    (double)total.bytes / total.events,
+		    (double)total.failures / runs,
+		    (double)total.disconnects / runs);
+	}
+}
+
+static void
+usage(FILE *out, const char *name) {
+	fprintf(out, "Usage: %s [options] scenario...\n"
+	    "  -b, --batch=N     events per message\n"
+	    "  -w, --window=N    messages in flight (at most %d)\n"
+	    "  -e, --events=N    backlog, overriding the scenarios\n"
+	    "  -r, --runs=N      runs averaged per protocol (default 100)\n"
+	    "  -s, --seed=N      random seed (default 1)\n"
+	    "  -h, --help        show this help\n"
+	    "Without -b nor -w, compares stop-and-wait, batched and windowed"
+	    " sync.\n", name, MAX_WINDOW);
+}
+
+static bool
+parse_count(const char *s, unsigned max, unsigned *result) {
+	char *end;
+	unsigned long value = strtoul(s, &end, 10);
+
+	if (!*s || *end || value < 1 || value > max) return false;
+	*result = (unsigned)value;
+	return true;
+}
+
+int
+main(int argc, char **argv) {
+	static const struct option options[] = {
+		{ "batch", required_argument, 0, 'b' },
+		{ "window", required_argument, 0, 'w' },
+		{ "events", required_argument, 0, 'e' },
+		{ "runs", required_argument, 0, 'r' },
+		{ "seed", required_argument, 0, 's' },
+		{ "help", no_argument, 0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+	struct protocol protocols[] = {
+		{ "stop-and-wait", 1, 1 },
+		{ "batched", 8, 1 },
+		{ "windowed", 8, 4 }
+	};
+	struct protocol custom = { "custom", 1, 1 };
+	bool is_custom = false;
+	unsigned events = 0, runs = 100;
+	uint64_t seed = 1;
+	int c, errors = 0;
+
+	while ((c = getopt_long(argc, argv, "b:w:e:r:s:h", options, 0))
+	    != -1) {
+		switch (c) {
+		    case 'b':
+			is_custom = true;
+			if (!parse_count(optarg, 1000, &custom.batch)) {
+				usage(stderr, argv[0]);
+				return 2;
+			}
+			break;
+		    case 'w':
+			is_custom = true;
+			if (!parse_count(optarg, MAX_WINDOW, &custom.window)) {
+				usage(stderr, argv[0]);
+				return 2;
+			}
+			break;
+		    case 'e':
+			if (!parse_count(optarg, 10000000, &events)) {
+				usage(stderr, argv[0]);
+				return 2;
+			}
+			break;
+		    case 'r':
+			if (!parse_count(optarg, 1000000, &runs)) {
+				usage(stderr, argv[0]);
+				return 2;
+			}
+			break;
+		    case 's':
+			seed = strtoull(optarg, 0, 10);
+			break;
+		    case 'h':
+			usage(stdout, argv[0]);
+			return 0;
+		    default:
+			usage(stderr, argv[0]);
+			return 2;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(stderr, argv[0]);
+		return 2;
+	}
+
+	for (int i = optind; i < argc; i += 1) {
+		struct scenario s;
+
+		if (read_scenario(&s, argv[i]) < 0) {
+			errors += 1;
+			continue;
+		}
+		if (events) s.events = events;
+
+		if (is_custom)
+			run_scenario(&s, &custom, 1, runs, seed);
+		else
+			run_scenario(&s, protocols,
+			    sizeof protocols / sizeof *protocols, runs, seed);
+	}
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,79 @@
+#!/bin/sh
+#
+# Copyright (c) 2016, Natacha Porté
+#
+# Permission to use, copy, modify, and distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+# mem-check: memory report of the app and the worker on each platform
+#
+# Builds both with tools/mem-shim for the given platforms (all of them by
+# default), runs them, and checks their static data, heap peak and stack
+# depth against tools/mem-budgets.json with tools/mem-report.js. Exits
+# with a non-zero status when any budget is exceeded.
+#
+# Host builds have 64-bit pointers, which makes menu items and the like
+# larger than on the watch, so the report errs on the safe side; code size
+# is only checked on the map of the watch build.
+#
+# Usage: tools/mem-check.sh [aplite] [basalt] [chalk]
+# Environment: CC (default cc), OBJDUMP (default objdump), OUT (directory
+# of the builds, default a temporary one)
+
+set -e
+
+TOOLS=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(dirname "$TOOLS")
+CC=${CC:-cc}
+OBJDUMP=${OBJDUMP:-objdump}
+OUT=${OUT:-$(mktemp -d)}
+CFLAGS="-O2 -fstack-usage -fdata-sections -Wno-address-of-packed-member"
+CFLAGS="$CFLAGS -I$TOOLS/mem-shim -I$ROOT/src"
+STATUS=0
+
+[ $# -gt 0 ] || set -- aplite basalt chalk
+
+# build_target platform target sources...
+build_target() {
+	platform=$1
+	target=$2
+	shift 2
+	dir="$OUT/$platform/$target"
+	define="-DPBL_PLATFORM_$(echo "$platform" | tr a-z A-Z)"
+
+	mkdir -p "$dir"
+	(cd "$dir" && $CC $CFLAGS $define -c "$@" \
+	    && $CC -O2 -I"$TOOLS/mem-shim" -I"$ROOT/src" $define \
+	    -c "$TOOLS/mem-shim/shim.c" "$TOOLS/mem-shim/scenario.c" \
+	    && $CC -o "$target" *.o -Wl,-Map,"$target.map" \
+	    && ./"$target" >"$target.heap" 2>"$target.log" \
+	    && $OBJDUMP -d "$target" >"$target.dis")
+
+	objects=$(cd "$dir" && ls *.o | grep -v '^\(shim\|scenario\)\.o$' \
+	    | tr '\n' '|')
+	node "$TOOLS/mem-report.js" --platform "$platform" --target "$target" \
+	    --no-image --objects "(^|/)(${objects%|})\$" \
+	    --map "$dir/$target.map" --heap "$dir/$target.heap" \
+	    --calls "$dir/$target.dis" \
+	    --su $(ls "$dir"/*.su | grep -v '/\(shim\|scenario\)\.su$') \
+	    || STATUS=1
+	echo
+}
+
+for platform; do
+	build_target "$platform" app \
+	    "$ROOT/src/battery-minus.c" "$ROOT/src/simple_dialog.c"
+	build_target "$platform" worker \
+	    "$ROOT/worker_src/battery-minus_worker.c"
+done
+
+exit $STATUS
@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * mem-report: static, heap and stack footprint of a build, against budgets
+ *
+ * Inputs, each optional:
+ *  --map FILE      GNU ld map of the binary (-Wl,-Map,FILE), for the code
+ *                  and static data, broken down by symbol when the objects
+ *                  were compiled with -fdata-sections
+ *  --su FILE...    stack usage of each function (gcc -fstack-usage)
+ *  --calls FILE    disassembly of the binary (objdump -d), for the call
+ *                  graph along which frames add up
+ *  --heap FILE     heap trace written by tools/mem-shim
+ *  --objects RE    only count the sections of the objects matching RE, to
+ *                  leave out the shim and the C library of host builds
+ *
+ * Budgets are read from tools/mem-budgets.json, under the platform and the
+ * target (app or worker) given by --platform and --target. The exit status
+ * is 1 when any measure exceeds its budget, or when the stack is unbounded.
+ * --no-image leaves the code out of the check, for host builds whose code
+ * says nothing of the size of the watch binary.
+ *
+ * Usage: node tools/mem-report.js --platform aplite --target app
+ *           [--map FILE] [--su FILE...] [--calls FILE] [--heap FILE]
+ *           [--budgets FILE] [--objects RE] [--no-image] [--top N]
+ */
+
+var fs = require("fs");
+var path = require("path");
+
+/* header of each block in the heap of the firmware */
+var BLOCK_OVERHEAD = 8;
+
+/*************
+ * ARGUMENTS *
+ *************/
+
+var options = {
+   budgets: path.join(__dirname, "mem-budgets.json"),
+   su: [],
+   top: 8,
+   image: true
+};
+
+function usage(message) {
+   console.error("mem-report: " + message);
+   process.exit(2);
+}
+
+(function parseArguments(args) {
+   var last = null;
+
+   for (var i = 0; i < args.length; i += 1) {
+      var arg = args[i];
+      if (arg === "--no-image") {
+         options.image = false;
+         last = null;
+      } else if (arg.slice(0, 2) === "--") {
+         last = arg.slice(2);
+         if (["map", "su", "calls", "heap", "budgets", "platform", "target",
+          "top", "objects"].indexOf(last) < 0) {
+            usage("unknown option " + arg);
+         }
+      } else if (last === "su") {
+         options.su.push(arg);
+      } else if (last) {
+         options[last] = last === "top" ? parseInt(arg, 10) : arg;
+         last = null;
+      } else {
+         usage("unexpected argument " + arg);
+      }
+   }
+
+   if (!options.platform || !options.target) {
+      usage("--platform and --target are required");
+   }
+})(process.argv.slice(2));
+
+function pad(str, width) {
+   str = String(str);
+   while (str.length < width) str += " ";
+   return str;
+}
+
+function padLeft(str, width) {
+   str = String(str);
+   while (str.length < width) str = " " + str;
+   return str;
+}
+
+/**********
+ * STATIC *
+ **********/
+
+/* code and data sizes, from the input sections of the map */
+function readMap(file) {
+   var lines = fs.readFileSync(file, "utf8").split("\n");
+   var result = { image: 0, data: 0, bss: 0, symbols: {} };
+   var output = null;
+   var pending = null;
+   var started = false;
+
+   function category(name) {
+      if (/^\.(s|t)?bss\b/.test(name)) return "bss";
+      if (/^\.(s|t)?data\b/.test(name) && !/^\.data\.rel\.ro\b/.test(name)) {
+         return "data";
+      }
+      if (/^\.(debug|comment|note|stab|gnu|ARM\.attributes)/.test(name)) {
+         return null;
+      }
+      return "image";
+   }
+
+   function addInput(name, size, object) {
+      var kind = output && category(output);
+      var symbol;
+
+      if (!kind || !size) return;
+      if (options.objects && !new RegExp(options.objects).test(object)) {
+         return;
+      }
+      result[kind] += size;
+      if (kind === "image") return;
+
+      /* with -fdata-sections, the input section names the variable */
+      symbol = name.replace(/^\.(s|t)?(data|bss)(\.rel(\.ro)?(\.local)?)?\./,
+       "");
+      if (symbol === name) symbol = path.basename(object) + " " + name;
+      result.symbols[symbol] = (result.symbols[symbol] || 0) + size;
+   }
+
+   lines.forEach(function(line) {
+      var match;
+
+      if (!started) {
+         started = /^Linker script and memory map/.test(line);
+         return;
+      }
+
+      if (pending) {
+         match = /^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(.+)$/.exec(line);
+         if (match) addInput(pending, parseInt(match[2], 16), match[3]);
+         pending = null;
+         return;
+      }
+
+      if ((match = /^(\.\S+|COMMON)(\s+0x[0-9a-f]+\s+0x[0-9a-f]+.*)?$/
+       .exec(line))) {
+         output = match[1];
+      } else if ((match = /^ (\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(.+)$/
+       .exec(line))) {
+         addInput(match[1] === "*fill*" ? "fill" : match[1],
+          parseInt(match[3], 16), match[4]);
+      } else if ((match = /^ (\.\S+|COMMON)$/.exec(line))) {
+         pending = match[1];
+      }
+   });
+
+   if (!started) usage(file + " is not a GNU ld map");
+   return result;
+}
+
+/*********
+ * STACK *
+ *********/
+
+/* clones are named page_read.constprop.0.isra.0 in the binary, but
+ * page_read.constprop.isra in the .su files */
+function functionName(name) {
+   return name.replace(/\.[0-9]+/g, "");
+}
+
+/* frame size of each function, from the .su files */
+function readStackUsage(files) {
+   var frames = {};
+   var dynamic = [];
+
+   files.forEach(function(file) {
+      fs.readFileSync(file, "utf8").split("\n").forEach(function(line) {
+         var fields = line.split("\t");
+         var name;
+         if (fields.length < 3) return;
+         name = fields[0].slice(fields[0].lastIndexOf(":") + 1);
+         name = functionName(name);
+         frames[name] = Math.max(frames[name] || 0, parseInt(fields[1], 10));
+         if (fields[2].indexOf("dynamic") >= 0
+          && fields[2].indexOf("bounded") < 0) {
+            dynamic.push(name);
+         }
+      });
+   });
+
+   return { frames: frames, dynamic: dynamic };
+}
+
+/* direct calls and tail calls of each function, from the disassembly */
+function readCalls(file) {
+   var calls = {};
+   var current = null;
+
+   fs.readFileSync(file, "utf8").split("\n").forEach(function(line) {
+      var match = /^[0-9a-f]+ <([^>]+)>:$/.exec(line);
+      var callee;
+
+      if (match) {
+         current = functionName(match[1]);
+         calls[current] = calls[current] || [];
+         return;
+      }
+
+      match = /\s(call|callq|jmp|jmpq|bl|blx|b|b\.w|b\.n)\s+[0-9a-f]+ <([^>]+)>/
+       .exec(line);
+      if (!current || !match) return;
+      /* branches inside the function are not calls */
+      if (match[2].indexOf("+0x") >= 0) return;
+      callee = functionName(match[2].replace(/@plt$/, ""));
+      if (callee !== current && calls[current].indexOf(callee) < 0) {
+         calls[current].push(callee);
+      }
+   });
+
+   return calls;
+}
+
+/* deepest chain of frames, with the functions whose frame is unknown */
+function worstStack(frames, calls) {
+   var memo = {};
+   var visiting = {};
+   var external = {};
+   var recursive = [];
+
+   function depth(name) {
+      var best = { size: 0, path: [] };
+
+      if (memo[name]) return memo[name];
+      if (visiting[name]) {
+         if (recursive.indexOf(name) < 0) recursive.push(name);
+         return { size: 0, path: [name + " (recursion)"] };
+      }
+      if (!(name in frames)) {
+         external[name] = true;
+         return { size: 0, path: [] };
+      }
+
+      visiting[name] = true;
+      (calls[name] || []).forEach(function(callee) {
+         var sub = depth(callee);
+         if (sub.size > best.size) best = sub;
+      });
+      visiting[name] = false;
+
+      memo[name] = { size: frames[name] + best.size,
+       path: [name].concat(best.path) };
+      return memo[name];
+   }
+
+   var worst = { size: 0, path: [] };
+   Object.keys(frames).forEach(function(name) {
+      var result = depth(name);
+      if (result.size > worst.size) worst = result;
+   });
+
+   worst.external = Object.keys(external).sort();
+   worst.recursive = recursive;
+   return worst;
+}
+
+/********
+ * HEAP *
+ ********/
+
+/* peak of the traced heap, with what is allocated at that time */
+function readHeap(file) {
+   var blocks = {};
+   var current = 0;
+   var phase = "start";
+   var peak = { size: 0, phase: phase, owners: {} };
+   var count = 0;
+
+   fs.readFileSync(file, "utf8").split("\n").forEach(function(line) {
+      var fields = line.split(" ");
+
+      if (fields[0] === "phase") {
+         phase = fields[1];
+      } else if (fields[0] === "malloc") {
+         blocks[fields[1]] = { size: parseInt(fields[2], 10)
+          + BLOCK_OVERHEAD, owner: fields[3] };
+         current += blocks[fields[1]].size;
+         count += 1;
+         if (current > peak.size) {
+            peak = { size: current, phase: phase, owners: {} };
+            Object.keys(blocks).forEach(function(id) {
+               var owner = blocks[id].owner;
+               peak.owners[owner] = (peak.owners[owner] || 0)
+                + blocks[id].size;
+            });
+         }
+      } else if (fields[0] === "free" && blocks[fields[1]]) {
+         current -= blocks[fields[1]].size;
+         delete blocks[fields[1]];
+      }
+   });
+
+   peak.count = count;
+   peak.left = Object.keys(blocks).map(function(id) { return blocks[id]; });
+   return peak;
+}
+
+/**********
+ * REPORT *
+ **********/
+
+var budgets = JSON.parse(fs.readFileSync(options.budgets, "utf8"));
+var budget = (budgets[options.platform] || {})[options.target];
+var failures = [];
+var total = 0;
+
+if (!budget) {
+   usage("no budget for " + options.target + " on " + options.platform);
+}
+
+function check(name, size, limit) {
+   var line = pad(name, 8) + padLeft(size, 7) + " bytes";
+
+   total += size;
+   if (limit === undefined) {
+      console.log(line);
+      return;
+   }
+   line += ", budget " + limit;
+   if (size > limit) {
+      line += "  EXCEEDED";
+      failures.push(name);
+   }
+   console.log(line);
+}
+
+function breakdown(sizes) {
+   Object.keys(sizes).sort(function(a, b) {
+      return sizes[b] - sizes[a];
+   }).slice(0, options.top).forEach(function(name) {
+      console.log("   " + padLeft(sizes[name], 6) + "  " + name);
+   });
+}
+
+console.log(options.target + " on " + options.platform);
+
+if (options.map) {
+   var map = readMap(options.map);
+   if (options.image) check("image", map.image, budget.image);
+   check("static", map.data + map.bss, budget.static);
+   console.log("   data " + map.data + ", bss " + map.bss);
+   breakdown(map.symbols);
+}
+
+if (options.heap) {
+   var heap = readHeap(options.heap);
+   check("heap", heap.size, budget.heap);
+   if (heap.count) {
+      console.log("   peak during " + heap.phase + ", " + heap.count
+       + " allocations of " + BLOCK_OVERHEAD + " bytes of overhead each");
+   }
+   breakdown(heap.owners);
+   if (heap.left.length) {
+      console.log("   " + heap.left.length + " blocks still allocated: "
+       + heap.left.map(function(block) { return block.owner; }).join(", "));
+   }
+}
+
+if (options.su.length) {
+   var stackUsage = readStackUsage(options.su);
+   var stack = worstStack(stackUsage.frames,
+    options.calls ? readCalls(options.calls) : {});
+
+   check("stack", stack.size, budget.stack);
+   console.log("   " + stack.path.join(" > "));
+   if (!options.calls) {
+      console.log("   largest frame only, without --calls");
+   }
+   if (stack.external.length) {
+      console.log("   " + stack.external.length
+       + " callees without frame information, the SDK and libc: "
+       + stack.external.slice(0, options.top).join(", ")
+       + (stack.external.length > options.top ? ", ..." : ""));
+   }
+   if (stack.recursive.length || stackUsage.dynamic.length) {
+      console.log("   unbounded: "
+       + stack.recursive.concat(stackUsage.dynamic).join(", "));
+      failures.push("stack");
+   }
+}
+
+if (budget.ram !== undefined) {
+   check("total", total, budget.ram);
+}
+
+if (failures.length) {
+   console.log("FAILED: " + failures.join(", "));
+   process.exitCode = 1;
+}
@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Host stand-in for the part of the Pebble SDK used by the application and
+ * the worker, implemented in shim.c. Only meant to run them on a computer
+ * to measure their memory, not to behave like the firmware in every
+ * detail.
+ *
+ * time_t is 32-bit as on the watch, so that struct event keeps its size,
+ * and malloc() and free() of the application go through the shim, which
+ * traces them.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define time_t int32_t
+#define time(t) shim_time(t)
+#define localtime(t) shim_localtime(t)
+#define gmtime(t) shim_gmtime(t)
+#define malloc(size) shim_malloc(size)
+#define free(ptr) shim_free(ptr)
+
+time_t shim_time(time_t *t);
+struct tm *shim_localtime(const time_t *t);
+struct tm *shim_gmtime(const time_t *t);
+void *shim_malloc(size_t size);
+void shim_free(void *ptr);
+
+#define ARRAY_LENGTH(array) (sizeof (array) / sizeof (array)[0])
+
+/***********
+ * LOGGING *
+ ***********/
+
+enum {
+	APP_LOG_LEVEL_ERROR = 1,
+	APP_LOG_LEVEL_WARNING = 50,
+	APP_LOG_LEVEL_INFO = 100,
+	APP_LOG_LEVEL_DEBUG = 200,
+};
+
+void shim_log(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+#define APP_LOG(level, ...) shim_log((level), __VA_ARGS__)
+
+/***********
+ * STORAGE *
+ ***********/
+
+#define PERSIST_DATA_MAX_LENGTH 256
+
+typedef int32_t status_t;
+enum { S_SUCCESS = 0, E_ERROR = -1, E_INVALID_ARGUMENT = -2,
+    E_DOES_NOT_EXIST = -4 };
+
+bool persist_exists(uint32_t key);
+status_t persist_delete(uint32_t key);
+int persist_read_data(uint32_t key, void *buffer, size_t size);
+int persist_write_data(uint32_t key, const void *data, size_t size);
+int32_t persist_read_int(uint32_t key);
+status_t persist_write_int(uint32_t key, int32_t value);
+
+/********
+ * TIME *
+ ********/
+
+typedef enum { TODAY = 0, SUNDAY, MONDAY, TUESDAY, WEDNESDAY, THURSDAY,
+    FRIDAY, SATURDAY } WeekDay;
+typedef enum { SECOND_UNIT = 1, MINUTE_UNIT = 2, HOUR_UNIT = 4,
+    DAY_UNIT = 8, MONTH_UNIT = 16, YEAR_UNIT = 32 } TimeUnits;
+typedef void (*TickHandler)(struct tm *tick_time, TimeUnits units_changed);
+
+uint16_t time_ms(time_t *t, uint16_t *ms);
+time_t clock_to_timestamp(WeekDay day, int hour, int minute);
+void tick_timer_service_subscribe(TimeUnits units, TickHandler handler);
+void tick_timer_service_unsubscribe(void);
+
+typedef struct AppTimer AppTimer;
+typedef void (*AppTimerCallback)(void *data);
+
+AppTimer *app_timer_register(uint32_t timeout_ms, AppTimerCallback callback,
+    void *data);
+bool app_timer_reschedule(AppTimer *timer, uint32_t new_timeout_ms);
+void app_timer_cancel(AppTimer *timer);
+
+typedef int32_t WakeupId;
+WakeupId wakeup_schedule(time_t timestamp, int32_t cookie,
+    bool notify_if_missed);
+void wakeup_cancel_all(void);
+
+/************
+ * SERVICES *
+ ************/
+
+typedef struct {
+	uint8_t charge_percent;
+	bool is_charging;
+	bool is_plugged;
+} BatteryChargeState;
+typedef void (*BatteryStateHandler)(BatteryChargeState charge);
+
+BatteryChargeState battery_state_service_peek(void);
+void battery_state_service_subscribe(BatteryStateHandler handler);
+void battery_state_service_unsubscribe(void);
+
+typedef void (*ConnectionHandler)(bool connected);
+typedef struct {
+	ConnectionHandler pebble_app_connection_handler;
+	ConnectionHandler pebblekit_connection_handler;
+} ConnectionHandlers;
+
+void connection_service_subscribe(ConnectionHandlers handlers);
+void connection_service_unsubscribe(void);
+bool connection_service_peek_pebble_app_connection(void);
+
+typedef enum { APP_LAUNCH_SYSTEM, APP_LAUNCH_USER, APP_LAUNCH_PHONE,
+    APP_LAUNCH_WAKEUP, APP_LAUNCH_WORKER, APP_LAUNCH_QUICK_LAUNCH,
+    APP_LAUNCH_TIMELINE_ACTION, APP_LAUNCH_SMARTSTRAP } AppLaunchReason;
+AppLaunchReason launch_reason(void);
+
+typedef enum { APP_WORKER_RESULT_SUCCESS, APP_WORKER_RESULT_NO_WORKER,
+    APP_WORKER_RESULT_DIFFERENT_APP, APP_WORKER_RESULT_NOT_RUNNING,
+    APP_WORKER_RESULT_ALREADY_RUNNING,
+    APP_WORKER_RESULT_ASKING_CONFIRMATION } AppWorkerResult;
+AppWorkerResult app_worker_launch(void);
+AppWorkerResult app_worker_kill(void);
+bool app_worker_is_running(void);
+void worker_launch_app(void);
+
+void app_event_loop(void);
+void worker_event_loop(void);
+
+/**************
+ * APPMESSAGE *
+ **************/
+
+typedef enum { TUPLE_BYTE_ARRAY = 0, TUPLE_CSTRING = 1, TUPLE_UINT = 2,
+    TUPLE_INT = 3 } TupleType;
+
+typedef struct __attribute__((__packed__)) {
+	uint32_t key;
+	TupleType type:8;
+	uint16_t length;
+	union {
+		uint8_t data[0];
+		char cstring[0];
+		uint8_t uint8;
+		uint16_t uint16;
+		uint32_t uint32;
+		int8_t int8;
+		int16_t int16;
+		int32_t int32;
+	} value[];
+} Tuple;
+
+typedef struct {
+	uint8_t *begin;
+	uint8_t *end;	/* end of the buffer */
+	uint8_t *cursor;	/* next tuple */
+} DictionaryIterator;
+
+typedef enum { DICT_OK = 0, DICT_NOT_ENOUGH_STORAGE = 2 } DictionaryResult;
+
+Tuple *dict_read_first(DictionaryIterator *iter);
+Tuple *dict_read_next(DictionaryIterator *iter);
+DictionaryResult dict_write_data(DictionaryIterator *iter, uint32_t key,
+    const uint8_t *data, size_t size);
+DictionaryResult dict_write_cstring(DictionaryIterator *iter, uint32_t key,
+    const char *cstring);
+DictionaryResult dict_write_uint8(DictionaryIterator *iter, uint32_t key,
+    uint8_t value);
+DictionaryResult dict_write_uint16(DictionaryIterator *iter, uint32_t key,
+    uint16_t value);
+DictionaryResult dict_write_uint32(DictionaryIterator *iter, uint32_t key,
+    uint32_t value);
+DictionaryResult dict_write_int32(DictionaryIterator *iter, uint32_t key,
+    int32_t value);
+
+typedef enum { APP_MSG_OK = 0, APP_MSG_SEND_TIMEOUT = 2,
+    APP_MSG_SEND_REJECTED = 4, APP_MSG_NOT_CONNECTED = 8,
+    APP_MSG_BUSY = 64, APP_MSG_OUT_OF_MEMORY = 128 } AppMessageResult;
+
+typedef void (*AppMessageInboxReceived)(DictionaryIterator *iterator,
+    void *context);
+typedef void (*AppMessageOutboxSent)(DictionaryIterator *iterator,
+    void *context);
+typedef void (*AppMessageOutboxFailed)(DictionaryIterator *iterator,
+    AppMessageResult reason, void *context);
+
+AppMessageResult app_message_open(uint32_t size_inbound,
+    uint32_t size_outbound);
+AppMessageResult app_message_outbox_begin(DictionaryIterator **iterator);
+AppMessageResult app_message_outbox_send(void);
+void app_message_register_inbox_received(AppMessageInboxReceived handler);
+void app_message_register_outbox_sent(AppMessageOutboxSent handler);
+void app_message_register_outbox_failed(AppMessageOutboxFailed handler);
+
+/******
+ * UI *
+ ******/
+
+typedef struct { int16_t x, y; } GPoint;
+typedef struct { int16_t w, h; } GSize;
+typedef struct { GPoint origin; GSize size; } GRect;
+#define GRect(x, y, w, h) ((GRect){ { (x), (y) }, { (w), (h) } })
+
+typedef struct GContext GContext;
+typedef struct GBitmap GBitmap;
+typedef struct Layer Layer;
+typedef struct Window Window;
+typedef struct TextLayer TextLayer;
+typedef struct SimpleMenuLayer SimpleMenuLayer;
+typedef const char *GFont;
+typedef enum { GTextAlignmentLeft, GTextAlignmentCenter,
+    GTextAlignmentRight } GTextAlignment;
+
+#define FONT_KEY_GOTHIC_24_BOLD "RESOURCE_ID_GOTHIC_24_BOLD"
+
+typedef void (*LayerUpdateProc)(Layer *layer, GContext *ctx);
+
+Layer *layer_create(GRect frame);
+void layer_destroy(Layer *layer);
+void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc);
+void layer_mark_dirty(Layer *layer);
+void layer_add_child(Layer *parent, Layer *child);
+GRect layer_get_bounds(const Layer *layer);
+
+typedef void (*WindowHandler)(Window *window);
+typedef struct {
+	WindowHandler load;
+	WindowHandler appear;
+	WindowHandler disappear;
+	WindowHandler unload;
+} WindowHandlers;
+
+typedef enum { BUTTON_ID_BACK, BUTTON_ID_UP, BUTTON_ID_SELECT,
+    BUTTON_ID_DOWN } ButtonId;
+typedef void *ClickRecognizerRef;
+typedef void (*ClickHandler)(ClickRecognizerRef recognizer, void *context);
+typedef void (*ClickConfigProvider)(void *context);
+
+Window *window_create(void);
+void window_destroy(Window *window);
+void window_set_window_handlers(Window *window, WindowHandlers handlers);
+void window_set_click_config_provider(Window *window,
+    ClickConfigProvider click_config_provider);
+void window_single_click_subscribe(ButtonId button_id, ClickHandler handler);
+Layer *window_get_root_layer(const Window *window);
+void window_stack_push(Window *window, bool animated);
+Window *window_stack_pop(bool animated);
+void window_stack_pop_all(bool animated);
+
+GFont fonts_get_system_font(const char *font_key);
+
+TextLayer *text_layer_create(GRect frame);
+void text_layer_destroy(TextLayer *text_layer);
+Layer *text_layer_get_layer(TextLayer *text_layer);
+void text_layer_set_text(TextLayer *text_layer, const char *text);
+void text_layer_set_font(TextLayer *text_layer, GFont font);
+void text_layer_set_text_alignment(TextLayer *text_layer,
+    GTextAlignment text_alignment);
+
+typedef void (*SimpleMenuLayerSelectCallback)(int index, void *context);
+typedef struct {
+	const char *title;
+	const char *subtitle;
+	GBitmap *icon;
+	SimpleMenuLayerSelectCallback callback;
+} SimpleMenuItem;
+typedef struct {
+	const char *title;
+	const SimpleMenuItem *items;
+	uint32_t num_items;
+} SimpleMenuSection;
+
+SimpleMenuLayer *simple_menu_layer_create(GRect frame, Window *window,
+    const SimpleMenuSection *sections, int32_t num_sections, void *context);
+void simple_menu_layer_destroy(SimpleMenuLayer *menu_layer);
+Layer *simple_menu_layer_get_layer(const SimpleMenuLayer *simple_menu);
+void simple_menu_layer_set_selected_index(SimpleMenuLayer *simple_menu,
+    int32_t index, bool animated);
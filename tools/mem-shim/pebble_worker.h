@@ -14,10 +14,5 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-#include <pebble.h>
-
-int32_t
-tuple_int(Tuple *tuple);
-
-uint32_t
-tuple_uint(Tuple *tuple);
+/* the worker sees the same shim, the UI part being unused */
+#include "pebble.h"
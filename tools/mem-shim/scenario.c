@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * mem-shim scenario: the heaviest paths of the application or the worker
+ *
+ * It seeds the persistent storage with a full log, then its event loop
+ * drives them through their heaviest paths: a sync of the whole log with
+ * the phone acknowledging every message, then every item of the main menu
+ * selected in turn (history query answered in full, session expanded,
+ * dialogs), or days of battery changes for the worker. The heap trace goes
+ * to the standard output.
+ *
+ * The launch reason is taken from SHIM_LAUNCH ("user", "wakeup" or
+ * "worker"), so the background sync can be measured too.
+ *
+ * See tools/mem-check.sh for the build.
+ */
+
+#include "shim.h"
+#include "messages.h"
+#include "profile.h"
+#include "storage.h"
+
+#undef time_t
+
+#define SHIM_MAX_STEPS		100000
+#define SHIM_MAX_SELECTIONS	64
+#define SHIM_WORKER_DAYS	6
+
+/***********
+ * STORAGE *
+ ***********/
+
+/* a full log of alternating discharges and charges, ending now */
+static void
+seed_storage(void) {
+	struct page page;
+	uint32_t seq;
+	int level = 60;
+	bool charging = false;
+
+	memset(&page, 0, sizeof page);
+	page.next_seq = PAGE_LENGTH * 3 + 1;
+	for (seq = page_first_seq(&page); seq < page.next_seq; seq += 1) {
+		struct event *event = page.events + seq % PAGE_LENGTH;
+		int next = charging ? level + 5 : level - 1;
+
+		event->time = shim_now - (int32_t)(page.next_seq - seq) * 1800;
+		event->before = (uint8_t)(level | (charging ? 0x80 : 0));
+		event->after = (uint8_t)(next | (charging ? 0x80 : 0));
+		level = next;
+		if (level >= 100 || level <= 20) charging = !charging;
+	}
+
+	if (!page_write(&page)) shim_fail("unable to seed the log");
+	persist_write_int(MSG_KEY_CFG_WAKEUP_TIME, 8 * 60 + 1);
+	persist_write_int(MSG_KEY_LAST_SEQ, (int32_t)(page.next_seq - 20));
+	persist_write_int(MSG_KEY_LAST_POSTED, (int32_t)(page.next_seq - 20));
+}
+
+/*********
+ * PHONE *
+ *********/
+
+static uint32_t history_wanted;	/* events left to answer the query */
+static uint32_t history_batch;
+static int32_t history_to;
+static unsigned long messages_sent;
+
+static void
+send_command(uint32_t key, uint32_t value) {
+	dict_write_uint32(shim_inbox_begin(), key, value);
+	shim_deliver();
+}
+
+/* acknowledge the outbox, noting any history query */
+static void
+receive_outbox(void) {
+	Tuple *tuple;
+
+	messages_sent += 1;
+
+	for (tuple = dict_read_first(&shim_outbox); tuple;
+	    tuple = dict_read_next(&shim_outbox)) {
+		if (tuple->key == MSG_KEY_HISTORY_MAX)
+			history_wanted = tuple->value->uint32;
+		else if (tuple->key == MSG_KEY_HISTORY_BATCH)
+			history_batch = tuple->value->uint32;
+		else if (tuple->key == MSG_KEY_HISTORY_TO)
+			history_to = tuple->value->int32;
+	}
+
+	shim_outbox_done(APP_MSG_OK);
+}
+
+/* next batch of archived events, older ones first */
+static void
+send_history(void) {
+	struct event events[PROFILE_HISTORY_BATCH];
+	uint32_t count = history_batch;
+
+	if (count > history_wanted) count = history_wanted;
+	if (count > PROFILE_HISTORY_BATCH) count = PROFILE_HISTORY_BATCH;
+
+	for (uint32_t i = 0; i < count; i += 1) {
+		events[i].time = history_to
+		    - (int32_t)(history_wanted - i) * 3600;
+		events[i].before = 80;
+		events[i].after = 79;
+	}
+	history_wanted -= count;
+
+	dict_write_data(shim_inbox_begin(), MSG_KEY_HISTORY_EVENTS,
+	    (const uint8_t *)events, count * sizeof events[0]);
+	if (!history_wanted) {
+		dict_write_uint32(&shim_inbox, MSG_KEY_HISTORY_DONE, 1);
+		history_batch = 0;
+	}
+	shim_deliver();
+}
+
+/* run the exchanges and timers until nothing is left to do */
+static void
+run_until_idle(void) {
+	for (unsigned step = 0; step < SHIM_MAX_STEPS; step += 1) {
+		if (shim_outbox_pending)
+			receive_outbox();
+		else if (history_batch)
+			send_history();
+		else if (!shim_fire_timer())
+			return;
+	}
+	shim_fail("scenario does not settle");
+}
+
+/* select each item of the main menu, then back out of its windows */
+static void
+visit_menu(void) {
+	for (unsigned index = 0, n = 0; n < SHIM_MAX_SELECTIONS; index += 1) {
+		void *context;
+		const SimpleMenuSection *sections = shim_menu(0, &context);
+		const SimpleMenuItem *item;
+
+		if (!sections || index >= sections[0].num_items) return;
+		item = sections[0].items + index;
+		if (!item->callback) continue;
+
+		n += 1;
+		item->callback((int)index, context);
+		run_until_idle();
+		while (shim_window_count() > 1) {
+			window_stack_pop(true);
+			run_until_idle();
+		}
+	}
+}
+
+void
+app_event_loop(void) {
+	run_until_idle();
+
+	shim_trace_phase("sync");
+	send_command(MSG_KEY_LAST_SEQ, 0);
+	run_until_idle();
+
+	shim_trace_phase("menu");
+	visit_menu();
+
+	shim_trace_phase("exit");
+	window_stack_pop_all(true);
+	run_until_idle();
+
+	fprintf(stderr, "mem-shim: %lu messages sent, %lu persistent writes\n",
+	    messages_sent, shim_persist->writes);
+}
+
+/**********
+ * WORKER *
+ **********/
+
+/* days of full discharges and charges, with the phone coming and going */
+void
+worker_event_loop(void) {
+	shim_trace_phase("shim_battery");
+
+	for (int hour = 0; hour < SHIM_WORKER_DAYS * 24; hour += 1) {
+		for (int minute = 0; minute < 60; minute += 10) {
+			BatteryChargeState next = shim_battery;
+
+			if (shim_battery.is_charging
+			    && shim_battery.charge_percent >= 100)
+				next.is_charging = next.is_plugged = false;
+			else if (!shim_battery.is_charging
+			    && shim_battery.charge_percent <= 20)
+				next.is_charging = next.is_plugged = true;
+			else if (shim_battery.is_charging)
+				next.charge_percent += 10;
+			else if (minute % 30 == 0)
+				next.charge_percent -= 10;
+
+			shim_now += 600;
+			shim_battery = next;
+			if (shim_battery_handler)
+				shim_battery_handler(shim_battery);
+		}
+
+		if (shim_tick_handler && (shim_tick_units & HOUR_UNIT)) {
+			time_t host_time = shim_now;
+			struct tm tm;
+			shim_tick_handler(gmtime_r(&host_time, &tm), HOUR_UNIT);
+		}
+		if (shim_connection_handlers.pebble_app_connection_handler)
+			shim_connection_handlers.pebble_app_connection_handler(
+			    hour % 5 == 0);
+	}
+
+	shim_trace_phase("exit");
+	fprintf(stderr, "mem-shim: %lu persistent writes\n",
+	    shim_persist->writes);
+}
+
+/*********
+ * SETUP *
+ *********/
+
+__attribute__((constructor)) static void
+scenario_init(void) {
+	const char *reason = getenv("SHIM_LAUNCH");
+
+	setvbuf(stdout, 0, _IOLBF, 0);
+	shim_trace = stdout;
+	if (reason && !strcmp(reason, "wakeup"))
+		shim_launch_reason = APP_LAUNCH_WAKEUP;
+	else if (reason && !strcmp(reason, "worker"))
+		shim_launch_reason = APP_LAUNCH_WORKER;
+
+	seed_storage();
+	shim_persist->writes = 0;
+	shim_trace_phase("init");
+}
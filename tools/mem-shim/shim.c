@@ -0,0 +1,878 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * mem-shim: host stand-in for the SDK, under the application or the worker
+ *
+ * It keeps the firmware side of things in memory: clock, timers,
+ * persistent storage, services, AppMessage buffers and the window stack.
+ * A scenario linked along (scenario.c for tools/mem-check.sh, or
+ * tools/fleet-sim.c) plays the user, the battery and the phone through
+ * shim.h.
+ *
+ * When shim_trace is set, every heap allocation is written there, as
+ * "malloc <id> <size> <owner>" and "free <id>", with "phase <name>" lines
+ * between the steps of the scenario; tools/mem-report.js reads them.
+ * Objects created by the firmware on the application heap are traced with
+ * the FW_*_SIZE estimates below rather than their size in the shim.
+ * Logs go to the standard error.
+ */
+
+#include <stdarg.h>
+#include "shim.h"
+
+#undef time_t
+
+/* firmware objects on the application heap, estimated from SDK 3 */
+#define FW_WINDOW_SIZE			84
+#define FW_LAYER_SIZE			40
+#define FW_TEXT_LAYER_SIZE		68
+#define FW_SIMPLE_MENU_LAYER_SIZE	220
+#define FW_APP_MESSAGE_OVERHEAD		32	/* on top of both buffers */
+
+#define SHIM_START_TIME		1460000000
+#define SHIM_STACK_DEPTH	8
+
+/*************
+ * UTILITIES *
+ *************/
+
+int32_t shim_now = SHIM_START_TIME;
+uint16_t shim_now_ms;
+FILE *shim_trace;
+int shim_log_level = APP_LOG_LEVEL_DEBUG;
+
+void
+shim_fail(const char *message) {
+	fprintf(stderr, "mem-shim: %s\n", message);
+	exit(1);
+}
+
+void
+shim_log(int level, const char *fmt, ...) {
+	va_list ap;
+
+	if (level > shim_log_level) return;
+	fprintf(stderr, "[%d] ", level);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+/***************
+ * TRACED HEAP *
+ ***************/
+
+struct block {
+	unsigned long id;
+	size_t size;
+	max_align_t data[];
+};
+
+static unsigned long last_block_id;
+
+void
+shim_trace_phase(const char *name) {
+	if (shim_trace) fprintf(shim_trace, "phase %s\n", name);
+}
+
+/* allocation traced as size bytes, with real_size bytes usable */
+static void *
+trace_alloc(size_t size, size_t real_size, const char *owner) {
+	struct block *block
+	    = (malloc)(sizeof *block + (real_size > size ? real_size : size));
+
+	if (!block) shim_fail("out of memory");
+	block->id = ++last_block_id;
+	block->size = size;
+	if (shim_trace)
+		fprintf(shim_trace, "malloc %lu %zu %s\n", block->id, size,
+		    owner);
+	return block->data;
+}
+
+static void
+trace_free(void *ptr) {
+	struct block *block;
+
+	if (!ptr) return;
+	block = (struct block *)((char *)ptr - offsetof(struct block, data));
+	if (shim_trace) fprintf(shim_trace, "free %lu\n", block->id);
+	(free)(block);
+}
+
+void *
+shim_malloc(size_t size) {
+	return trace_alloc(size, size, "app");
+}
+
+void
+shim_free(void *ptr) {
+	trace_free(ptr);
+}
+
+/********
+ * TIME *
+ ********/
+
+int32_t
+shim_time(int32_t *t) {
+	if (t) *t = shim_now;
+	return shim_now;
+}
+
+uint16_t
+time_ms(int32_t *t, uint16_t *ms) {
+	if (t) *t = shim_now;
+	if (ms) *ms = shim_now_ms;
+	return shim_now_ms;
+}
+
+struct tm *
+shim_gmtime(const int32_t *t) {
+	static struct tm result;
+	int32_t value;
+	time_t host_time;
+
+	/* the application passes times from its packed events */
+	memcpy(&value, t, sizeof value);
+	host_time = value;
+
+	return gmtime_r(&host_time, &result);
+}
+
+/* the shim runs in UTC */
+struct tm *
+shim_localtime(const int32_t *t) {
+	return shim_gmtime(t);
+}
+
+int32_t
+clock_to_timestamp(WeekDay day, int hour, int minute) {
+	int32_t midnight = shim_now - shim_now % 86400;
+	int32_t result = midnight + hour * 3600 + minute * 60;
+	/* 1970-01-01 was a Thursday */
+	int wday = (int)((shim_now / 86400 + 4) % 7);
+
+	if (day != TODAY)
+		result += 86400 * ((day - 1 - wday + 7) % 7);
+	if (result <= shim_now)
+		result += day == TODAY ? 86400 : 7 * 86400;
+	return result;
+}
+
+int32_t shim_wakeup_time;
+
+WakeupId
+wakeup_schedule(int32_t timestamp, int32_t cookie, bool notify_if_missed) {
+	(void)notify_if_missed;
+	APP_LOG(APP_LOG_LEVEL_DEBUG, "wakeup %d at %d", (int)cookie,
+	    (int)timestamp);
+	shim_wakeup_time = timestamp;
+	return 1;
+}
+
+void
+wakeup_cancel_all(void) {
+	shim_wakeup_time = 0;
+}
+
+/**********
+ * TIMERS *
+ **********/
+
+/* timers live in the firmware, outside the application heap */
+struct AppTimer {
+	int64_t due_ms;
+	AppTimerCallback callback;
+	void *data;
+	struct AppTimer *next;
+};
+
+static struct AppTimer *timers;
+
+int64_t
+shim_clock_ms(void) {
+	return (int64_t)shim_now * 1000 + shim_now_ms;
+}
+
+void
+shim_advance_to(int64_t t_ms) {
+	if (t_ms <= shim_clock_ms()) return;
+	shim_now = (int32_t)(t_ms / 1000);
+	shim_now_ms = (uint16_t)(t_ms % 1000);
+}
+
+AppTimer *
+app_timer_register(uint32_t timeout_ms, AppTimerCallback callback,
+    void *data) {
+	struct AppTimer *timer = (malloc)(sizeof *timer);
+
+	if (!timer) shim_fail("out of memory");
+	timer->due_ms = shim_clock_ms() + timeout_ms;
+	timer->callback = callback;
+	timer->data = data;
+	timer->next = timers;
+	timers = timer;
+	return timer;
+}
+
+static bool
+unlink_timer(AppTimer *timer) {
+	struct AppTimer **prev;
+
+	for (prev = &timers; *prev; prev = &(*prev)->next) {
+		if (*prev != timer) continue;
+		*prev = timer->next;
+		return true;
+	}
+	return false;
+}
+
+bool
+app_timer_reschedule(AppTimer *timer, uint32_t new_timeout_ms) {
+	struct AppTimer *t;
+
+	for (t = timers; t; t = t->next) {
+		if (t != timer) continue;
+		t->due_ms = shim_clock_ms() + new_timeout_ms;
+		return true;
+	}
+	return false;
+}
+
+void
+app_timer_cancel(AppTimer *timer) {
+	if (unlink_timer(timer)) (free)(timer);
+}
+
+int64_t
+shim_next_timer_ms(void) {
+	int64_t result = INT64_MAX;
+
+	for (struct AppTimer *t = timers; t; t = t->next)
+		if (t->due_ms < result) result = t->due_ms;
+	return result;
+}
+
+/* fire the earliest timer, returning false when there is none */
+bool
+shim_fire_timer(void) {
+	struct AppTimer *timer = timers, *t;
+	AppTimerCallback callback;
+	void *data;
+
+	if (!timer) return false;
+	for (t = timers; t; t = t->next)
+		if (t->due_ms < timer->due_ms) timer = t;
+
+	unlink_timer(timer);
+	shim_advance_to(timer->due_ms);
+	callback = timer->callback;
+	data = timer->data;
+	(free)(timer);
+	callback(data);
+	return true;
+}
+
+/***********
+ * STORAGE *
+ ***********/
+
+static struct shim_persist private_persist;
+struct shim_persist *shim_persist = &private_persist;
+
+static struct shim_persist_entry *
+persist_find(uint32_t key) {
+	struct shim_persist_entry *entry = shim_persist->entries;
+
+	for (unsigned i = 0; i < shim_persist->count; i += 1, entry += 1)
+		if (entry->key == key) return entry;
+	return 0;
+}
+
+bool
+persist_exists(uint32_t key) {
+	return persist_find(key) != 0;
+}
+
+status_t
+persist_delete(uint32_t key) {
+	struct shim_persist_entry *entry = persist_find(key);
+
+	if (!entry) return E_DOES_NOT_EXIST;
+	*entry = shim_persist->entries[--shim_persist->count];
+	return S_SUCCESS;
+}
+
+int
+persist_read_data(uint32_t key, void *buffer, size_t size) {
+	struct shim_persist_entry *entry = persist_find(key);
+
+	if (!entry) return E_DOES_NOT_EXIST;
+	if (size > (size_t)entry->size) size = entry->size;
+	memcpy(buffer, entry->data, size);
+	return (int)size;
+}
+
+int
+persist_write_data(uint32_t key, const void *data, size_t size) {
+	struct shim_persist_entry *entry = persist_find(key);
+
+	if (size > PERSIST_DATA_MAX_LENGTH) return E_INVALID_ARGUMENT;
+	if (!entry) {
+		if (shim_persist->count >= SHIM_PERSIST_KEYS)
+			shim_fail("too many persistent keys");
+		entry = shim_persist->entries + shim_persist->count++;
+		entry->key = key;
+	}
+	memcpy(entry->data, data, size);
+	entry->size = (int)size;
+	shim_persist->writes += 1;
+	return (int)size;
+}
+
+int32_t
+persist_read_int(uint32_t key) {
+	int32_t value = 0;
+
+	persist_read_data(key, &value, sizeof value);
+	return value;
+}
+
+status_t
+persist_write_int(uint32_t key, int32_t value) {
+	int ret = persist_write_data(key, &value, sizeof value);
+
+	return ret < 0 ? ret : S_SUCCESS;
+}
+
+/************
+ * SERVICES *
+ ************/
+
+BatteryChargeState shim_battery = { 60, false, false };
+bool shim_connected = true;
+AppLaunchReason shim_launch_reason = APP_LAUNCH_USER;
+unsigned long shim_app_launches;
+BatteryStateHandler shim_battery_handler;
+ConnectionHandlers shim_connection_handlers;
+TickHandler shim_tick_handler;
+TimeUnits shim_tick_units;
+
+BatteryChargeState
+battery_state_service_peek(void) {
+	return shim_battery;
+}
+
+void
+battery_state_service_subscribe(BatteryStateHandler handler) {
+	shim_battery_handler = handler;
+}
+
+void
+battery_state_service_unsubscribe(void) {
+	shim_battery_handler = 0;
+}
+
+void
+connection_service_subscribe(ConnectionHandlers handlers) {
+	shim_connection_handlers = handlers;
+}
+
+void
+connection_service_unsubscribe(void) {
+	memset(&shim_connection_handlers, 0, sizeof shim_connection_handlers);
+}
+
+bool
+connection_service_peek_pebble_app_connection(void) {
+	return shim_connected;
+}
+
+void
+tick_timer_service_subscribe(TimeUnits units, TickHandler handler) {
+	shim_tick_units = units;
+	shim_tick_handler = handler;
+}
+
+void
+tick_timer_service_unsubscribe(void) {
+	shim_tick_handler = 0;
+}
+
+AppLaunchReason
+launch_reason(void) {
+	return shim_launch_reason;
+}
+
+AppWorkerResult
+app_worker_launch(void) {
+	return APP_WORKER_RESULT_SUCCESS;
+}
+
+AppWorkerResult
+app_worker_kill(void) {
+	return APP_WORKER_RESULT_SUCCESS;
+}
+
+bool
+app_worker_is_running(void) {
+	return true;
+}
+
+void
+worker_launch_app(void) {
+	APP_LOG(APP_LOG_LEVEL_INFO, "worker launches the app");
+	shim_app_launches += 1;
+}
+
+/****************
+ * DICTIONARIES *
+ ****************/
+
+static Tuple *
+tuple_at(DictionaryIterator *iter) {
+	Tuple *tuple = (Tuple *)iter->cursor;
+
+	if (iter->cursor + sizeof *tuple > iter->end
+	    || iter->cursor + sizeof *tuple + tuple->length > iter->end
+	    || !tuple->key)
+		return 0;
+	return tuple;
+}
+
+Tuple *
+dict_read_first(DictionaryIterator *iter) {
+	iter->cursor = iter->begin;
+	return tuple_at(iter);
+}
+
+Tuple *
+dict_read_next(DictionaryIterator *iter) {
+	Tuple *tuple = tuple_at(iter);
+
+	if (!tuple) return 0;
+	iter->cursor += sizeof *tuple + tuple->length;
+	return tuple_at(iter);
+}
+
+static DictionaryResult
+dict_write(DictionaryIterator *iter, uint32_t key, TupleType type,
+    const void *data, size_t size) {
+	Tuple *tuple = (Tuple *)iter->cursor;
+
+	/* room for the tuple and the zero key ending the dictionary */
+	if (iter->cursor + 2 * sizeof *tuple + size > iter->end)
+		return DICT_NOT_ENOUGH_STORAGE;
+
+	tuple->key = key;
+	tuple->type = type;
+	tuple->length = (uint16_t)size;
+	memcpy(tuple->value, data, size);
+	iter->cursor += sizeof *tuple + size;
+	memset(iter->cursor, 0, sizeof *tuple);
+	return DICT_OK;
+}
+
+DictionaryResult
+dict_write_data(DictionaryIterator *iter, uint32_t key, const uint8_t *data,
+    size_t size) {
+	return dict_write(iter, key, TUPLE_BYTE_ARRAY, data, size);
+}
+
+DictionaryResult
+dict_write_cstring(DictionaryIterator *iter, uint32_t key,
+    const char *cstring) {
+	return dict_write(iter, key, TUPLE_CSTRING, cstring,
+	    strlen(cstring) + 1);
+}
+
+DictionaryResult
+dict_write_uint8(DictionaryIterator *iter, uint32_t key, uint8_t value) {
+	return dict_write(iter, key, TUPLE_UINT, &value, sizeof value);
+}
+
+DictionaryResult
+dict_write_uint16(DictionaryIterator *iter, uint32_t key, uint16_t value) {
+	return dict_write(iter, key, TUPLE_UINT, &value, sizeof value);
+}
+
+DictionaryResult
+dict_write_uint32(DictionaryIterator *iter, uint32_t key, uint32_t value) {
+	return dict_write(iter, key, TUPLE_UINT, &value, sizeof value);
+}
+
+DictionaryResult
+dict_write_int32(DictionaryIterator *iter, uint32_t key, int32_t value) {
+	return dict_write(iter, key, TUPLE_INT, &value, sizeof value);
+}
+
+/**************
+ * APPMESSAGE *
+ **************/
+
+static AppMessageInboxReceived inbox_handler;
+static AppMessageOutboxSent sent_handler;
+static AppMessageOutboxFailed failed_handler;
+DictionaryIterator shim_inbox;
+DictionaryIterator shim_outbox;
+bool shim_outbox_pending;
+
+AppMessageResult
+app_message_open(uint32_t size_inbound, uint32_t size_outbound) {
+	/* both buffers come from the application heap */
+	uint8_t *buffer = trace_alloc(FW_APP_MESSAGE_OVERHEAD
+	    + size_inbound + size_outbound,
+	    FW_APP_MESSAGE_OVERHEAD + size_inbound + size_outbound,
+	    "app_message");
+
+	shim_inbox.begin = buffer + FW_APP_MESSAGE_OVERHEAD;
+	shim_inbox.end = shim_inbox.begin + size_inbound;
+	shim_outbox.begin = shim_inbox.end;
+	shim_outbox.end = shim_outbox.begin + size_outbound;
+	return APP_MSG_OK;
+}
+
+AppMessageResult
+app_message_outbox_begin(DictionaryIterator **iterator) {
+	if (!shim_outbox.begin) return APP_MSG_NOT_CONNECTED;
+	if (shim_outbox_pending) return APP_MSG_BUSY;
+	shim_outbox.cursor = shim_outbox.begin;
+	memset(shim_outbox.cursor, 0, sizeof(Tuple));
+	*iterator = &shim_outbox;
+	return APP_MSG_OK;
+}
+
+AppMessageResult
+app_message_outbox_send(void) {
+	if (shim_outbox_pending) return APP_MSG_BUSY;
+	shim_outbox_pending = true;
+	return APP_MSG_OK;
+}
+
+void
+app_message_register_inbox_received(AppMessageInboxReceived handler) {
+	inbox_handler = handler;
+}
+
+void
+app_message_register_outbox_sent(AppMessageOutboxSent handler) {
+	sent_handler = handler;
+}
+
+void
+app_message_register_outbox_failed(AppMessageOutboxFailed handler) {
+	failed_handler = handler;
+}
+
+/* empty inbox, for the scenario to fill before shim_deliver() */
+DictionaryIterator *
+shim_inbox_begin(void) {
+	shim_inbox.cursor = shim_inbox.begin;
+	memset(shim_inbox.cursor, 0, sizeof(Tuple));
+	return &shim_inbox;
+}
+
+void
+shim_deliver(void) {
+	if (inbox_handler) inbox_handler(&shim_inbox, 0);
+}
+
+void
+shim_outbox_done(AppMessageResult result) {
+	shim_outbox_pending = false;
+	if (result == APP_MSG_OK) {
+		if (sent_handler) sent_handler(&shim_outbox, 0);
+	} else if (failed_handler)
+		failed_handler(&shim_outbox, result, 0);
+}
+
+/******
+ * UI *
+ ******/
+
+struct Layer {
+	GRect frame;
+	LayerUpdateProc update_proc;
+};
+
+struct Window {
+	Layer root;
+	WindowHandlers handlers;
+	ClickConfigProvider click_config_provider;
+	bool is_loaded;
+};
+
+struct TextLayer {
+	Layer layer;
+	const char *text;
+};
+
+struct SimpleMenuLayer {
+	Layer layer;
+	const SimpleMenuSection *sections;
+	int32_t num_sections;
+	void *context;
+};
+
+static Window *window_stack[SHIM_STACK_DEPTH];
+static unsigned window_count;
+static SimpleMenuLayer *menu_layers[SHIM_STACK_DEPTH];
+
+static const GRect screen = { { 0, 0 }, { 144, 168 } };
+
+Layer *
+layer_create(GRect frame) {
+	Layer *layer = trace_alloc(FW_LAYER_SIZE, sizeof *layer, "layer");
+
+	memset(layer, 0, sizeof *layer);
+	layer->frame = frame;
+	return layer;
+}
+
+void
+layer_destroy(Layer *layer) {
+	trace_free(layer);
+}
+
+void
+layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc) {
+	layer->update_proc = update_proc;
+}
+
+void
+layer_mark_dirty(Layer *layer) {
+	(void)layer;
+}
+
+void
+layer_add_child(Layer *parent, Layer *child) {
+	(void)parent;
+	/* draw once, for the first frame probe */
+	if (child->update_proc) child->update_proc(child, 0);
+}
+
+GRect
+layer_get_bounds(const Layer *layer) {
+	return (GRect){ { 0, 0 }, layer->frame.size };
+}
+
+Window *
+window_create(void) {
+	Window *window = trace_alloc(FW_WINDOW_SIZE, sizeof *window,
+	    "window");
+
+	memset(window, 0, sizeof *window);
+	window->root.frame = screen;
+	return window;
+}
+
+static int
+window_index(Window *window) {
+	for (unsigned i = 0; i < window_count; i += 1)
+		if (window_stack[i] == window) return (int)i;
+	return -1;
+}
+
+static void
+window_remove(unsigned index) {
+	Window *window = window_stack[index];
+	bool is_top = index + 1 == window_count;
+
+	if (is_top && window->handlers.disappear)
+		window->handlers.disappear(window);
+	memmove(window_stack + index, window_stack + index + 1,
+	    (window_count - index - 1) * sizeof *window_stack);
+	memmove(menu_layers + index, menu_layers + index + 1,
+	    (window_count - index - 1) * sizeof *menu_layers);
+	window_count -= 1;
+	if (window->is_loaded && window->handlers.unload)
+		window->handlers.unload(window);
+	window->is_loaded = false;
+
+	if (is_top && window_count > 0) {
+		Window *top = window_stack[window_count - 1];
+		if (top->handlers.appear) top->handlers.appear(top);
+	}
+}
+
+void
+window_destroy(Window *window) {
+	int i = window_index(window);
+
+	if (!window) return;
+	if (i >= 0) window_remove((unsigned)i);
+	trace_free(window);
+}
+
+void
+window_set_window_handlers(Window *window, WindowHandlers handlers) {
+	window->handlers = handlers;
+}
+
+void
+window_set_click_config_provider(Window *window,
+    ClickConfigProvider click_config_provider) {
+	window->click_config_provider = click_config_provider;
+}
+
+void
+window_single_click_subscribe(ButtonId button_id, ClickHandler handler) {
+	(void)button_id;
+	(void)handler;
+}
+
+Layer *
+window_get_root_layer(const Window *window) {
+	return (Layer *)&window->root;
+}
+
+void
+window_stack_push(Window *window, bool animated) {
+	(void)animated;
+
+	if (window_index(window) >= 0) return;
+	if (window_count >= SHIM_STACK_DEPTH)
+		shim_fail("window stack overflow");
+
+	if (window_count > 0) {
+		Window *top = window_stack[window_count - 1];
+		if (top->handlers.disappear) top->handlers.disappear(top);
+	}
+
+	window_stack[window_count] = window;
+	menu_layers[window_count] = 0;
+	window_count += 1;
+
+	if (window->click_config_provider)
+		window->click_config_provider(window);
+	if (!window->is_loaded && window->handlers.load)
+		window->handlers.load(window);
+	window->is_loaded = true;
+	if (window->handlers.appear) window->handlers.appear(window);
+}
+
+Window *
+window_stack_pop(bool animated) {
+	Window *window;
+	(void)animated;
+
+	if (!window_count) return 0;
+	window = window_stack[window_count - 1];
+	window_remove(window_count - 1);
+	return window;
+}
+
+void
+window_stack_pop_all(bool animated) {
+	while (window_count) window_stack_pop(animated);
+}
+
+GFont
+fonts_get_system_font(const char *font_key) {
+	return font_key;
+}
+
+TextLayer *
+text_layer_create(GRect frame) {
+	TextLayer *text_layer = trace_alloc(FW_TEXT_LAYER_SIZE,
+	    sizeof *text_layer, "text_layer");
+
+	memset(text_layer, 0, sizeof *text_layer);
+	text_layer->layer.frame = frame;
+	return text_layer;
+}
+
+void
+text_layer_destroy(TextLayer *text_layer) {
+	trace_free(text_layer);
+}
+
+Layer *
+text_layer_get_layer(TextLayer *text_layer) {
+	return &text_layer->layer;
+}
+
+void
+text_layer_set_text(TextLayer *text_layer, const char *text) {
+	text_layer->text = text;
+}
+
+void
+text_layer_set_font(TextLayer *text_layer, GFont font) {
+	(void)text_layer;
+	(void)font;
+}
+
+void
+text_layer_set_text_alignment(TextLayer *text_layer,
+    GTextAlignment text_alignment) {
+	(void)text_layer;
+	(void)text_alignment;
+}
+
+SimpleMenuLayer *
+simple_menu_layer_create(GRect frame, Window *window,
+    const SimpleMenuSection *sections, int32_t num_sections, void *context) {
+	SimpleMenuLayer *menu_layer = trace_alloc(FW_SIMPLE_MENU_LAYER_SIZE,
+	    sizeof *menu_layer, "simple_menu_layer");
+	int i = window_index(window);
+
+	memset(menu_layer, 0, sizeof *menu_layer);
+	menu_layer->layer.frame = frame;
+	menu_layer->sections = sections;
+	menu_layer->num_sections = num_sections;
+	menu_layer->context = context;
+	if (i >= 0) menu_layers[i] = menu_layer;
+	return menu_layer;
+}
+
+void
+simple_menu_layer_destroy(SimpleMenuLayer *menu_layer) {
+	for (unsigned i = 0; i < window_count; i += 1)
+		if (menu_layers[i] == menu_layer) menu_layers[i] = 0;
+	trace_free(menu_layer);
+}
+
+Layer *
+simple_menu_layer_get_layer(const SimpleMenuLayer *simple_menu) {
+	return (Layer *)&simple_menu->layer;
+}
+
+void
+simple_menu_layer_set_selected_index(SimpleMenuLayer *simple_menu,
+    int32_t index, bool animated) {
+	(void)simple_menu;
+	(void)index;
+	(void)animated;
+}
+
+unsigned
+shim_window_count(void) {
+	return window_count;
+}
+
+/* sections of the menu in the given window, null when it has none */
+const SimpleMenuSection *
+shim_menu(unsigned index, void **context) {
+	SimpleMenuLayer *menu = index < window_count ? menu_layers[index] : 0;
+
+	if (!menu) return 0;
+	if (context) *context = menu->context;
+	return menu->sections;
+}
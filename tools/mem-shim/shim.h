@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Driver side of the shim: what scenarios need to play the firmware and
+ * the phone around the application or the worker. Each scenario defines
+ * app_event_loop() and worker_event_loop().
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <pebble.h>
+
+#define SHIM_PERSIST_KEYS	64
+
+/* heap trace for tools/mem-report.js, nothing is written when null */
+extern FILE *shim_trace;
+void shim_trace_phase(const char *name);
+void shim_fail(const char *message);
+
+/* APP_LOG messages above this level are not written */
+extern int shim_log_level;
+
+/* simulated clock, only moving forward */
+extern int32_t shim_now;
+extern uint16_t shim_now_ms;
+int64_t shim_clock_ms(void);
+void shim_advance_to(int64_t t_ms);
+
+/* pending timers, the earliest being fired without moving the clock back */
+int64_t shim_next_timer_ms(void);	/* INT64_MAX when there is none */
+bool shim_fire_timer(void);
+
+/* persistent storage, which may be pointed at memory shared with others */
+struct shim_persist_entry {
+	uint32_t key;
+	int size;
+	uint8_t data[PERSIST_DATA_MAX_LENGTH];
+};
+
+struct shim_persist {
+	struct shim_persist_entry entries[SHIM_PERSIST_KEYS];
+	unsigned count;
+	unsigned long writes;
+};
+
+extern struct shim_persist *shim_persist;
+
+/* watch state and the handlers subscribed to its changes */
+extern BatteryChargeState shim_battery;
+extern bool shim_connected;
+extern AppLaunchReason shim_launch_reason;
+extern int32_t shim_wakeup_time;	/* 0 when no wakeup is scheduled */
+extern unsigned long shim_app_launches;	/* calls to worker_launch_app */
+extern BatteryStateHandler shim_battery_handler;
+extern ConnectionHandlers shim_connection_handlers;
+extern TickHandler shim_tick_handler;
+extern TimeUnits shim_tick_units;
+
+/* AppMessage: the outbox waits for shim_outbox_done() once sent */
+extern DictionaryIterator shim_inbox;
+extern DictionaryIterator shim_outbox;
+extern bool shim_outbox_pending;
+DictionaryIterator *shim_inbox_begin(void);
+void shim_deliver(void);
+void shim_outbox_done(AppMessageResult result);
+
+/* window stack, the bottom window being at index 0 */
+unsigned shim_window_count(void);
+const SimpleMenuSection *shim_menu(unsigned index, void **context);
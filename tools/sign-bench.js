@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * sign-bench: signatures per second of src/js/signer.js
+ *
+ * For each algorithm and payload size, checks that every signing path
+ * agrees with jsSHA, then reports signatures per second for jsSHA keyed
+ * per payload (the former uploader), the cached keyed states, and
+ * crypto.subtle when node provides it.
+ *
+ * Usage: node tools/sign-bench.js [milliseconds per measure]
+ */
+
+var path = require("path");
+var src = path.join(__dirname, "..", "src", "js");
+
+/* the phone resolves modules by bare name */
+var Module = require("module");
+var resolve = Module._resolveFilename;
+Module._resolveFilename = function(request) {
+   if (request === "sha" || request === "signer" || request === "deflate") {
+      return path.join(src, request + ".js");
+   }
+   return resolve.apply(this, arguments);
+};
+
+if (typeof crypto === "undefined") {
+   try {
+      global.crypto = require("crypto").webcrypto;
+   } catch (e) {
+      /* no subtle path on this node */
+   }
+}
+
+var Signer = require("signer").Signer;
+
+var ALGORITHMS = ["SHA-1", "SHA-224", "SHA-256", "SHA-384", "SHA-512"];
+var MODES = ["jssha", "cached", "subtle"];
+var KEY = "3f1a9c0e5b7d2468ace013579bdf0246";
+var LINE = "2016-01-01T00:00:00Z,-,60,61";
+var PAYLOADS = [
+   { name: "1 line", text: LINE },
+   { name: "8 lines", text: new Array(9).join(LINE + "\n").slice(0, -1) },
+   { name: "64 lines", text: new Array(65).join(LINE + "\n").slice(0, -1) }
+];
+
+var duration = parseInt(process.argv[2] || "500", 10);
+
+function now() {
+   var t = process.hrtime();
+   return t[0] * 1000 + t[1] / 1e6;
+}
+
+/* signatures per second, signing one payload after the other */
+function measure(signer, text, callback) {
+   var count = 0;
+   var start = now();
+
+   function next() {
+      if (now() - start >= duration) {
+         callback(count * 1000 / (now() - start));
+         return;
+      }
+      count += 1;
+      signer.sign(text, "TEXT", function() {
+         /* keep the stack flat for synchronous signers */
+         if (count % 256 === 0) setImmediate(next);
+         else next();
+      });
+   }
+
+   next();
+}
+
+function signersFor(algo) {
+   return MODES.map(function(mode) {
+      return new Signer(algo, KEY, "HEX", "HEX", { mode: mode });
+   }).filter(function(signer, i) {
+      /* unavailable modes fall back to another one */
+      return signer.mode === MODES[i];
+   });
+}
+
+var jobs = [];
+
+ALGORITHMS.forEach(function(algo) {
+   PAYLOADS.forEach(function(payload) {
+      jobs.push({ algo: algo, payload: payload, signers: signersFor(algo) });
+   });
+});
+
+function check(job, callback) {
+   var expected = job.signers[0].signSync(job.payload.text, "TEXT");
+   var pending = job.signers.length;
+
+   job.signers.forEach(function(signer) {
+      signer.sign(job.payload.text, "TEXT", function(signature) {
+         if (signature !== expected) {
+            console.error(job.algo + " " + signer.mode + ": got "
+             + signature + ", expected " + expected);
+            process.exitCode = 1;
+         }
+         pending -= 1;
+         if (pending === 0) callback();
+      });
+   });
+}
+
+function pad(str, width) {
+   while (str.length < width) str += " ";
+   return str;
+}
+
+function runJob(index) {
+   if (index >= jobs.length) return;
+   var job = jobs[index];
+   var results = [];
+
+   check(job, function() {
+      (function runSigner(i) {
+         if (i >= job.signers.length) {
+            console.log(pad(job.algo, 9) + pad(job.payload.name, 10)
+             + results.join("  "));
+            runJob(index + 1);
+            return;
+         }
+         measure(job.signers[i], job.payload.text, function(rate) {
+            results.push(pad(job.signers[i].mode, 7)
+             + pad(Math.round(rate).toString(10), 9));
+            runSigner(i + 1);
+         });
+      })(0);
+   });
+}
+
+console.log("signatures per second, " + duration + " ms per measure");
+runJob(0);
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2016, Natacha Porté
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Local stand-in for the upload endpoint, logging the arrival of each
+ * event and its age in seconds, and reporting age percentiles on exit.
+ *
+ * Usage: node tools/trace-receiver.js [port [data field]]
+ *
+ * Accepts any of the upload formats (CSV, columnar JSON, deflated CSV)
+ * in multipart or URL-encoded forms, and always answers 200.
+ */
+
+var http = require("http");
+var zlib = require("zlib");
+
+var port = parseInt(process.argv[2] || "8080", 10);
+var data_field = process.argv[3] || "data";
+var ages = [];
+
+/* extract form fields from a request body */
+function parseForm(type, body) {
+   var result = {};
+   var boundary = /boundary=(?:"([^"]+)"|([^;]+))/.exec(type || "");
+
+   if (boundary) {
+      var parts = body.split("--" + (boundary[1] || boundary[2]));
+      for (var i = 0; i < parts.length; i += 1) {
+         var split = parts[i].indexOf("\r\n\r\n");
+         var name = /name="([^"]*)"/.exec(parts[i].slice(0, split));
+         if (split < 0 || !name) continue;
+         result[name[1]] = parts[i].slice(split + 4).replace(/\r\n$/, "");
+      }
+   } else {
+      body.split("&").forEach(function(pair) {
+         var kv = pair.split("=");
+         result[decodeURIComponent(kv.shift().replace(/\+/g, " "))]
+          = decodeURIComponent(kv.join("=").replace(/\+/g, " "));
+      });
+   }
+
+   return result;
+}
+
+/* event times, in seconds since the epoch, of a payload in any format */
+function eventTimes(payload) {
+   var result = [];
+
+   if (payload.charAt(0) === "{") {
+      var columns = JSON.parse(payload);
+      var t = columns.time;
+      for (var i = 0; i < columns.dt.length; i += 1) {
+         t += columns.dt[i];
+         result.push(t);
+      }
+      return result;
+   }
+
+   if (!/^\d{4}-/.test(payload)) {
+      payload = zlib.inflateSync(Buffer.from(payload, "base64")).toString();
+   }
+
+   payload.split("\n").forEach(function(line) {
+      if (line) result.push(Math.floor(Date.parse(line.split(",")[0]) / 1000));
+   });
+   return result;
+}
+
+function percentile(sorted, p) {
+   return sorted[Math.min(sorted.length - 1,
+    Math.floor(sorted.length * p / 100))];
+}
+
+function report() {
+   var sorted = ages.slice().sort(function(a, b) { return a - b; });
+
+   if (sorted.length === 0) {
+      console.log("No events received");
+   } else {
+      console.log(sorted.length + " events, age p50 "
+       + percentile(sorted, 50) + " s, p90 " + percentile(sorted, 90)
+       + " s, p99 " + percentile(sorted, 99) + " s, max "
+       + sorted[sorted.length - 1] + " s");
+   }
+   process.exit(0);
+}
+
+http.createServer(function(req, res) {
+   var chunks = [];
+
+   req.on("data", function(chunk) { chunks.push(chunk); });
+   req.on("end", function() {
+      var now = Date.now() / 1000;
+      var fields = parseForm(req.headers["content-type"],
+       Buffer.concat(chunks).toString());
+      var times = [];
+
+      try {
+         times = eventTimes(fields[data_field] || "");
+      } catch (e) {
+         console.log("Unreadable payload: " + e.message);
+      }
+
+      for (var i = 0; i < times.length; i += 1) {
+         var age = Math.round(now - times[i]);
+         ages.push(age);
+         console.log(new Date(now * 1000).toISOString() + " event "
+          + new Date(times[i] * 1000).toISOString() + " age " + age + " s");
+      }
+
+      res.writeHead(200, { "Content-Type": "text/plain" });
+      res.end("OK\n");
+   });
+}).listen(port, function() {
+   console.log("Listening on port " + port + ", field " + data_field);
+});
+
+process.on("SIGINT", report);
+process.on("SIGTERM", report);
@@ -18,32 +18,140 @@
 
 #include "../src/storage.h"
 
-static struct event current_page[PAGE_LENGTH];
-static unsigned index;
+/* values shared with the app are persisted under its message keys */
+#define MSG_KEYS_ONLY
+#include "../src/messages.h"
+
+#undef TRACE_FRESHNESS
+
+static struct page current_page;
+static struct session_index sessions;
+static uint32_t saved_session_seq;	/* next_seq of the saved index */
 static BatteryChargeState previous;
+static time_t last_app_launch;
+
+/* cursor of the phone, read again at each tick and connection change */
+static bool has_cursor;
+static uint32_t acked_seq;
+
+/* samples confirming the current state, only kept in RAM and only taken
+ * when enabled from the configuration page */
+static time_t last_event_time;
+static time_t last_sample_time;
+
+#define SAMPLE_UNIT HOUR_UNIT
+#define SAMPLE_MIN_SPAN (3 * 3600)	/* plateau worth a summary record */
+
+#ifdef TRACE_FRESHNESS
+static struct trace_entry trace[PAGE_LENGTH];
+static time_t trace_time;
+static uint16_t trace_time_ms;
+#endif
+
+/* unsynced backlog above which a reconnection triggers a sync */
+#define SYNC_TARGET_BACKLOG (PAGE_LENGTH * 3 / 4)
+#define SYNC_LAUNCH_INTERVAL 3600
 
 /******************************
  * LOW LEVEL EVENT MANAGEMENT *
  ******************************/
 
+/* the phone cursor is updated by the app behind the worker's back */
 static void
-append_event(struct event *event) {
-	int ret;
+read_cursor(void) {
+	has_cursor = persist_exists(MSG_KEY_LAST_SEQ);
+	acked_seq = has_cursor ? persist_read_int(MSG_KEY_LAST_SEQ) : 0;
+}
+
+/* move the bounds of the indexed session holding seq to its new time */
+static void
+session_refold(uint32_t seq, const struct event *event) {
+	for (uint32_t id = sessions.next_id; id > 0; id -= 1) {
+		struct session *session = session_get(&sessions, id - 1);
+
+		if (!session || session->last_seq < seq) return;
+		if (session->first_seq > seq) continue;
+		if (session->first_seq == seq) session->start = event->time;
+		if (session->last_seq == seq) session->end = event->time;
+		return;
+	}
+}
 
-	if (index >= PAGE_LENGTH) {
-		APP_LOG(APP_LOG_LEVEL_ERROR,
-		    "invalid value %u for index", index);
+/*
+ * The slot of a new event holds the oldest one. Events acknowledged by the
+ * phone are safe in its queue, but when the phone has been away for long,
+ * the oldest event may not have reached it yet: it is then folded into the
+ * next one rather than dropped.
+ * A level change that follows takes over its starting point: its previous
+ * level, the start of the worker, or an unknown level after an anomalous
+ * value or a stop. A sample confirming its level is replaced by it.
+ * Otherwise the oldest event is dropped, which only loses a sample that
+ * later events supersede, or a stop or a value that the next start or
+ * anomalous value reports again.
+ */
+static void
+fold_oldest(void) {
+	uint32_t seq = current_page.next_seq - PAGE_LENGTH;
+	struct event *oldest = page_event(&current_page, seq);
+	struct event *next = page_event(&current_page, seq + 1);
+
+	/* without phone, there is no cursor and the ring simply wraps, and a
+	 * cursor beyond the log is from before it restarted */
+	if (!oldest || !next || !has_cursor
+	    || (seq <= acked_seq && acked_seq < current_page.next_seq))
 		return;
+
+	if (next->before <= UNKNOWN) {
+		if (oldest->before <= APP_STARTED)
+			next->before = oldest->before;
+		else if (oldest->before != SAMPLE)
+			next->before = UNKNOWN;
+	} else if (next->before == SAMPLE && next->after == oldest->after
+	    && oldest->before <= APP_STARTED) {
+		*next = *oldest;
+
+		/* the index may already hold the sample at its later time */
+		if (seq + 1 < sessions.next_seq)
+			session_refold(seq + 1, next);
 	}
+}
+
+/* add an event to the page in RAM, committed with the next append */
+static void
+push_event(struct event *event) {
+	if (current_page.next_seq > PAGE_LENGTH) fold_oldest();
+	current_page.events[current_page.next_seq % PAGE_LENGTH] = *event;
+	current_page.next_seq += 1;
+}
+
+/* the index is rebuilt from the page when read, so it is only saved
+ * before the page overwrites events that the saved copy lacks */
+static void
+save_sessions(void) {
+	if (session_write(&sessions)) saved_session_seq = sessions.next_seq;
+}
+
+static void
+append_event(struct event *event) {
+	push_event(event);
+	page_write(&current_page);
+
+	/* also folds the events pushed since the last append */
+	session_catch_up(&sessions, &current_page);
+	if (sessions.next_seq - saved_session_seq >= PAGE_LENGTH / 2)
+		save_sessions();
 
-	current_page[index] = *event;
-	index = (index + 1) % PAGE_LENGTH;
+#ifdef TRACE_FRESHNESS
+	unsigned slot = (current_page.next_seq - 1) % PAGE_LENGTH;
+	time_t now;
+	uint16_t now_ms;
 
-	ret = persist_write_data(1, current_page, sizeof current_page);
-	if (ret < 0 || (unsigned)ret != sizeof current_page)
-		APP_LOG(APP_LOG_LEVEL_ERROR,
-		    "unexpected return value %d for persist_wride_data",
-		    ret);
+	time_ms(&now, &now_ms);
+	trace[slot].handler_ms = trace_time_ms;
+	trace[slot].flush_ms = (now - trace_time) * 1000
+	    + now_ms - trace_time_ms;
+	persist_write_data(TRACE_KEY, trace, sizeof trace);
+#endif
 }
 
 static uint8_t
@@ -56,13 +164,36 @@ convert_state(BatteryChargeState *state) {
  * HIGH LEVEL EVENTS *
  *********************/
 
+/* summarize a long plateau into a record pushed before the next event,
+ * so that it costs no write of its own */
+static void
+fold_samples(void) {
+	struct event summary;
+
+	if (last_sample_time - last_event_time >= SAMPLE_MIN_SPAN) {
+		summary.time = last_sample_time;
+		summary.before = SAMPLE;
+		summary.after = convert_state(&previous);
+		if (summary.after != ANOMALOUS_VALUE) push_event(&summary);
+	}
+
+	last_sample_time = 0;
+}
+
 static void
 new_event(uint8_t before, uint8_t after) {
 	struct event event;
 
+#ifdef TRACE_FRESHNESS
+	event.time = trace_time;
+#else
 	event.time = time(0);
+#endif
 	event.before = before;
 	event.after = after;
+
+	fold_samples();
+	last_event_time = event.time;
 	append_event(&event);
 }
 
@@ -102,6 +233,9 @@ battery_update(BatteryChargeState *before, BatteryChargeState *after) {
 
 static void
 battery_handler(BatteryChargeState charge) {
+#ifdef TRACE_FRESHNESS
+	time_ms(&trace_time, &trace_time_ms);
+#endif
 	if (charge.charge_percent == previous.charge_percent
 	    && charge.is_charging == previous.is_charging)
 		return;
@@ -110,43 +244,88 @@ battery_handler(BatteryChargeState charge) {
 	previous = charge;
 }
 
+static void
+sample_handler(struct tm *tick_time, TimeUnits units_changed) {
+	BatteryChargeState charge = battery_state_service_peek();
+
+	read_cursor();
+
+	/* read at each tick, so that the setting applies without restart */
+	if (persist_read_int(MSG_KEY_CFG_LEVEL_SAMPLING) <= 0) {
+		last_sample_time = 0;
+		return;
+	}
+
+	/* a change without callback is recorded as a regular event */
+	if (charge.charge_percent != previous.charge_percent
+	    || charge.is_charging != previous.is_charging) {
+		battery_handler(charge);
+		return;
+	}
+
+	last_sample_time = time(0);
+}
+
+static void
+connection_handler(bool connected) {
+	time_t now = time(0);
+
+	read_cursor();
+	if (!connected
+	    || persist_read_int(MSG_KEY_CFG_WAKEUP_TIME) <= 0
+	    || now - last_app_launch < SYNC_LAUNCH_INTERVAL
+	    || page_backlog(&current_page, acked_seq) < SYNC_TARGET_BACKLOG)
+		return;
+
+	/* the ring is about to overwrite unsynced events */
+	last_app_launch = now;
+	worker_launch_app();
+}
+
 /***********************************
  * INITIALIZATION AND FINALIZATION *
  ***********************************/
 
 static bool
 init(void) {
-	int ret = persist_read_data(1, current_page, sizeof current_page);
-
-	if (ret == E_DOES_NOT_EXIST) {
-		APP_LOG(APP_LOG_LEVEL_INFO,
-		    "no configuration found, initializing to zero");
-		memset(current_page, 0, sizeof current_page);
-	} else if (ret != sizeof current_page) {
-		APP_LOG(APP_LOG_LEVEL_ERROR,
-		    "unexpected return value %d for persist_read_data",
-		    ret);
-		return false;
-	} else if (current_page[0].time) {
-		for (index = 1;
-		    index < PAGE_LENGTH
-		    && current_page[index - 1].time < current_page[index].time;
-		    index += 1);
-	} else
-		index = 0;
+	if (!page_read(&current_page)) return false;
+
+	/* move a single-key page to the commit slots */
+	if (persist_exists(LEGACY_PAGE_KEY) && page_write(&current_page))
+		persist_delete(LEGACY_PAGE_KEY);
+
+	session_read(&sessions, &current_page);
+	save_sessions();
+	read_cursor();
+
+#ifdef TRACE_FRESHNESS
+	if (persist_read_data(TRACE_KEY, trace, sizeof trace) != sizeof trace)
+		memset(trace, 0, sizeof trace);
+	time_ms(&trace_time, &trace_time_ms);
+#endif
 
 	previous = battery_state_service_peek();
 	app_started();
 
 	battery_state_service_subscribe(&battery_handler);
+	connection_service_subscribe((ConnectionHandlers) {
+	    .pebble_app_connection_handler = &connection_handler,
+	});
+	tick_timer_service_subscribe(SAMPLE_UNIT, &sample_handler);
 
 	return true;
 }
 
 static void
 deinit(void) {
+	tick_timer_service_unsubscribe();
+	connection_service_unsubscribe();
 	battery_state_service_unsubscribe();
+#ifdef TRACE_FRESHNESS
+	time_ms(&trace_time, &trace_time_ms);
+#endif
 	app_stopped();
+	save_sessions();
 }
 
 int